@@ -0,0 +1,354 @@
+#include <benchmark/benchmark.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "bulk_load.hpp"
+#include "flat_combining.hpp"
+#include "key_generator.hpp"
+#include "lock_free_skip_list.hpp"
+#include "perf_counters.hpp"
+#include "sharded_memtable.hpp"
+#include "simple_memtable.hpp"
+#include "simple_skip_list.hpp"
+#include "spin_lock.hpp"
+#include "unrolled_skip_list.hpp"
+#include "wal.hpp"
+
+// Usage:
+//   bench_memtable --benchmark_filter='SkipList/NoLock/get/zipf'
+//   bench_memtable --perf_counters --benchmark_filter='get/uniform/1048576'
+// Every benchmark is named <skiplist>/<lock>/<workload>/<distribution> and
+// is swept over key counts (the /N suffix) and thread counts (threads:N).
+// --perf_counters adds cycles, instructions, L1d, LLC and dTLB misses and
+// branch misses per operation, and IPC, to every benchmark's counters.
+
+// NOTE(shiwen): set by --perf_counters.
+bool perf_counters_mode = false;
+
+// NOTE(shiwen): counts the calling thread's hardware events from its
+// construction to Report, one measured phase. Outside --perf_counters, or
+// where perf_event_open is not allowed, it counts nothing and the benchmark
+// reports throughput alone.
+class PerfPhase {
+ public:
+  PerfPhase() {
+    if (!perf_counters_mode) {
+      return;
+    }
+    counters_ = PerfCounters::Open();
+    if (counters_ == nullptr) {
+      auto error = errno;
+      static std::once_flag warned;
+      std::call_once(warned, [error] {
+        std::fprintf(stderr,
+                     "perf counters unavailable (perf_event_open: %s), "
+                     "check /proc/sys/kernel/perf_event_paranoid\n",
+                     std::strerror(error));
+      });
+      return;
+    }
+    counters_->Start();
+  }
+
+  // NOTE(shiwen): an iteration runs ops_per_iteration operations. Every
+  // thread adds its counts, the sums are divided by the iterations of all
+  // threads.
+  void Report(benchmark::State& state, double ops_per_iteration) {
+    if (counters_ == nullptr) {
+      return;
+    }
+    auto sample = counters_->Stop();
+    for (size_t i = 0; i < static_cast<size_t>(PerfEvent::Kcount); i++) {
+      auto event = static_cast<PerfEvent>(i);
+      if (sample.Valid(event)) {
+        state.counters[PerfEventName(event) + "_per_op"] =
+            benchmark::Counter(sample.Count(event) / ops_per_iteration,
+                               benchmark::Counter::kAvgIterations);
+      }
+    }
+    if (sample.Valid(PerfEvent::Kcycles) &&
+        sample.Valid(PerfEvent::Kinstructions) &&
+        sample.Count(PerfEvent::Kcycles) > 0) {
+      state.counters["IPC"] = benchmark::Counter(
+          sample.Count(PerfEvent::Kinstructions) /
+              sample.Count(PerfEvent::Kcycles),
+          benchmark::Counter::kAvgThreads);
+    }
+  }
+
+ private:
+  std::unique_ptr<PerfCounters> counters_;
+};
+
+enum class Workload { Kput, Kget, Kmixed, Kmulti_get };
+
+auto WorkloadName(Workload workload) -> std::string {
+  switch (workload) {
+    case Workload::Kput:
+      return "put";
+    case Workload::Kget:
+      return "get";
+    case Workload::Kmixed:
+      return "mixed";
+    case Workload::Kmulti_get:
+      return "multiget";
+  }
+  return "unknown";
+}
+
+// NOTE(shiwen): put starts from an empty table, get, multiget and mixed (one
+// put every Kmixed_put_ratio operations) start from a table holding every key.
+enum { Kmixed_put_ratio = 10 };
+// NOTE(shiwen): multiget looks up this many keys per iteration.
+enum { Kmulti_get_batch = 64 };
+
+// NOTE(shiwen): a sharded table is cut evenly over the keys of the run, so
+// every thread's writes spread over all shards.
+template <typename MemTableType>
+auto MakeMemTable(uint32_t key_count, int threads)
+    -> std::unique_ptr<MemTableType> {
+  if constexpr (requires { MemTableType::SplitsFromSample({}, 1); }) {
+    std::vector<uint32_t> sample;
+    for (uint32_t key = 1; key <= key_count; key++) {
+      sample.push_back(key);
+    }
+    return std::make_unique<MemTableType>(MemTableType::SplitsFromSample(
+        sample, static_cast<size_t>(std::max(threads, 1) * 4)));
+  } else {
+    return std::make_unique<MemTableType>();
+  }
+}
+
+template <typename MemTableType>
+void BM_MemTable(benchmark::State& state, Workload workload,
+                 KeyDistribution dist) {
+  static std::unique_ptr<MemTableType> mt;
+  auto key_count = static_cast<uint32_t>(state.range(0));
+  if (state.thread_index() == 0) {
+    mt = MakeMemTable<MemTableType>(key_count, state.threads());
+    if (workload != Workload::Kput) {
+      for (uint32_t key = 1; key <= key_count; key++) {
+        mt->Put(key, key);
+      }
+    }
+  }
+
+  auto gen = KeyGenerator(dist, key_count, state.thread_index(),
+                          state.threads());
+  uint32_t value;
+  uint64_t found = 0;
+  uint64_t op_count = 0;
+  uint32_t keys[Kmulti_get_batch];
+  uint32_t values[Kmulti_get_batch];
+  bool hits[Kmulti_get_batch];
+  auto perf = PerfPhase{};
+  for (auto _ : state) {
+    if (workload == Workload::Kmulti_get) {
+      for (auto& key : keys) {
+        key = gen.Next();
+      }
+      found += mt->MultiGet(keys, values, hits);
+      continue;
+    }
+    auto key = gen.Next();
+    if (workload == Workload::Kput ||
+        (workload == Workload::Kmixed && ++op_count % Kmixed_put_ratio == 0)) {
+      mt->Put(key, key);
+    } else {
+      found += mt->Get(key, value);
+    }
+  }
+  perf.Report(state, workload == Workload::Kmulti_get ? Kmulti_get_batch : 1);
+  benchmark::DoNotOptimize(found);
+  state.SetItemsProcessed(
+      state.iterations() *
+      (workload == Workload::Kmulti_get ? Kmulti_get_batch : 1));
+
+  if (state.thread_index() == 0) {
+    uint64_t entries = 0;
+    mt->Scan(0, std::numeric_limits<uint32_t>::max(),
+             [&entries](const uint32_t&, const uint32_t&) { entries++; });
+    state.counters["entries"] = static_cast<double>(entries);
+    state.counters["bytes_per_entry"] =
+        entries == 0 ? 0.0
+                     : static_cast<double>(mt->ApproximateMemoryUsage()) /
+                           static_cast<double>(entries);
+    if constexpr (requires { mt->Combines(); }) {
+      state.counters["ops_per_combine"] =
+          mt->Combines() == 0
+              ? 0.0
+              : static_cast<double>(mt->CombinedOperations()) /
+                    static_cast<double>(mt->Combines());
+    }
+    if constexpr (requires { mt->StateLock().Stats(); }) {
+      auto stats = mt->StateLock().Stats();
+      state.counters["lock_contended"] = stats.ContendedRatio();
+      state.counters["lock_wait_ns"] = stats.MeanWaitNanos();
+      state.counters["lock_max_wait_ns"] =
+          static_cast<double>(stats.max_wait_nanos_);
+    }
+    mt.reset();
+  }
+}
+
+template <typename MemTableType>
+void RegisterMemTable(const std::string& name, bool multi_writer) {
+  auto max_threads =
+      static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+  for (auto workload : {Workload::Kput, Workload::Kget, Workload::Kmixed,
+                        Workload::Kmulti_get}) {
+    for (auto dist : {KeyDistribution::Ksequential, KeyDistribution::Kuniform,
+                      KeyDistribution::Kzipfian, KeyDistribution::Khot_set}) {
+      auto bm_name =
+          name + "/" + WorkloadName(workload) + "/" + DistributionName(dist);
+      auto bm = benchmark::RegisterBenchmark(
+          bm_name.c_str(), BM_MemTable<MemTableType>, workload, dist);
+      bm->Arg(1 << 10)->Arg(1 << 16)->Arg(1 << 20)->UseRealTime();
+      // NOTE(shiwen): without a lock only SkipList takes concurrent writers.
+      if (workload == Workload::Kget || workload == Workload::Kmulti_get ||
+          multi_writer) {
+        bm->ThreadRange(1, max_threads);
+      } else {
+        bm->Threads(1);
+      }
+    }
+  }
+}
+
+template <template <typename, typename> class S>
+void RegisterSkipList(const std::string& name, bool lock_free_put) {
+  RegisterMemTable<MemTable<uint32_t, uint32_t, NaiveSpinLock,
+                            S<uint32_t, uint32_t>>>(name + "/NaiveSpinLock",
+                                                    true);
+  RegisterMemTable<
+      MemTable<uint32_t, uint32_t, std::mutex, S<uint32_t, uint32_t>>>(
+      name + "/Mutex", true);
+  RegisterMemTable<MemTable<uint32_t, uint32_t, NoLock, S<uint32_t, uint32_t>>>(
+      name + "/NoLock", lock_free_put);
+}
+
+// NOTE(shiwen): replay a log of range(0) puts of uniform keys with range(1)
+// parser threads.
+void BM_WalRecovery(benchmark::State& state) {
+  auto key_count = static_cast<uint32_t>(state.range(0));
+  auto path = "/tmp/bench_wal_recovery." + std::to_string(key_count);
+  std::remove(path.c_str());
+  {
+    auto wal = Wal::Open(path, WalOptions{WalSyncPolicy::Knone});
+    auto mt = MemTable<>{0, wal.get()};
+    auto gen = KeyGenerator(KeyDistribution::Kuniform, key_count, 0, 1);
+    for (uint32_t i = 0; i < key_count; i++) {
+      mt.Put(gen.Next(), i);
+    }
+  }
+  WalRecoveryStats stats;
+  auto perf = PerfPhase{};
+  for (auto _ : state) {
+    auto mt = MemTable<>{};
+    stats = mt.Recover(path, static_cast<size_t>(state.range(1)));
+    benchmark::DoNotOptimize(stats);
+  }
+  // NOTE(shiwen): only the driving thread is counted, not the parsers.
+  perf.Report(state, static_cast<double>(stats.operations_));
+  state.SetItemsProcessed(state.iterations() * stats.operations_);
+  state.SetBytesProcessed(state.iterations() * stats.bytes_);
+  std::remove(path.c_str());
+}
+
+enum class BuildMode { Kput, Ksorted, Kunsorted, Kbalanced };
+
+// NOTE(shiwen): build a SkipList of range(0) uniform keys by Puts or by a
+// bulk load of the same pairs, presorted or not.
+void BM_Build(benchmark::State& state, BuildMode mode) {
+  auto key_count = static_cast<uint32_t>(state.range(0));
+  auto gen = KeyGenerator(KeyDistribution::Kuniform, key_count, 0, 1);
+  std::vector<std::pair<uint32_t, uint32_t>> input;
+  for (uint32_t i = 0; i < key_count; i++) {
+    input.emplace_back(gen.Next(), i);
+  }
+  auto sorted = SortForBulkLoad<uint32_t, uint32_t>(
+      input.begin(), input.end(), DefaultComparator<uint32_t>{}, 1);
+  BulkLoadOptions options;
+  options.heights_ = mode == BuildMode::Kbalanced ? TowerHeights::Kbalanced
+                                                  : TowerHeights::Krandom;
+  options.sorted_ = mode != BuildMode::Kunsorted;
+  const auto& source = mode == BuildMode::Kunsorted ? input : sorted;
+  auto perf = PerfPhase{};
+  for (auto _ : state) {
+    auto list = SkipList<uint32_t, uint32_t>{};
+    if (mode == BuildMode::Kput) {
+      for (const auto& [key, value] : input) {
+        list.Put(key, value);
+      }
+    } else {
+      list.BulkLoad(source.begin(), source.end(), options);
+    }
+    benchmark::DoNotOptimize(list.Count());
+  }
+  perf.Report(state, key_count);
+  state.SetItemsProcessed(state.iterations() * key_count);
+}
+
+int main(int argc, char** argv) {
+  // NOTE(shiwen): take --perf_counters out before benchmark sees it.
+  auto kept = 1;
+  for (auto i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--perf_counters") == 0) {
+      perf_counters_mode = true;
+    } else {
+      argv[kept++] = argv[i];
+    }
+  }
+  argc = kept;
+  RegisterSkipList<SkipList>("SkipList", true);
+  RegisterMemTable<MemTable<uint32_t, uint32_t, BackoffSpinLock>>(
+      "SkipList/BackoffSpinLock", true);
+  RegisterMemTable<MemTable<uint32_t, uint32_t, TicketLock>>(
+      "SkipList/TicketLock", true);
+  RegisterMemTable<MemTable<uint32_t, uint32_t, McsLock>>("SkipList/McsLock",
+                                                          true);
+  RegisterMemTable<FlatCombiningMemTable<>>(
+      "SkipList/FlatCombining<NaiveSpinLock>", true);
+  RegisterMemTable<
+      MemTable<uint32_t, uint32_t, InstrumentedLock<NaiveSpinLock>>>(
+      "SkipList/Instrumented<NaiveSpinLock>", true);
+  RegisterMemTable<MemTable<uint32_t, uint32_t, InstrumentedLock<McsLock>>>(
+      "SkipList/Instrumented<McsLock>", true);
+  RegisterMemTable<ShardedMemTable<>>("Sharded/SkipList/NaiveSpinLock", true);
+  RegisterSkipList<NaiveSkipList>("NaiveSkipList", false);
+  RegisterSkipList<UnrolledSkipList>("UnrolledSkipList", false);
+  auto max_threads =
+      static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+  benchmark::RegisterBenchmark("WalRecovery", BM_WalRecovery)
+      ->ArgsProduct({{1 << 16, 1 << 20},
+                     benchmark::CreateRange(1, max_threads, 2)})
+      ->UseRealTime()
+      ->Unit(benchmark::kMillisecond);
+  for (auto [name, mode] : {std::pair{"put", BuildMode::Kput},
+                            std::pair{"sorted", BuildMode::Ksorted},
+                            std::pair{"unsorted", BuildMode::Kunsorted},
+                            std::pair{"balanced", BuildMode::Kbalanced}}) {
+    benchmark::RegisterBenchmark(("Build/" + std::string(name)).c_str(),
+                                 BM_Build, mode)
+        ->Arg(1 << 20)
+        ->Unit(benchmark::kMillisecond);
+  }
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -0,0 +1,131 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "random_gen.hpp"
+
+enum class KeyDistribution { Ksequential, Kuniform, Kzipfian, Khot_set };
+
+inline auto DistributionName(KeyDistribution dist) -> std::string {
+  switch (dist) {
+    case KeyDistribution::Ksequential:
+      return "seq";
+    case KeyDistribution::Kuniform:
+      return "uniform";
+    case KeyDistribution::Kzipfian:
+      return "zipf";
+    case KeyDistribution::Khot_set:
+      return "hotset";
+  }
+  return "unknown";
+}
+
+// NOTE(shiwen): draws keys in [1, key_count], one generator per benchmark
+// thread. Key 0 is avoided, it used to be the head key.
+class KeyGenerator {
+ public:
+  // zipfian skew, the YCSB default.
+  static constexpr double Ktheta = 0.99;
+  // hot set: Khot_op_percent% of the operations go to Khot_key_percent% of
+  // the keys.
+  enum { Khot_key_percent = 10 };
+  enum { Khot_op_percent = 90 };
+
+  explicit KeyGenerator(KeyDistribution dist, uint32_t key_count,
+                        uint32_t thread_index, uint32_t thread_count)
+      : dist_(dist),
+        key_count_(key_count),
+        next_(thread_index),
+        stride_(thread_count),
+        rnd_(0x9e3779b9u * (thread_index + 1)) {
+    if (dist_ == KeyDistribution::Kzipfian) {
+      zeta_n_ = Zeta(key_count_);
+      alpha_ = 1.0 / (1.0 - Ktheta);
+      eta_ = (1.0 - std::pow(2.0 / key_count_, 1.0 - Ktheta)) /
+             (1.0 - Zeta(2) / zeta_n_);
+    }
+  }
+
+  auto Next() -> uint32_t {
+    switch (dist_) {
+      case KeyDistribution::Ksequential: {
+        auto key = next_ % key_count_;
+        next_ += stride_;
+        return key + 1;
+      }
+      case KeyDistribution::Kuniform:
+        return Uniform(key_count_) + 1;
+      case KeyDistribution::Kzipfian:
+        // NOTE(shiwen): scramble the ranks, so hot keys are not neighbours.
+        return static_cast<uint32_t>(Hash(NextZipfRank()) % key_count_) + 1;
+      case KeyDistribution::Khot_set: {
+        auto hot_keys = std::max<uint32_t>(
+            1, static_cast<uint64_t>(key_count_) * Khot_key_percent / 100);
+        if (Uniform(100) < Khot_op_percent) {
+          return Uniform(hot_keys) + 1;
+        }
+        auto cold_keys = std::max<uint32_t>(1, key_count_ - hot_keys);
+        return hot_keys + Uniform(cold_keys) + 1;
+      }
+    }
+    return 1;
+  }
+
+ private:
+  auto Uniform(uint32_t n) -> uint32_t {
+    // NOTE(shiwen): Random only has 31 bits, combine two draws.
+    auto bits = (static_cast<uint64_t>(rnd_.Next()) << 31) | rnd_.Next();
+    return static_cast<uint32_t>(bits % n);
+  }
+
+  auto NextZipfRank() -> uint64_t {
+    auto u = static_cast<double>(Uniform(1u << 30)) / (1u << 30);
+    auto uz = u * zeta_n_;
+    if (uz < 1.0) {
+      return 0;
+    }
+    if (uz < 1.0 + std::pow(0.5, Ktheta)) {
+      return 1;
+    }
+    return static_cast<uint64_t>(key_count_ *
+                                 std::pow(eta_ * u - eta_ + 1.0, alpha_));
+  }
+
+  // NOTE(shiwen): O(n), memoized because every benchmark thread and every
+  // benchmark repetition builds its own generator.
+  static auto Zeta(uint64_t n) -> double {
+    static std::mutex mutex;
+    static std::map<uint64_t, double> cache;
+    std::lock_guard guard(mutex);
+    if (auto it = cache.find(n); it != cache.end()) {
+      return it->second;
+    }
+    auto sum = 0.0;
+    for (uint64_t i = 1; i <= n; i++) {
+      sum += 1.0 / std::pow(static_cast<double>(i), Ktheta);
+    }
+    cache.emplace(n, sum);
+    return sum;
+  }
+
+  static auto Hash(uint64_t x) -> uint64_t {
+    // NOTE(shiwen): splitmix64 finalizer.
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+  }
+
+  KeyDistribution dist_;
+  uint32_t key_count_;
+  uint64_t next_;
+  uint32_t stride_;
+  Random rnd_;
+  double zeta_n_{0};
+  double alpha_{0};
+  double eta_{0};
+};
@@ -0,0 +1,170 @@
+#pragma once
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+
+// NOTE(shiwen): the hardware events a PerfCounters counts.
+enum class PerfEvent : uint32_t {
+  Kcycles,
+  Kinstructions,
+  Kl1d_misses,
+  Kllc_misses,
+  Kdtlb_misses,
+  Kbranch_misses,
+  Kcount
+};
+
+inline auto PerfEventName(PerfEvent event) -> std::string {
+  switch (event) {
+    case PerfEvent::Kcycles:
+      return "cycles";
+    case PerfEvent::Kinstructions:
+      return "instructions";
+    case PerfEvent::Kl1d_misses:
+      return "L1d_misses";
+    case PerfEvent::Kllc_misses:
+      return "LLC_misses";
+    case PerfEvent::Kdtlb_misses:
+      return "dTLB_misses";
+    case PerfEvent::Kbranch_misses:
+      return "branch_misses";
+    case PerfEvent::Kcount:
+      break;
+  }
+  return "unknown";
+}
+
+// NOTE(shiwen): what one phase counted. An event the kernel or the CPU does
+// not offer is not valid.
+struct PerfSample {
+  std::array<double, static_cast<size_t>(PerfEvent::Kcount)> counts_{};
+  std::array<bool, static_cast<size_t>(PerfEvent::Kcount)> valid_{};
+
+  auto Count(PerfEvent event) const -> double {
+    return counts_[static_cast<size_t>(event)];
+  }
+  auto Valid(PerfEvent event) const -> bool {
+    return valid_[static_cast<size_t>(event)];
+  }
+};
+
+// NOTE(shiwen): perf_event_open counters of the calling thread, user space
+// only, so they open with the default perf_event_paranoid of 2. Every event
+// is opened on its own: one the PMU lacks leaves the others counting, and
+// when there are more events than hardware counters the kernel multiplexes
+// them and Stop scales each count up by the share of the phase it ran.
+class PerfCounters {
+ public:
+  // NOTE(shiwen): nullptr if not a single event opens, e.g. in a container
+  // without perf_event_open or a VM without a virtual PMU. errno is that of
+  // the last attempt.
+  static auto Open() -> std::unique_ptr<PerfCounters> {
+    auto counters = std::unique_ptr<PerfCounters>(new PerfCounters());
+    auto opened = false;
+    for (size_t i = 0; i < counters->fds_.size(); i++) {
+      counters->fds_[i] = OpenEvent(static_cast<PerfEvent>(i));
+      opened |= counters->fds_[i] >= 0;
+    }
+    return opened ? std::move(counters) : nullptr;
+  }
+
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+  ~PerfCounters() {
+    for (auto fd : fds_) {
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
+  }
+
+  void Start() {
+    for (auto fd : fds_) {
+      if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+      }
+    }
+  }
+
+  auto Stop() -> PerfSample {
+    for (auto fd : fds_) {
+      if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+      }
+    }
+    auto sample = PerfSample{};
+    for (size_t i = 0; i < fds_.size(); i++) {
+      // NOTE(shiwen): value, time enabled, time running.
+      uint64_t values[3];
+      if (fds_[i] < 0 || read(fds_[i], values, sizeof(values)) !=
+                             static_cast<ssize_t>(sizeof(values))) {
+        continue;
+      }
+      // NOTE(shiwen): an event that never got a counter tells nothing.
+      if (values[2] == 0) {
+        continue;
+      }
+      sample.counts_[i] = static_cast<double>(values[0]) *
+                          static_cast<double>(values[1]) /
+                          static_cast<double>(values[2]);
+      sample.valid_[i] = true;
+    }
+    return sample;
+  }
+
+ private:
+  PerfCounters() { fds_.fill(-1); }
+
+  static auto OpenEvent(PerfEvent event) -> int {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    auto cache = [&attr](uint64_t cache_id) {
+      attr.type = PERF_TYPE_HW_CACHE;
+      attr.config = cache_id | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    };
+    switch (event) {
+      case PerfEvent::Kcycles:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+      case PerfEvent::Kinstructions:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+      case PerfEvent::Kl1d_misses:
+        cache(PERF_COUNT_HW_CACHE_L1D);
+        break;
+      case PerfEvent::Kllc_misses:
+        cache(PERF_COUNT_HW_CACHE_LL);
+        break;
+      case PerfEvent::Kdtlb_misses:
+        cache(PERF_COUNT_HW_CACHE_DTLB);
+        break;
+      case PerfEvent::Kbranch_misses:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+        break;
+      case PerfEvent::Kcount:
+        return -1;
+    }
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(
+        syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+  }
+
+  std::array<int, static_cast<size_t>(PerfEvent::Kcount)> fds_;
+};
@@ -0,0 +1,259 @@
+#pragma once
+#include <sys/mman.h>
+
+#include <atomic>
+#include <cassert>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "spin_lock.hpp"
+
+template <typename T>
+concept ArenaConcept = requires(T arena, size_t bytes) {
+  { arena.Allocate(bytes) } -> std::same_as<char*>;
+  { arena.AllocateAligned(bytes) } -> std::same_as<char*>;
+  { arena.MemoryUsage() } -> std::same_as<size_t>;
+};
+
+constexpr size_t KhugePageSize = 2 << 20;
+
+// NOTE(shiwen): a bump allocator. Memory is carved out of large cache-line
+// aligned blocks and only released when the arena dies, so freeing a skiplist
+// costs O(blocks) instead of O(nodes). Not thread safe, callers must serialize
+// allocations. Use BasicConcurrentArena for concurrent writers.
+template <size_t KblockSize = 1 << 20, bool KhugePage = false>
+class BasicArena {
+ public:
+  static_assert(KblockSize % KcacheLineSize == 0);
+  static_assert(!KhugePage || KblockSize % KhugePageSize == 0,
+                "huge page blocks must be a multiple of the huge page size");
+
+  explicit BasicArena() = default;
+  BasicArena(const BasicArena&) = delete;
+  BasicArena& operator=(const BasicArena&) = delete;
+  ~BasicArena() {
+    for (auto it = cleanups_.rbegin(); it != cleanups_.rend(); ++it) {
+      it->second(it->first);
+    }
+    for (auto& [block, bytes] : blocks_) {
+      FreeBlock(block, bytes);
+    }
+  }
+
+  auto Allocate(size_t bytes) -> char* {
+    assert(bytes > 0);
+    if (bytes <= alloc_bytes_remaining_) {
+      auto result = alloc_ptr_;
+      alloc_ptr_ += bytes;
+      alloc_bytes_remaining_ -= bytes;
+      return result;
+    }
+    return AllocateFallback(bytes);
+  }
+
+  auto AllocateAligned(size_t bytes,
+                       size_t align = alignof(std::max_align_t)) -> char* {
+    assert((align & (align - 1)) == 0);
+    auto current_mod = reinterpret_cast<uintptr_t>(alloc_ptr_) & (align - 1);
+    auto slop = current_mod == 0 ? 0 : align - current_mod;
+    auto needed = bytes + slop;
+    if (needed <= alloc_bytes_remaining_) {
+      auto result = alloc_ptr_ + slop;
+      alloc_ptr_ += needed;
+      alloc_bytes_remaining_ -= needed;
+      return result;
+    }
+    // NOTE(shiwen): blocks are cache-line aligned, which covers any align we
+    // hand out.
+    assert(align <= KcacheLineSize);
+    return AllocateFallback(bytes);
+  }
+
+  // NOTE(shiwen): construct an object in the arena. Objects that are not
+  // trivially destructible get their destructor run when the arena dies.
+  template <typename V, typename... Args>
+  auto New(Args&&... args) -> V* {
+    auto memory = AllocateAligned(sizeof(V), alignof(V));
+    auto object = new (memory) V(std::forward<Args>(args)...);
+    if constexpr (!std::is_trivially_destructible_v<V>) {
+      RegisterCleanup(object);
+    }
+    return object;
+  }
+
+  template <typename V>
+  void RegisterCleanup(V* object) {
+    cleanups_.emplace_back(object,
+                           [](void* ptr) { static_cast<V*>(ptr)->~V(); });
+  }
+
+  // NOTE(shiwen): can be called concurrently with allocations.
+  auto MemoryUsage() const -> size_t {
+    return memory_usage_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  auto AllocateFallback(size_t bytes) -> char* {
+    if (bytes > KblockSize / 4) {
+      // Object is more than a quarter of our block size. Allocate it
+      // separately to avoid wasting too much space in leftover bytes.
+      return AllocateNewBlock(bytes);
+    }
+    // We waste the remaining space in the current block.
+    alloc_ptr_ = AllocateNewBlock(KblockSize);
+    alloc_bytes_remaining_ = KblockSize;
+
+    auto result = alloc_ptr_;
+    alloc_ptr_ += bytes;
+    alloc_bytes_remaining_ -= bytes;
+    return result;
+  }
+
+  auto AllocateNewBlock(size_t bytes) -> char* {
+    auto granularity = KhugePage ? KhugePageSize : KcacheLineSize;
+    bytes = (bytes + granularity - 1) & ~(granularity - 1);
+    char* block = nullptr;
+    if constexpr (KhugePage) {
+      // Try explicit huge pages first, then fall back to transparent ones.
+      auto addr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if (addr == MAP_FAILED) {
+        addr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED) {
+          throw std::bad_alloc();
+        }
+        madvise(addr, bytes, MADV_HUGEPAGE);
+      }
+      block = static_cast<char*>(addr);
+    } else {
+      block = static_cast<char*>(std::aligned_alloc(KcacheLineSize, bytes));
+      if (block == nullptr) {
+        throw std::bad_alloc();
+      }
+    }
+    blocks_.emplace_back(block, bytes);
+    memory_usage_.fetch_add(bytes + sizeof(std::pair<char*, size_t>),
+                            std::memory_order_relaxed);
+    return block;
+  }
+
+  static void FreeBlock(char* block, size_t bytes) {
+    if constexpr (KhugePage) {
+      munmap(block, bytes);
+    } else {
+      free(block);
+    }
+  }
+
+  char* alloc_ptr_{nullptr};
+  size_t alloc_bytes_remaining_{0};
+  std::vector<std::pair<char*, size_t>> blocks_;
+  std::vector<std::pair<void*, void (*)(void*)>> cleanups_;
+  std::atomic<size_t> memory_usage_{0};
+};
+
+using Arena = BasicArena<>;
+using HugePageArena = BasicArena<KhugePageSize, true>;
+
+// NOTE(shiwen): a thread safe arena for the multi-writer skiplist. Small
+// allocations are served from per-core shards, each guarded by its own spin
+// lock and refilled in KshardBlockSize chunks from a shared BasicArena, so
+// writers on different cores rarely touch the same cache line.
+template <size_t KblockSize = 1 << 20, bool KhugePage = false>
+class BasicConcurrentArena {
+ public:
+  enum { KshardBlockSize = 8 << 10 };
+
+  explicit BasicConcurrentArena()
+      : shard_mask_(ShardCount() - 1),
+        shards_(std::make_unique<Shard[]>(ShardCount())) {}
+  BasicConcurrentArena(const BasicConcurrentArena&) = delete;
+  BasicConcurrentArena& operator=(const BasicConcurrentArena&) = delete;
+
+  auto Allocate(size_t bytes) -> char* { return AllocateAligned(bytes, 1); }
+
+  auto AllocateAligned(size_t bytes,
+                       size_t align = alignof(std::max_align_t)) -> char* {
+    assert((align & (align - 1)) == 0 && align <= KcacheLineSize);
+    if (bytes > KshardBlockSize / 4) {
+      std::lock_guard guard(arena_lock_);
+      return arena_.AllocateAligned(bytes, align);
+    }
+
+    auto& shard = shards_[ShardIndex() & shard_mask_];
+    std::lock_guard guard(shard.lock_);
+    auto current_mod = reinterpret_cast<uintptr_t>(shard.free_begin_) &
+                       (align - 1);
+    auto slop = current_mod == 0 ? 0 : align - current_mod;
+    if (bytes + slop > shard.free_bytes_) {
+      // We waste the tail of the old chunk, at most a quarter of it.
+      std::lock_guard arena_guard(arena_lock_);
+      shard.free_begin_ = arena_.AllocateAligned(KshardBlockSize,
+                                                 KcacheLineSize);
+      shard.free_bytes_ = KshardBlockSize;
+      slop = 0;
+    }
+    auto result = shard.free_begin_ + slop;
+    shard.free_begin_ += bytes + slop;
+    shard.free_bytes_ -= bytes + slop;
+    return result;
+  }
+
+  template <typename V, typename... Args>
+  auto New(Args&&... args) -> V* {
+    auto memory = AllocateAligned(sizeof(V), alignof(V));
+    auto object = new (memory) V(std::forward<Args>(args)...);
+    if constexpr (!std::is_trivially_destructible_v<V>) {
+      RegisterCleanup(object);
+    }
+    return object;
+  }
+
+  template <typename V>
+  void RegisterCleanup(V* object) {
+    std::lock_guard guard(arena_lock_);
+    arena_.RegisterCleanup(object);
+  }
+
+  auto MemoryUsage() const -> size_t { return arena_.MemoryUsage(); }
+
+ private:
+  struct alignas(KcacheLineSize) Shard {
+    NaiveSpinLock lock_;
+    char* free_begin_{nullptr};
+    size_t free_bytes_{0};
+  };
+
+  static auto ShardCount() -> size_t {
+    size_t count = 1;
+    while (count < std::thread::hardware_concurrency()) {
+      count <<= 1;
+    }
+    return count;
+  }
+
+  static auto ShardIndex() -> size_t {
+    static std::atomic<size_t> next_index{0};
+    thread_local auto index =
+        next_index.fetch_add(1, std::memory_order_relaxed);
+    return index;
+  }
+
+  BasicArena<KblockSize, KhugePage> arena_;
+  NaiveSpinLock arena_lock_;
+  const size_t shard_mask_;
+  std::unique_ptr<Shard[]> shards_;
+};
+
+using ConcurrentArena = BasicConcurrentArena<>;
+using HugePageConcurrentArena = BasicConcurrentArena<KhugePageSize, true>;
@@ -0,0 +1,125 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// NOTE(shiwen): how a bulk load picks tower heights. Krandom draws them the
+// way Put does. Kbalanced gives the i-th key (counting from 1) one level for
+// every factor of p in i, so every p-th key reaches level 1, every p^2-th
+// level 2 and so on, and a search takes at most p hops on every level.
+enum class TowerHeights { Krandom, Kbalanced };
+
+struct BulkLoadOptions {
+  // NOTE(shiwen): the input is sorted by key without duplicates, skip the
+  // sort.
+  bool sorted_{false};
+  TowerHeights heights_{TowerHeights::Krandom};
+  size_t sort_threads_{std::max(1u, std::thread::hardware_concurrency())};
+  // NOTE(shiwen): the entries the list will ever hold, 0 if unknown. The bulk
+  // loading constructors cap the tower heights for good at the level this
+  // many need, so a list that keeps growing after the load should leave it 0.
+  // Random access input larger than this raises it to the input size.
+  size_t expected_entries_{0};
+};
+
+inline auto BalancedHeight(uint64_t index, uint64_t p, int32_t max_level)
+    -> int32_t {
+  auto level = 0;
+  while (level < max_level && index % p == 0) {
+    index /= p;
+    level++;
+  }
+  return level;
+}
+
+// NOTE(shiwen): the entries a bulk loaded list sizes its towers for, 0 for
+// no cap unless options.expected_entries_ asks for one.
+template <typename It>
+auto ExpectedEntries(It first, It last, const BulkLoadOptions& options)
+    -> size_t {
+  if constexpr (std::random_access_iterator<It>) {
+    if (options.expected_entries_ != 0) {
+      return std::max(options.expected_entries_,
+                      static_cast<size_t>(last - first));
+    }
+  }
+  return options.expected_entries_;
+}
+
+// NOTE(shiwen): [first + bounds[i], first + bounds[i + 1]) are sorted runs,
+// merge them pairwise into one sorted range. Stable, equal elements keep the
+// order of their runs.
+template <typename It, typename L>
+void MergeSortedRuns(It first, const std::vector<size_t>& bounds, L less) {
+  auto runs = bounds.size() - 1;
+  for (size_t width = 1; width < runs; width *= 2) {
+    for (size_t i = 0; i + width < runs; i += 2 * width) {
+      auto end = std::min(i + 2 * width, runs);
+      std::inplace_merge(first + bounds[i], first + bounds[i + width],
+                         first + bounds[end], less);
+    }
+  }
+}
+
+// NOTE(shiwen): std::stable_sort of up to threads slices at once, then one
+// merge pass per doubling of the slice size.
+template <typename It, typename L>
+void ParallelStableSort(It first, It last, L less, size_t threads) {
+  constexpr size_t Kmin_slice = 1 << 14;
+  auto size = static_cast<size_t>(last - first);
+  threads = std::max<size_t>(1, std::min(threads, size / Kmin_slice));
+  if (threads == 1) {
+    std::stable_sort(first, last, less);
+    return;
+  }
+  std::vector<size_t> bounds;
+  for (size_t i = 0; i <= threads; i++) {
+    bounds.push_back(size * i / threads);
+  }
+  std::vector<std::thread> sorters;
+  for (size_t i = 1; i < threads; i++) {
+    sorters.emplace_back([first, &bounds, &less, i] {
+      std::stable_sort(first + bounds[i], first + bounds[i + 1], less);
+    });
+  }
+  std::stable_sort(first, first + bounds[1], less);
+  for (auto& sorter : sorters) {
+    sorter.join();
+  }
+  MergeSortedRuns(first, bounds, less);
+}
+
+// NOTE(shiwen): copy the (key, value) pairs in [first, last) and sort them by
+// key, keeping only the last pair of every key, as n Puts would.
+template <typename K, typename V, typename It, typename C>
+auto SortForBulkLoad(It first, It last, const C& compare, size_t threads)
+    -> std::vector<std::pair<K, V>> {
+  std::vector<std::pair<K, V>> entries;
+  if constexpr (std::random_access_iterator<It>) {
+    entries.reserve(static_cast<size_t>(last - first));
+  }
+  for (; first != last; ++first) {
+    const auto& [key, value] = *first;
+    entries.emplace_back(key, value);
+  }
+  ParallelStableSort(
+      entries.begin(), entries.end(),
+      [&compare](const std::pair<K, V>& lhs, const std::pair<K, V>& rhs) {
+        return compare(lhs.first, rhs.first) < 0;
+      },
+      threads);
+  auto out = entries.begin();
+  for (auto it = entries.begin(); it != entries.end(); ++it) {
+    auto next = it + 1;
+    if (next != entries.end() && compare(it->first, next->first) == 0) {
+      continue;
+    }
+    *out++ = std::move(*it);
+  }
+  entries.erase(out, entries.end());
+  return entries;
+}
@@ -0,0 +1,142 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+
+// NOTE(shiwen): varint32 as in LevelDB, 7 bits per byte, low bits first, the
+// high bit set on every byte but the last.
+constexpr int KmaxVarint32Length = 5;
+
+inline auto EncodeVarint32(char* dst, uint32_t value) -> char* {
+  auto ptr = reinterpret_cast<uint8_t*>(dst);
+  while (value >= 0x80) {
+    *ptr++ = static_cast<uint8_t>(value | 0x80);
+    value >>= 7;
+  }
+  *ptr++ = static_cast<uint8_t>(value);
+  return reinterpret_cast<char*>(ptr);
+}
+
+inline auto VarintLength(uint32_t value) -> int {
+  auto length = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    length++;
+  }
+  return length;
+}
+
+// NOTE(shiwen): no bounds check, the input was written by EncodeVarint32.
+inline auto DecodeVarint32(const char* src, uint32_t* value) -> const char* {
+  auto ptr = reinterpret_cast<const uint8_t*>(src);
+  uint32_t result = 0;
+  for (uint32_t shift = 0; shift <= 28; shift += 7) {
+    auto byte = *ptr++;
+    result |= static_cast<uint32_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      break;
+    }
+  }
+  *value = result;
+  return reinterpret_cast<const char*>(ptr);
+}
+
+// NOTE(shiwen): copy bytes into the arena behind their varint32 length.
+template <typename A>
+auto EncodeLengthPrefixed(std::string_view bytes, A& arena) -> const char* {
+  auto size = static_cast<uint32_t>(bytes.size());
+  auto dst = arena.Allocate(VarintLength(size) + bytes.size());
+  auto data = EncodeVarint32(dst, size);
+  if (!bytes.empty()) {
+    std::memcpy(data, bytes.data(), bytes.size());
+  }
+  return dst;
+}
+
+inline auto DecodeLengthPrefixed(const char* src) -> std::string_view {
+  uint32_t size;
+  auto data = DecodeVarint32(src, &size);
+  return std::string_view(data, size);
+}
+
+// NOTE(shiwen): fixed width integers are stored little endian, like LevelDB.
+inline void EncodeFixed32(char* dst, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    dst[i] = static_cast<char>(value >> (8 * i));
+  }
+}
+
+inline void EncodeFixed64(char* dst, uint64_t value) {
+  for (int i = 0; i < 8; i++) {
+    dst[i] = static_cast<char>(value >> (8 * i));
+  }
+}
+
+inline auto DecodeFixed32(const char* src) -> uint32_t {
+  auto ptr = reinterpret_cast<const uint8_t*>(src);
+  uint32_t result = 0;
+  for (int i = 0; i < 4; i++) {
+    result |= static_cast<uint32_t>(ptr[i]) << (8 * i);
+  }
+  return result;
+}
+
+inline auto DecodeFixed64(const char* src) -> uint64_t {
+  auto ptr = reinterpret_cast<const uint8_t*>(src);
+  uint64_t result = 0;
+  for (int i = 0; i < 8; i++) {
+    result |= static_cast<uint64_t>(ptr[i]) << (8 * i);
+  }
+  return result;
+}
+
+// NOTE(shiwen): DecodeVarint32 that stops at limit, nullptr if the varint
+// runs past it or is longer than KmaxVarint32Length.
+inline auto DecodeVarint32(const char* src, const char* limit,
+                           uint32_t* value) -> const char* {
+  uint32_t result = 0;
+  for (uint32_t shift = 0; shift <= 28 && src < limit; shift += 7) {
+    auto byte = static_cast<uint8_t>(*src++);
+    result |= static_cast<uint32_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      *value = result;
+      return src;
+    }
+  }
+  return nullptr;
+}
+
+// NOTE(shiwen): the bytes a key or value is stored as outside of memory.
+// Byte strings are their own bytes, other types must be trivially copyable
+// and are stored as their object representation, so files are only read back
+// on machines of the same endianness.
+template <typename T>
+auto ObjectBytes(const T& object) -> std::string_view {
+  if constexpr (std::is_same_v<T, std::string_view>) {
+    return object;
+  } else {
+    static_assert(std::is_trivially_copyable_v<T>);
+    return std::string_view(reinterpret_cast<const char*>(&object),
+                            sizeof(T));
+  }
+}
+
+// NOTE(shiwen): the inverse of ObjectBytes, byte strings point into bytes.
+template <typename T>
+auto ObjectFromBytes(std::string_view bytes) -> T {
+  if constexpr (std::is_same_v<T, std::string_view>) {
+    return bytes;
+  } else {
+    T object;
+    std::memcpy(&object, bytes.data(), sizeof(T));
+    return object;
+  }
+}
+
+// NOTE(shiwen): ObjectFromBytes copies sizeof(T) bytes of a fixed size
+// object, readers of untrusted bytes check the size first.
+template <typename T>
+auto FitsObject(size_t size) -> bool {
+  return std::is_same_v<T, std::string_view> || size == sizeof(T);
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <concepts>
+#include <cstdint>
+#include <string_view>
+
+// NOTE(shiwen): a comparator returns <0, 0 or >0 as lhs sorts before, equal
+// to or after rhs.
+template <typename T>
+struct DefaultComparator {
+  auto operator()(const T& lhs, const T& rhs) const -> int {
+    return lhs < rhs ? -1 : (rhs < lhs ? 1 : 0);
+  }
+};
+
+// NOTE(shiwen): byte strings compare bytewise as unsigned chars, like memcmp.
+template <>
+struct DefaultComparator<std::string_view> {
+  auto operator()(std::string_view lhs, std::string_view rhs) const -> int {
+    return lhs.compare(rhs);
+  }
+
+  // NOTE(shiwen): the first 8 bytes as a big-endian integer, zero padded.
+  // Keys with different prefixes compare like their prefixes.
+  static auto Prefix(std::string_view key) -> uint64_t {
+    uint64_t prefix = 0;
+    for (size_t i = 0; i < sizeof(uint64_t); i++) {
+      prefix <<= 8;
+      if (i < key.size()) {
+        prefix |= static_cast<uint8_t>(key[i]);
+      }
+    }
+    return prefix;
+  }
+};
+
+// NOTE(shiwen): a comparator with an order preserving Prefix, if
+// Prefix(a) < Prefix(b) then a sorts before b. Skiplists keep the prefix of
+// every key in its node and only compare whole keys when prefixes are equal.
+template <typename C, typename T>
+concept PrefixComparator = requires(const C& compare, const T& key) {
+  { compare.Prefix(key) } -> std::same_as<uint64_t>;
+};
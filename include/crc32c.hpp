@@ -0,0 +1,71 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+// NOTE(shiwen): CRC-32C (Castagnoli), the checksum of LevelDB and RocksDB
+// files. SSE4.2 has an instruction for it, elsewhere a byte at a time table.
+constexpr uint32_t Kcrc32cPolynomial = 0x82F63B78;  // reflected 0x1EDC6F41
+
+constexpr auto MakeCrc32cTable() -> std::array<uint32_t, 256> {
+  std::array<uint32_t, 256> table{};
+  for (uint32_t i = 0; i < 256; i++) {
+    auto crc = i;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ ((crc & 1) != 0 ? Kcrc32cPolynomial : 0);
+    }
+    table[i] = crc;
+  }
+  return table;
+}
+
+inline constexpr auto Kcrc32cTable = MakeCrc32cTable();
+
+// NOTE(shiwen): crc is the CRC-32C of some bytes, returns that of the same
+// bytes followed by data[0, n).
+inline auto Crc32cExtend(uint32_t crc, const char* data, size_t n)
+    -> uint32_t {
+  auto ptr = reinterpret_cast<const uint8_t*>(data);
+  auto end = ptr + n;
+  crc = ~crc;
+#if defined(__SSE4_2__)
+  uint64_t crc64 = crc;
+  while (end - ptr >= 8) {
+    uint64_t word;
+    std::memcpy(&word, ptr, sizeof(word));
+    crc64 = _mm_crc32_u64(crc64, word);
+    ptr += 8;
+  }
+  crc = static_cast<uint32_t>(crc64);
+  while (ptr != end) {
+    crc = _mm_crc32_u8(crc, *ptr++);
+  }
+#else
+  while (ptr != end) {
+    crc = Kcrc32cTable[(crc ^ *ptr++) & 0xFF] ^ (crc >> 8);
+  }
+#endif
+  return ~crc;
+}
+
+inline auto Crc32c(const char* data, size_t n) -> uint32_t {
+  return Crc32cExtend(0, data, n);
+}
+
+// NOTE(shiwen): the CRC of bytes that embed CRCs is weak, so stored CRCs are
+// rotated and offset first, as in LevelDB.
+constexpr uint32_t KcrcMaskDelta = 0xA282EAD8;
+
+inline auto MaskCrc(uint32_t crc) -> uint32_t {
+  return ((crc >> 15) | (crc << 17)) + KcrcMaskDelta;
+}
+
+inline auto UnmaskCrc(uint32_t masked) -> uint32_t {
+  auto rot = masked - KcrcMaskDelta;
+  return (rot >> 17) | (rot << 15);
+}
@@ -0,0 +1,186 @@
+#pragma once
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+#include "spin_lock.hpp"
+
+// NOTE(shiwen): epoch based reclamation, one domain for the whole process.
+// A thread pins the domain while it holds pointers into a shared structure.
+// Whatever is unlinked from the structure is retired with the epoch it was
+// retired in and may be reused once the epoch is two past that, every thread
+// that could still reach it has unpinned by then. The epoch only moves on
+// once every pinned thread has seen the current one, so a thread that stays
+// pinned holds reclamation back, never other readers or writers.
+class EpochDomain {
+ public:
+  // NOTE(shiwen): a thread's pin, owned by one live thread at a time and
+  // handed on to a new thread once its owner exits.
+  struct alignas(KcacheLineSize) Record {
+    // NOTE(shiwen): epoch << 1 | Kpinned while pinned, 0 otherwise.
+    std::atomic<uint64_t> state_{0};
+    uint32_t depth_{0};
+    std::atomic<bool> owned_{false};
+    Record* next_{nullptr};
+  };
+
+  enum : uint64_t { Kpinned = 1 };
+
+  // NOTE(shiwen): never destroyed, threads may still unpin while statics are
+  // torn down.
+  static auto Global() -> EpochDomain& {
+    static auto* domain = new EpochDomain();
+    return *domain;
+  }
+
+  EpochDomain(const EpochDomain&) = delete;
+  EpochDomain& operator=(const EpochDomain&) = delete;
+
+  auto Epoch() const -> uint64_t {
+    return epoch_.load(std::memory_order_seq_cst);
+  }
+
+  // NOTE(shiwen): pins nest, only the outermost pin announces an epoch. The
+  // announcement is an exchange, so it is ordered before the loads of the
+  // pinned section and continues the release sequence of the last unpin.
+  auto Pin() -> Record& {
+    auto& record = LocalRecord();
+    if (record.depth_++ > 0) {
+      return record;
+    }
+    auto epoch = epoch_.load(std::memory_order_relaxed);
+    while (true) {
+      record.state_.exchange(epoch << 1 | Kpinned, std::memory_order_seq_cst);
+      // NOTE(shiwen): the epoch may have moved on before the announcement
+      // became visible, announce the current one.
+      auto current = epoch_.load(std::memory_order_seq_cst);
+      if (current == epoch) {
+        return record;
+      }
+      epoch = current;
+    }
+  }
+
+  void Unpin(Record& record) {
+    assert(record.depth_ > 0);
+    if (--record.depth_ == 0) {
+      record.state_.store(0, std::memory_order_release);
+    }
+  }
+
+  // NOTE(shiwen): move the epoch on by one if every pinned thread has seen the
+  // current one. Returns the epoch after the attempt.
+  auto TryAdvance() -> uint64_t {
+    auto epoch = epoch_.load(std::memory_order_seq_cst);
+    for (auto record = records_.load(std::memory_order_acquire);
+         record != nullptr; record = record->next_) {
+      auto state = record->state_.load(std::memory_order_seq_cst);
+      if ((state & Kpinned) != 0 && (state >> 1) != epoch) {
+        return epoch;
+      }
+    }
+    if (epoch_.compare_exchange_strong(epoch, epoch + 1,
+                                       std::memory_order_seq_cst)) {
+      return epoch + 1;
+    }
+    return epoch;
+  }
+
+ private:
+  EpochDomain() = default;
+
+  auto LocalRecord() -> Record& {
+    thread_local struct Owner {
+      Record* record_;
+      ~Owner() { record_->owned_.store(false, std::memory_order_release); }
+    } owner{Acquire()};
+    return *owner.record_;
+  }
+
+  // NOTE(shiwen): records are never freed, a thread takes over the record of
+  // one that exited or pushes a new one.
+  auto Acquire() -> Record* {
+    for (auto record = records_.load(std::memory_order_acquire);
+         record != nullptr; record = record->next_) {
+      auto owned = false;
+      if (record->owned_.compare_exchange_strong(owned, true,
+                                                 std::memory_order_acquire)) {
+        return record;
+      }
+    }
+    auto record = new Record();
+    record->owned_.store(true, std::memory_order_relaxed);
+    record->next_ = records_.load(std::memory_order_relaxed);
+    while (!records_.compare_exchange_weak(record->next_, record,
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed)) {
+    }
+    return record;
+  }
+
+  alignas(KcacheLineSize) std::atomic<uint64_t> epoch_{1};
+  std::atomic<Record*> records_{nullptr};
+};
+
+// NOTE(shiwen): pins the global domain for its lifetime. A guard belongs to
+// the thread that made it, copies pin that thread again.
+class EpochGuard {
+ public:
+  EpochGuard() : record_(&EpochDomain::Global().Pin()) {}
+  EpochGuard(const EpochGuard& /*other*/) : EpochGuard() {}
+  auto operator=([[maybe_unused]] const EpochGuard& other) -> EpochGuard& {
+    assert(record_ == other.record_);
+    return *this;
+  }
+  ~EpochGuard() { EpochDomain::Global().Unpin(*record_); }
+
+  // NOTE(shiwen): the epoch this thread announced. Pointers read under a guard
+  // stay valid under a later one that announces the same epoch.
+  auto Epoch() const -> uint64_t {
+    return record_->state_.load(std::memory_order_relaxed) >> 1;
+  }
+
+ private:
+  EpochDomain::Record* record_;
+};
+
+// NOTE(shiwen): objects waiting for every thread that might reach them to
+// unpin. Retired in epoch order, so the oldest are reclaimed first.
+template <typename P>
+class RetireList {
+ public:
+  // NOTE(shiwen): ptr must already be unlinked, a thread that pins from now
+  // on can not reach it.
+  void Retire(P* ptr) {
+    std::lock_guard<NaiveSpinLock> guard(lock_);
+    retired_.emplace_back(EpochDomain::Global().Epoch(), ptr);
+  }
+
+  // NOTE(shiwen): try to advance the epoch, then hand every retired object no
+  // pinned thread can reach to release. Returns how many were released.
+  template <typename F>
+  auto Reclaim(F&& release) -> size_t {
+    auto epoch = EpochDomain::Global().TryAdvance();
+    std::lock_guard<NaiveSpinLock> guard(lock_);
+    size_t count = 0;
+    while (!retired_.empty() && retired_.front().first + 2 <= epoch) {
+      release(retired_.front().second);
+      retired_.pop_front();
+      count++;
+    }
+    return count;
+  }
+
+  auto Size() -> size_t {
+    std::lock_guard<NaiveSpinLock> guard(lock_);
+    return retired_.size();
+  }
+
+ private:
+  NaiveSpinLock lock_;
+  std::deque<std::pair<uint64_t, P*>> retired_;
+};
@@ -0,0 +1,161 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "simple_memtable.hpp"
+#include "spin_lock.hpp"
+#include "write_batch.hpp"
+
+// NOTE(shiwen): a MemTable whose Puts and Deletes are applied by flat
+// combining. A writer publishes its operation in a slot and whichever writer
+// gets hold of combiner_lock_ collects every published operation into one
+// WriteBatch and applies it with Write: one sequence range, one Wal record,
+// one state_lock_ acquisition and one sorted pass over the skiplist that
+// starts each search from the previous key's predecessors. The other writers
+// wait on their own slot for the result instead of fighting over the lock.
+// Operations that meet in one batch are concurrent, if two of them write the
+// same key the later one in the batch wins and the other is never visible.
+// Reads, Write and DeleteRange are those of M.
+template <typename M = MemTable<>>
+class FlatCombiningMemTable : public M {
+ public:
+  using memtable_type = M;
+  using typename M::key_type;
+  using typename M::value_type;
+
+  template <typename... Args>
+  explicit FlatCombiningMemTable(Args&&... args)
+      : M(std::forward<Args>(args)...),
+        slot_count_(std::bit_ceil(
+            std::max<size_t>(4, 2 * std::thread::hardware_concurrency()))),
+        slots_(std::make_unique<Slot[]>(slot_count_)) {}
+
+  auto Put(const key_type& key, const value_type& value) -> bool {
+    return Combine(key, value, false);
+  }
+
+  auto Delete(const key_type& key) -> bool {
+    return Combine(key, value_type{}, true);
+  }
+
+  // NOTE(shiwen): batches applied and the operations in them, their ratio is
+  // the mean batch size.
+  auto Combines() const -> uint64_t {
+    return combines_.load(std::memory_order_relaxed);
+  }
+
+  auto CombinedOperations() const -> uint64_t {
+    return combined_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  enum SlotState : uint32_t { Kfree, Kclaimed, Kpending, Kdone };
+
+  struct alignas(KcacheLineSize) Slot {
+    std::atomic<uint32_t> state_{Kfree};
+    bool deletion_{false};
+    bool result_{false};
+    key_type key_{};
+    value_type value_{};
+  };
+
+  // NOTE(shiwen): publish the operation, then either combine or wait for a
+  // combiner to apply it. Byte strings are not copied, they stay valid since
+  // their writer waits for the result.
+  auto Combine(const key_type& key, const value_type& value, bool deletion)
+      -> bool {
+    auto& slot = Claim();
+    slot.key_ = key;
+    slot.value_ = value;
+    slot.deletion_ = deletion;
+    slot.state_.store(Kpending, std::memory_order_release);
+
+    auto wait = SpinWait{};
+    while (slot.state_.load(std::memory_order_acquire) != Kdone) {
+      if (combiner_lock_.try_lock()) {
+        ApplyPending();
+        combiner_lock_.unlock();
+        continue;
+      }
+      wait.Pause();
+    }
+    auto result = slot.result_;
+    slot.state_.store(Kfree, std::memory_order_release);
+    return result;
+  }
+
+  // NOTE(shiwen): every thread starts at its own slot, so a slot is only
+  // shared when there are more writers than slots. used_ bounds the slots a
+  // combiner scans to the ones ever claimed.
+  auto Claim() -> Slot& {
+    thread_local auto home =
+        std::hash<std::thread::id>{}(std::this_thread::get_id());
+    auto wait = SpinWait{};
+    for (auto index = home;; index++) {
+      auto& slot = slots_[index & (slot_count_ - 1)];
+      uint32_t expected = Kfree;
+      if (slot.state_.compare_exchange_strong(expected, Kclaimed,
+                                              std::memory_order_acquire,
+                                              std::memory_order_relaxed)) {
+        auto used = (index & (slot_count_ - 1)) + 1;
+        auto seen = used_.load(std::memory_order_relaxed);
+        while (seen < used && !used_.compare_exchange_weak(
+                                  seen, used, std::memory_order_release,
+                                  std::memory_order_relaxed)) {
+        }
+        return slot;
+      }
+      wait.Pause();
+    }
+  }
+
+  // NOTE(shiwen): called with combiner_lock_ held.
+  auto ApplyPending() {
+    batch_.Clear();
+    pending_.clear();
+    auto used = used_.load(std::memory_order_acquire);
+    for (size_t i = 0; i < used; i++) {
+      auto& slot = slots_[i];
+      if (slot.state_.load(std::memory_order_acquire) != Kpending) {
+        continue;
+      }
+      if (slot.deletion_) {
+        batch_.Delete(slot.key_);
+      } else {
+        batch_.Put(slot.key_, slot.value_);
+      }
+      pending_.push_back(&slot);
+    }
+    if (pending_.empty()) {
+      return;
+    }
+    auto result = M::Write(batch_);
+    for (auto slot : pending_) {
+      slot->result_ = result;
+      slot->state_.store(Kdone, std::memory_order_release);
+    }
+    combines_.store(combines_.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+    combined_.store(combined_.load(std::memory_order_relaxed) +
+                        pending_.size(),
+                    std::memory_order_relaxed);
+  }
+
+  const size_t slot_count_;
+  std::unique_ptr<Slot[]> slots_;
+  std::atomic<size_t> used_{0};
+  // NOTE(shiwen): only touched by the combiner.
+  WriteBatch<key_type, value_type> batch_;
+  std::vector<Slot*> pending_;
+  std::atomic<uint64_t> combines_{0};
+  std::atomic<uint64_t> combined_{0};
+  BackoffSpinLock combiner_lock_;
+};
@@ -0,0 +1,85 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+// NOTE(shiwen): wyrand, one 64x64->128 multiply per 64 random bits.
+class WyRand {
+ public:
+  explicit WyRand(uint64_t seed) : state_(seed) {}
+
+  auto Next() -> uint64_t {
+    state_ += 0xa0761d6478bd642fULL;
+    auto product = static_cast<unsigned __int128>(state_) *
+                   (state_ ^ 0xe7037ed1a0b428dbULL);
+    return static_cast<uint64_t>(product >> 64) ^
+           static_cast<uint64_t>(product);
+  }
+
+ private:
+  uint64_t state_;
+};
+
+// NOTE(shiwen): xorshift64*, for targets without a fast 128-bit multiply.
+// The multiplier is odd, so the low zero bits are those of the xorshift
+// state, which runs through every non-zero value.
+class XorShift64 {
+ public:
+  explicit XorShift64(uint64_t seed)
+      : state_(seed == 0 ? 0x9e3779b97f4a7c15ULL : seed) {}
+
+  auto Next() -> uint64_t {
+    state_ ^= state_ >> 12;
+    state_ ^= state_ << 25;
+    state_ ^= state_ >> 27;
+    return state_ * 0x2545f4914f6cdd1dULL;
+  }
+
+ private:
+  uint64_t state_;
+};
+
+// NOTE(shiwen): the shape of a skiplist's towers, fixed at compile time. A
+// node reaches level l with probability Kp^-l, up to Kmax_level. Kp must be
+// a power of two, so a height is one draw of R: the number of trailing
+// groups of log2(Kp) zero bits.
+template <int32_t Kmax = 15, uint32_t Kbranching = 4, typename R = WyRand>
+struct HeightPolicy {
+  static_assert(Kbranching >= 2 && std::has_single_bit(Kbranching));
+
+  using random_type = R;
+  enum : int32_t { Kmax_level = Kmax };
+  enum : uint32_t { Kp = Kbranching };
+  static constexpr int32_t Kbits_per_level = std::countr_zero(Kbranching);
+  static_assert(Kmax_level >= 0 && Kmax_level * Kbits_per_level < 64);
+
+  // NOTE(shiwen): every thread draws from its own generator.
+  static auto RandomLevel(int32_t max_level) -> int32_t {
+    thread_local auto rnd = random_type(static_cast<uint64_t>(
+        std::hash<std::thread::id>{}(std::this_thread::get_id()) ^
+        std::chrono::steady_clock::now().time_since_epoch().count()));
+    auto level = std::countr_zero(rnd.Next()) / Kbits_per_level;
+    return std::min<int32_t>(level, max_level);
+  }
+
+  // NOTE(shiwen): floor(log_Kp(entries)), the level about one of entries
+  // random towers reaches, capped at Kmax_level. Higher levels would be
+  // almost empty. No estimate (0) keeps Kmax_level.
+  static constexpr auto MaxLevelFor(size_t entries) -> int32_t {
+    if (entries == 0) {
+      return Kmax_level;
+    }
+    int32_t level = 0;
+    for (auto reach = entries / Kp; reach > 0 && level < Kmax_level;
+         reach /= Kp) {
+      level++;
+    }
+    return level;
+  }
+};
+
+using DefaultHeightPolicy = HeightPolicy<>;
@@ -0,0 +1,76 @@
+#pragma once
+#include <cstdint>
+#include <limits>
+#include <string_view>
+
+#include "key_slot.hpp"
+
+// NOTE(shiwen): MemTable tags every entry with the sequence number of the
+// write that made it. Versions of one user key sort newest first, so seeking
+// to (key, snapshot sequence) lands on the newest version visible to the
+// snapshot.
+constexpr uint64_t KmaxSequence = std::numeric_limits<uint64_t>::max();
+
+template <typename T>
+struct InternalKey {
+  T user_key_;
+  uint64_t sequence_;
+};
+
+// NOTE(shiwen): orders by user key ascending, then by sequence descending.
+template <typename C>
+struct InternalComparator {
+  C user_comparator_{};
+
+  template <typename T>
+  auto operator()(const InternalKey<T>& lhs, const InternalKey<T>& rhs) const
+      -> int {
+    auto cmp = user_comparator_(lhs.user_key_, rhs.user_key_);
+    if (cmp != 0) {
+      return cmp;
+    }
+    return lhs.sequence_ > rhs.sequence_   ? -1
+           : lhs.sequence_ < rhs.sequence_ ? 1
+                                           : 0;
+  }
+};
+
+// NOTE(shiwen): byte string user keys keep their arena copy and inline prefix,
+// the sequence only breaks ties between versions of one key.
+template <>
+struct KeySlot<InternalKey<std::string_view>> {
+  using view_type = InternalKey<std::string_view>;
+
+  struct Probe {
+    Probe() = default;
+    template <typename C>
+    Probe(const view_type& key, const C& compare)
+        : user_(key.user_key_, compare.user_comparator_),
+          sequence_(key.sequence_) {}
+
+    KeySlot<std::string_view>::Probe user_;
+    uint64_t sequence_{0};
+  };
+
+  KeySlot<std::string_view> user_;
+  uint64_t sequence_;
+
+  template <typename A, typename C>
+  auto Init(const view_type& key, A& arena, const C& compare) {
+    user_.Init(key.user_key_, arena, compare.user_comparator_);
+    sequence_ = key.sequence_;
+  }
+
+  auto Load() const -> view_type { return {user_.Load(), sequence_}; }
+
+  template <typename C>
+  auto Compare(const Probe& probe, const C& compare) const -> int {
+    auto cmp = user_.Compare(probe.user_, compare.user_comparator_);
+    if (cmp != 0) {
+      return cmp;
+    }
+    return sequence_ > probe.sequence_   ? -1
+           : sequence_ < probe.sequence_ ? 1
+                                         : 0;
+  }
+};
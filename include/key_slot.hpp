@@ -0,0 +1,82 @@
+#pragma once
+#include <cstdint>
+#include <new>
+#include <string_view>
+#include <type_traits>
+
+#include "coding.hpp"
+#include "comparator.hpp"
+
+// NOTE(shiwen): the key part of a skiplist node. Searches wrap the key they
+// look for in a Probe once, then compare it against many nodes.
+template <typename T>
+struct KeySlot {
+  using view_type = const T&;
+
+  struct Probe {
+    Probe() = default;
+    template <typename C>
+    Probe(const T& key, const C& /*compare*/) : key_(&key) {}
+
+    const T* key_{nullptr};
+  };
+
+  T k_;
+
+  template <typename A, typename C>
+  auto Init(const T& key, A& arena, const C& /*compare*/) {
+    new (&k_) T(key);
+    if constexpr (!std::is_trivially_destructible_v<T>) {
+      arena.RegisterCleanup(&k_);
+    }
+  }
+
+  auto Load() const -> view_type { return k_; }
+
+  template <typename C>
+  auto Compare(const Probe& probe, const C& compare) const -> int {
+    return compare(k_, *probe.key_);
+  }
+};
+
+// NOTE(shiwen): byte string keys are copied into the arena length-prefixed.
+// With a PrefixComparator the node also keeps the key's prefix inline, so
+// most comparisons never touch the key bytes.
+template <>
+struct KeySlot<std::string_view> {
+  using view_type = std::string_view;
+
+  struct Probe {
+    Probe() = default;
+    template <typename C>
+    Probe(std::string_view key, const C& compare) : key_(key) {
+      if constexpr (PrefixComparator<C, std::string_view>) {
+        prefix_ = compare.Prefix(key);
+      }
+    }
+
+    std::string_view key_;
+    uint64_t prefix_{0};
+  };
+
+  uint64_t prefix_;
+  const char* data_;
+
+  template <typename A, typename C>
+  auto Init(std::string_view key, A& arena, const C& compare) {
+    prefix_ = Probe(key, compare).prefix_;
+    data_ = EncodeLengthPrefixed(key, arena);
+  }
+
+  auto Load() const -> view_type { return DecodeLengthPrefixed(data_); }
+
+  template <typename C>
+  auto Compare(const Probe& probe, const C& compare) const -> int {
+    if constexpr (PrefixComparator<C, std::string_view>) {
+      if (prefix_ != probe.prefix_) {
+        return prefix_ < probe.prefix_ ? -1 : 1;
+      }
+    }
+    return compare(Load(), probe.key_);
+  }
+};
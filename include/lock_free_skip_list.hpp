@@ -1,21 +1,31 @@
 #pragma once
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <cstdint>
 #include <cstdlib>
 #include <ctime>
 #include <iostream>
+#include <iterator>
+#include <span>
+#include <type_traits>
 #include <vector>
 
-#include "random_gen.hpp"
+#include "arena.hpp"
+#include "bulk_load.hpp"
+#include "comparator.hpp"
+#include "height_policy.hpp"
+#include "key_slot.hpp"
+#include "stats.hpp"
+#include "value_slot.hpp"
 
 template <typename T = uint32_t, typename U = uint32_t>
 struct NaiveNode {
   using key_type = T;
   using value_type = U;
   using NaiveNodePtr = NaiveNode*;
-  T k_;
-  U v_;
+  KeySlot<T> k_;
+  ValueSlot<U> v_;
   NaiveNodePtr next_lists_[];
 
   auto static GetNaiveNodeSize(int32_t max_node_level) {
@@ -32,132 +42,435 @@ struct NaiveNode {
 };
 
 // NOTE(shiwen): Multiple threads can read the skiplist at the same time, but
-// write operations must be mutually exclusive.
-template <typename T = uint32_t, typename U = uint32_t>
+// write operations must be mutually exclusive. S collects search path and
+// latency stats, NoStats compiles them out.
+template <typename T = uint32_t, typename U = uint32_t, typename A = Arena,
+          typename C = DefaultComparator<T>, typename H = DefaultHeightPolicy,
+          typename S = NoStats>
 struct NaiveSkipList {
   using key_type = T;
   using value_type = U;
+  using arena_type = A;
+  using comparator_type = C;
   using NaiveNodePtr = NaiveNode<key_type, value_type>*;
 
-  enum { Kmax_level = 15 };  // the height is 16.
-  enum { Kp = 4 };
+  using Probe = typename KeySlot<key_type>::Probe;
+
+  static_assert(ArenaConcept<arena_type>);
+
+  using height_policy = H;
+  using stats_policy = S;
+
+  enum : int32_t { Kmax_level = height_policy::Kmax_level };
+  enum : uint32_t { Kp = height_policy::Kp };
+  enum { Kmulti_get_lanes = 8 };
+  // NOTE(shiwen): declared before head_, the head node lives in the arena.
+  arena_type arena_;
   NaiveNodePtr head_;
   std::atomic<int32_t> level_;  // the skiplist level (initially 0)
+  // NOTE(shiwen): the highest level a node may reach, see
+  // HeightPolicy::MaxLevelFor.
+  const int32_t max_level_;
+  const comparator_type compare_;
+  std::atomic<size_t> entry_count_{0};
+  // NOTE(shiwen): bumped by const searches too.
+  [[no_unique_address]] mutable stats_policy stats_;
 
   // key_type first_key_;
   // key_type last_key_;
 
-  Random rnd_;
-
-  explicit NaiveSkipList();
+  // NOTE(shiwen): expected_entries, if known, caps the tower heights at the
+  // level it needs.
+  explicit NaiveSkipList(const comparator_type& compare = comparator_type{},
+                         size_t expected_entries = 0);
+  // NOTE(shiwen): a list holding the (key, value) pairs in [first, last),
+  // see BulkLoad. options.expected_entries_ may cap the tower heights.
+  template <std::input_iterator It>
+  NaiveSkipList(It first, It last,
+                const BulkLoadOptions& options = BulkLoadOptions{},
+                const comparator_type& compare = comparator_type{});
   NaiveSkipList(NaiveSkipList&& other) = delete;
   ~NaiveSkipList();
 
+  auto NewNode(const key_type& key, const value_type& value,
+               int32_t level) -> NaiveNodePtr;
   auto GetRandomLevel() -> int32_t;
+  auto FindSpliceForLevel(const Probe& probe, NaiveNodePtr before,
+                          int32_t level, NaiveNodePtr* out_prev,
+                          NaiveNodePtr* out_next) const;
+  // NOTE(shiwen): the nodes around the last key put through it, like the
+  // splice of RocksDB's InlineSkipList. Brackets are nested, prevs_[i] <= key
+  // of the last put <= nexts_[i] and every level lies inside the one above.
+  // The next put starts from the lowest level whose bracket still contains
+  // its key, so sequential or clustered keys skip the upper levels entirely.
+  // Levels [0, height_] are filled, an empty splice has height_ -1.
+  struct Splice {
+    int32_t height_{-1};
+    NaiveNodePtr prevs_[Kmax_level + 1];
+    NaiveNodePtr nexts_[Kmax_level + 1];
+  };
+
+  // NOTE(shiwen): true if key lies in (prev, next].
+  auto BracketContains(const Probe& probe, NaiveNodePtr prev,
+                       NaiveNodePtr next) const -> bool {
+    return (prev == head_ || prev->k_.Compare(probe, compare_) < 0) &&
+           (next == nullptr || next->k_.Compare(probe, compare_) >= 0);
+  }
+
+  // NOTE(shiwen): the cached splice of Put, writers are mutually exclusive.
+  Splice splice_;
+
+  // NOTE(shiwen): fill the list, which must be empty and not yet shared,
+  // with the (key, value) pairs in [first, last). Unsorted input is copied
+  // and sorted first, the last pair of a key wins. Nodes are then appended
+  // left to right, each level linked to the last node on it, without a
+  // search. Returns the number of keys.
+  template <typename It>
+  auto BulkLoad(It first, It last,
+                const BulkLoadOptions& options = BulkLoadOptions{}) -> size_t;
   auto Put(const key_type& key, const value_type& value) -> bool;
+  auto Put(const key_type& key, const value_type& value, Splice& splice)
+      -> bool;
   auto Get(const key_type& key, value_type& value) const -> bool;
-};
+  // NOTE(shiwen): bytes taken from the arena, nodes and boxed values alike.
+  auto ApproximateMemoryUsage() const -> size_t {
+    return arena_.MemoryUsage();
+  }
+  // NOTE(shiwen): distinct keys inserted, puts that overwrite a value do not
+  // count.
+  auto Count() const -> size_t {
+    return entry_count_.load(std::memory_order_relaxed);
+  }
+  auto GetStats() const -> StatsSnapshot
+    requires stats_policy::Kenabled
+  {
+    return stats_.Snapshot();
+  }
+  // NOTE(shiwen): Seek iterators[i] to targets[i] for every target. Up to
+  // Kmulti_get_lanes searches run interleaved, each hop prefetches the node
+  // its lane reads next and moves on to the other lanes while it loads.
+  class Iterator;
+  auto MultiSeek(std::span<const key_type> targets,
+                 std::span<Iterator> iterators) const;
+  auto FindGreaterOrEqual(const key_type& key) const -> NaiveNodePtr;
+  auto FindLast() const -> NaiveNodePtr;
 
-template <typename T, typename U>
-NaiveSkipList<T, U>::NaiveSkipList() : rnd_(time(nullptr)) {
-  auto head_node_size = NaiveNode<>::GetNaiveNodeSize(Kmax_level);
-  // NOTE(shiwen): use malloc to allocate memories, can be optimaized by arena.
-  head_ = static_cast<NaiveNodePtr>(malloc(head_node_size));
+  // NOTE(shiwen): nodes are never removed and keys never change once linked,
+  // so an iterator stays valid while writers run. It sees every key linked
+  // before it got there, with the newest value of each.
+  class Iterator {
+   public:
+    enum { Kprefetch_distance = 4 };
 
-  // TODO(shiwen): did we need to initial the head_ ?
-  // BUG(shiwen): placement new to initialize atomics
-  // new (head_) NaiveNode<T, U>();
+    explicit Iterator(const NaiveSkipList* list) : list_(list) {}
 
-  // NOTE(shiwen): change this, min value of the key_type
-  head_->k_ = 0;
-  for (auto i = 0; i <= Kmax_level; i++) {
-    head_->StoreNext(i, nullptr);
-  }
+    auto Valid() const -> bool { return node_ != nullptr; }
+    auto key() const -> typename KeySlot<key_type>::view_type {
+      assert(Valid());
+      return node_->k_.Load();
+    }
+    auto value() const -> value_type {
+      assert(Valid());
+      return node_->v_.Load();
+    }
+    void Next();
+    // Advance to the first entry with a key >= target.
+    void Seek(const key_type& target);
+    void SeekToFirst();
+    void SeekToLast();
+
+   private:
+    friend struct NaiveSkipList;
+
+    void Reset(NaiveNodePtr node);
+
+    const NaiveSkipList* list_;
+    NaiveNodePtr node_{nullptr};
+    // NOTE(shiwen): a level 0 cursor running Kprefetch_distance nodes ahead of
+    // node_, every node it reaches is prefetched.
+    NaiveNodePtr ahead_{nullptr};
+    int32_t ahead_distance_{0};
+  };
+};
+
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+NaiveSkipList<T, U, A, C, H, S>::NaiveSkipList(const comparator_type& compare,
+                                               size_t expected_entries)
+    : max_level_(height_policy::MaxLevelFor(expected_entries)),
+      compare_(compare) {
+  // NOTE(shiwen): the head key is never compared.
+  head_ = NewNode(key_type{}, value_type{}, max_level_);
   level_.store(0, std::memory_order_relaxed);
 }
 
-template <typename T, typename U>
-NaiveSkipList<T, U>::~NaiveSkipList() {
-  NaiveNodePtr current = head_;
-  while (current) {
-    NaiveNodePtr next = current->LoadNext(0);
-    free(current);
-    current = next;
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+NaiveSkipList<T, U, A, C, H, S>::~NaiveSkipList() {
+  // NOTE(shiwen): all nodes live in arena_, which releases its blocks.
+}
+
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+auto NaiveSkipList<T, U, A, C, H, S>::NewNode(const key_type& key,
+                                              const value_type& value,
+                                              int32_t level) -> NaiveNodePtr {
+  auto new_node_size = NaiveNode<T, U>::GetNaiveNodeSize(level);
+  auto new_node = reinterpret_cast<NaiveNodePtr>(arena_.AllocateAligned(
+      new_node_size, alignof(NaiveNode<T, U>)));
+  stats_.Allocate(new_node_size);
+  new_node->k_.Init(key, arena_, compare_);
+  new_node->v_.Init(value, arena_);
+  for (auto i = 0; i <= level; i++) {
+    new_node->StoreNext(i, nullptr);
   }
+  return new_node;
 }
 
-template <typename T, typename U>
-auto NaiveSkipList<T, U>::Get(const key_type& key,
-                              value_type& value) const -> bool {
-  // NOTE(shiwen): check [first_key, last_key].
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+auto NaiveSkipList<T, U, A, C, H, S>::Get(const key_type& key,
+                                          value_type& value) const -> bool {
+  auto timer = StatsTimer(stats_, StatsOp::Kget);
+  auto probe = Probe(key, compare_);
   auto cur_node = head_;
   for (auto cur_node_level = level_.load(std::memory_order_acquire);
        cur_node_level >= 0; cur_node_level--) {
     while (true) {
       NaiveNodePtr next = cur_node->LoadNext(cur_node_level);
-      if (next == nullptr || next->k_ > key) {
+      if (next == nullptr) {
         break;
       }
-      if (next->k_ == key) {
-        // NOTE(shiwen): if dupliacate key, need to get the bottom value.
-        if (cur_node_level == 0) {
-          value = next->v_;
-          return true;
-        }
+      stats_.Compare();
+      auto cmp = next->k_.Compare(probe, compare_);
+      if (cmp > 0) {
         break;
       }
+      if (cmp == 0) {
+        // NOTE(shiwen): keys are unique, the first hit is the only node.
+        value = next->v_.Load();
+        return true;
+      }
+      stats_.Hop(cur_node_level);
       cur_node = next;
     }
   }
   return false;
 }
 
-template <typename T, typename U>
-auto NaiveSkipList<T, U>::GetRandomLevel() -> int32_t {
-  auto level = 0;
-  while (level < Kmax_level && rnd_.OneIn(Kp)) {
-    ++level;
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+auto NaiveSkipList<T, U, A, C, H, S>::MultiSeek(
+    std::span<const key_type> targets, std::span<Iterator> iterators) const {
+  assert(iterators.size() >= targets.size());
+  struct Lane {
+    size_t index_;
+    Probe probe_;
+    NaiveNodePtr node_;
+    NaiveNodePtr next_;
+    int32_t level_;
+  };
+  Lane lanes[Kmulti_get_lanes];
+  size_t active = 0;
+  size_t next_index = 0;
+  auto start = [&](Lane& lane) {
+    lane.index_ = next_index;
+    lane.probe_ = Probe(targets[next_index++], compare_);
+    lane.node_ = head_;
+    lane.level_ = level_.load(std::memory_order_acquire);
+    lane.next_ = head_->LoadNext(lane.level_);
+    __builtin_prefetch(lane.next_);
+  };
+  while (active < Kmulti_get_lanes && next_index < targets.size()) {
+    start(lanes[active++]);
   }
-  return level;
+
+  while (active > 0) {
+    for (size_t i = 0; i < active;) {
+      auto& lane = lanes[i];
+      // NOTE(shiwen): one hop of FindGreaterOrEqual, next_ was prefetched by
+      // the last one.
+      auto next = lane.next_;
+      auto cmp = 1;
+      if (next != nullptr) {
+        stats_.Compare();
+        cmp = next->k_.Compare(lane.probe_, compare_);
+      }
+      auto done = false;
+      if (cmp < 0) {
+        stats_.Hop(lane.level_);
+        lane.node_ = next;
+      } else if (cmp == 0 || lane.level_ == 0) {
+        iterators[lane.index_].Reset(next);
+        done = true;
+      } else {
+        lane.level_--;
+      }
+
+      if (!done) {
+        lane.next_ = lane.node_->LoadNext(lane.level_);
+        __builtin_prefetch(lane.next_);
+        i++;
+      } else if (next_index < targets.size()) {
+        start(lane);
+        i++;
+      } else {
+        lane = lanes[--active];
+      }
+    }
+  }
+}
+
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+template <std::input_iterator It>
+NaiveSkipList<T, U, A, C, H, S>::NaiveSkipList(It first, It last,
+    const BulkLoadOptions& options, const comparator_type& compare)
+    : NaiveSkipList(compare, ExpectedEntries(first, last, options)) {
+  BulkLoad(first, last, options);
+}
+
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+template <typename It>
+auto NaiveSkipList<T, U, A, C, H, S>::BulkLoad(It first, It last,
+    const BulkLoadOptions& options) -> size_t {
+  assert(head_->LoadNext(0) == nullptr);
+  if (!options.sorted_) {
+    auto entries = SortForBulkLoad<key_type, value_type>(
+        first, last, compare_, options.sort_threads_);
+    auto sorted = options;
+    sorted.sorted_ = true;
+    return BulkLoad(entries.begin(), entries.end(), sorted);
+  }
+  NaiveNodePtr prevs[Kmax_level + 1];
+  std::fill(std::begin(prevs), std::end(prevs), head_);
+  auto max_level = level_.load(std::memory_order_relaxed);
+  size_t count = 0;
+  for (; first != last; ++first) {
+    const auto& [key, value] = *first;
+    auto level = options.heights_ == TowerHeights::Kbalanced
+                     ? BalancedHeight(count + 1, Kp, max_level_)
+                     : GetRandomLevel();
+    auto new_node = NewNode(key, value, level);
+    for (auto i = 0; i <= level; i++) {
+      prevs[i]->StoreNext(i, new_node);
+      prevs[i] = new_node;
+    }
+    stats_.Height(level, 1);
+    max_level = std::max(max_level, level);
+    count++;
+  }
+  entry_count_.fetch_add(count, std::memory_order_relaxed);
+  level_.store(max_level, std::memory_order_release);
+  return count;
+}
+
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+auto NaiveSkipList<T, U, A, C, H, S>::GetRandomLevel() -> int32_t {
+  return height_policy::RandomLevel(max_level_);
 }
 
 // NOTE(shiwen): Additional synchronization mechanisms should be added at the
 // upper layer to ensure that only one thread can call the put method at a time.
-template <typename T, typename U>
-auto NaiveSkipList<T, U>::Put(const key_type& key,
-                              const value_type& value) -> bool {
-  auto prevs = std::vector<NaiveNodePtr>(Kmax_level + 1);
-  auto nexts = std::vector<NaiveNodePtr>(Kmax_level + 1);
+// Returns true if a new node was inserted, false if an existing key had its
+// value overwritten in place.
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+auto NaiveSkipList<T, U, A, C, H, S>::Put(const key_type& key,
+                                          const value_type& value) -> bool {
+  return Put(key, value, splice_);
+}
+
+// NOTE(shiwen): a level is searched with plain loads, the writer is alone.
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+auto NaiveSkipList<T, U, A, C, H, S>::FindSpliceForLevel(
+    const Probe& probe, NaiveNodePtr before, int32_t level,
+    NaiveNodePtr* out_prev, NaiveNodePtr* out_next) const {
+  while (true) {
+    NaiveNodePtr next_node = before->LoadNext(level);
+    if (next_node != nullptr) {
+      stats_.Compare();
+      if (next_node->k_.Compare(probe, compare_) < 0) {
+        stats_.Hop(level);
+        before = next_node;
+        continue;
+      }
+    }
+    *out_prev = before;
+    *out_next = next_node;
+    return;
+  }
+}
+
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+auto NaiveSkipList<T, U, A, C, H, S>::Put(const key_type& key,
+                                          const value_type& value,
+                                          Splice& splice) -> bool {
+  auto timer = StatsTimer(stats_, StatsOp::Kput);
+  auto probe = Probe(key, compare_);
+  auto& prevs = splice.prevs_;
+  auto& nexts = splice.nexts_;
 
   auto old_level = level_.load(std::memory_order_acquire);
-  auto cur_node = head_;
-  for (auto cur_node_level = old_level; cur_node_level >= 0; cur_node_level--) {
-    while (true) {
-      NaiveNodePtr next_node = cur_node->LoadNext(cur_node_level);
-      if (next_node == nullptr || next_node->k_ >= key) {
-        prevs[cur_node_level] = cur_node;
-        nexts[cur_node_level] = next_node;
-        break;
+  // NOTE(shiwen): levels the splice has never seen bracket the whole list.
+  // They always contain key but are no tighter than a search from the top, so
+  // only the levels seen before can save work.
+  auto seen_height = splice.height_;
+  for (auto level = seen_height + 1; level <= old_level; level++) {
+    prevs[level] = head_;
+    nexts[level] = nullptr;
+  }
+  splice.height_ = std::max(splice.height_, old_level);
+
+  auto start_level = 0;
+  while (start_level <= seen_height &&
+         !BracketContains(probe, prevs[start_level], nexts[start_level])) {
+    start_level++;
+  }
+  if (start_level > seen_height) {
+    start_level = old_level;
+    prevs[old_level] = head_;
+  }
+
+  for (auto level = start_level; level >= 0; level--) {
+    auto before = level == start_level ? prevs[level] : prevs[level + 1];
+    FindSpliceForLevel(probe, before, level, &prevs[level], &nexts[level]);
+    auto next_node = nexts[level];
+    if (next_node != nullptr &&
+        next_node->k_.Compare(probe, compare_) == 0) {
+      next_node->v_.Store(value, arena_);
+      stats_.Duplicate();
+      // NOTE(shiwen): keep the brackets nested for the levels not searched.
+      for (auto lower_level = level - 1; lower_level >= 0; lower_level--) {
+        prevs[lower_level] = prevs[level];
+        nexts[lower_level] = next_node;
       }
-      cur_node = next_node;
+      return false;
     }
   }
 
   // init the new node
   auto new_node_level = GetRandomLevel();
-  auto new_node_size = NaiveNode<>::GetNaiveNodeSize(new_node_level);
-  auto new_node = static_cast<NaiveNodePtr>(malloc(new_node_size));
-  new_node->k_ = key;
-  new_node->v_ = value;
-  if (new_node_level > level_) {
-    // BUG(shiwen): Xiaopeng mentioned that two atomic variables should not
-    // appear in the same function.
+  auto new_node = NewNode(key, value, new_node_level);
+  // NOTE(shiwen): the levels above start_level still contain key, but other
+  // splices may have inserted behind this one's back.
+  for (auto level = std::min(new_node_level, old_level); level > start_level;
+       level--) {
+    FindSpliceForLevel(probe, prevs[level], level, &prevs[level],
+                       &nexts[level]);
+  }
+  if (new_node_level > old_level) {
     for (auto level = old_level + 1; level <= new_node_level; level++) {
       prevs[level] = head_;
       nexts[level] = nullptr;
     }
     level_.store(new_node_level, std::memory_order_release);
   }
+  splice.height_ = std::max(old_level, new_node_level);
 
   // NOTE(shiwen): these operations do not need sync mechanisms.
   for (auto level = 0; level <= new_node_level; level++) {
@@ -168,7 +481,99 @@ auto NaiveSkipList<T, U>::Put(const key_type& key,
   for (auto level = 0; level <= new_node_level; level++) {
     assert(level <= Kmax_level);
     prevs[level]->StoreNext(level, new_node);
+    prevs[level] = new_node;
   }
 
+  entry_count_.fetch_add(1, std::memory_order_relaxed);
+  stats_.Height(new_node_level, 1);
   return true;
 }
+
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+auto NaiveSkipList<T, U, A, C, H, S>::FindGreaterOrEqual(
+    const key_type& key) const -> NaiveNodePtr {
+  auto probe = Probe(key, compare_);
+  auto cur_node = head_;
+  NaiveNodePtr next = nullptr;
+  for (auto cur_node_level = level_.load(std::memory_order_acquire);
+       cur_node_level >= 0; cur_node_level--) {
+    while (true) {
+      next = cur_node->LoadNext(cur_node_level);
+      if (next == nullptr) {
+        break;
+      }
+      stats_.Compare();
+      if (next->k_.Compare(probe, compare_) >= 0) {
+        break;
+      }
+      stats_.Hop(cur_node_level);
+      cur_node = next;
+    }
+  }
+  return next;
+}
+
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+auto NaiveSkipList<T, U, A, C, H, S>::FindLast() const -> NaiveNodePtr {
+  auto cur_node = head_;
+  for (auto cur_node_level = level_.load(std::memory_order_acquire);
+       cur_node_level >= 0; cur_node_level--) {
+    while (true) {
+      auto next = cur_node->LoadNext(cur_node_level);
+      if (next == nullptr) {
+        break;
+      }
+      cur_node = next;
+    }
+  }
+  return cur_node == head_ ? nullptr : cur_node;
+}
+
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+void NaiveSkipList<T, U, A, C, H, S>::Iterator::Reset(NaiveNodePtr node) {
+  node_ = node;
+  ahead_ = node;
+  ahead_distance_ = 0;
+}
+
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+void NaiveSkipList<T, U, A, C, H, S>::Iterator::Next() {
+  assert(Valid());
+  node_ = node_->LoadNext(0);
+  if (ahead_distance_ == 0) {
+    ahead_ = node_;
+  } else {
+    ahead_distance_--;
+  }
+  while (ahead_ != nullptr && ahead_distance_ < Kprefetch_distance) {
+    auto next = ahead_->LoadNext(0);
+    if (next == nullptr) {
+      break;
+    }
+    __builtin_prefetch(next);
+    ahead_ = next;
+    ahead_distance_++;
+  }
+}
+
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+void NaiveSkipList<T, U, A, C, H, S>::Iterator::Seek(const key_type& target) {
+  Reset(list_->FindGreaterOrEqual(target));
+}
+
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+void NaiveSkipList<T, U, A, C, H, S>::Iterator::SeekToFirst() {
+  Reset(list_->head_->LoadNext(0));
+}
+
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+void NaiveSkipList<T, U, A, C, H, S>::Iterator::SeekToLast() {
+  Reset(list_->FindLast());
+}
@@ -0,0 +1,389 @@
+#pragma once
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <new>
+#include <string>
+#include <type_traits>
+
+#include "comparator.hpp"
+#include "height_policy.hpp"
+
+// NOTE(shiwen): a skiplist living in a file mapped MAP_SHARED. Nodes link to
+// each other by their offset O into the file instead of by address, so the
+// file can be mapped anywhere and a reopened list serves Get at once, paying
+// a page fault per page it touches instead of a reload.
+//
+//   [header][head node][node]...[free space up to the capacity]
+//
+// Nodes are bump allocated after the head and never freed. Offset 0 is the
+// header, it stands for no node. The file is in host byte order and only
+// opens with the key, value and offset types it was created with.
+//
+// The header's state is the consistency marker. A writer marks the file
+// dirty, and syncs the header, before its first change after a Sync, and
+// Sync flushes every node before it marks the file clean again. A file found
+// dirty was not synced after its last writes: after a process crash the page
+// cache still held them all, after a power loss some links may point at
+// nodes that never reached the disk.
+//
+// Like NaiveSkipList, many threads may read while one writes.
+struct PersistentSkipListOptions {
+  // NOTE(shiwen): the file size Create allocates, nodes never outgrow it.
+  size_t capacity_{64 << 20};
+  // NOTE(shiwen): let Open map a dirty file, e.g. after a process crash.
+  bool accept_dirty_{false};
+};
+
+// NOTE(shiwen): what a Put did. Kfailed wrote nothing, the file had no room
+// left for a new node or could not be marked dirty.
+enum class PersistentPutResult { Kinserted, Kupdated, Kfailed };
+
+constexpr uint64_t KpersistentSkipListMagic = 0x706d736b69706c73;  // "pmskipls"
+constexpr uint32_t KpersistentSkipListVersion = 1;
+
+template <typename T = uint32_t, typename U = uint32_t,
+          typename C = DefaultComparator<T>, typename O = uint32_t,
+          typename H = DefaultHeightPolicy>
+  requires std::is_trivially_copyable_v<T> &&
+           std::is_trivially_copyable_v<U> &&
+           std::atomic_ref<U>::is_always_lock_free &&
+           (std::is_same_v<O, uint32_t> || std::is_same_v<O, uint64_t>)
+class PersistentSkipList {
+ public:
+  using key_type = T;
+  using value_type = U;
+  using comparator_type = C;
+  using offset_type = O;
+  using height_policy = H;
+
+  enum : int32_t { Kmax_level = height_policy::Kmax_level };
+
+  // NOTE(shiwen): a new list in a file of options.capacity_ bytes at path,
+  // replacing whatever was there. nullptr if the file cannot be made or the
+  // capacity does not fit in offset_type.
+  static auto Create(const std::string& path,
+                     const PersistentSkipListOptions& options =
+                         PersistentSkipListOptions{},
+                     const comparator_type& compare = comparator_type{})
+      -> std::unique_ptr<PersistentSkipList> {
+    auto capacity = options.capacity_;
+    if (capacity > std::numeric_limits<offset_type>::max() ||
+        capacity < HeadOffset() + Node::Size(Kmax_level)) {
+      return nullptr;
+    }
+    auto fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+      return nullptr;
+    }
+    if (ftruncate(fd, static_cast<off_t>(capacity)) != 0 || fsync(fd) != 0) {
+      close(fd);
+      return nullptr;
+    }
+    auto base = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+      return nullptr;
+    }
+    auto list = std::unique_ptr<PersistentSkipList>(new PersistentSkipList(
+        static_cast<char*>(base), capacity, compare));
+    // NOTE(shiwen): towers higher than a full file needs are never drawn.
+    auto max_level = height_policy::MaxLevelFor(capacity / Node::Size(0));
+    auto header = new (base) Header();
+    header->magic_ = KpersistentSkipListMagic;
+    header->version_ = KpersistentSkipListVersion;
+    header->state_ = Kdirty;
+    header->offset_size_ = sizeof(offset_type);
+    header->key_size_ = sizeof(key_type);
+    header->value_size_ = sizeof(value_type);
+    header->max_level_ = max_level;
+    header->capacity_ = capacity;
+    header->used_ = HeadOffset() + Node::Size(max_level);
+    list->header_ = header;
+    list->max_level_ = max_level;
+    auto head = list->NodeAt(HeadOffset());
+    for (auto level = 0; level <= max_level; level++) {
+      new (&head->next_[level]) std::atomic<offset_type>(0);
+    }
+    if (!list->Sync()) {
+      return nullptr;
+    }
+    return list;
+  }
+
+  // NOTE(shiwen): map the list at path as it was left, nothing is read until
+  // a search touches it. nullptr if the file is missing, is not a list of
+  // these types, or is dirty without options.accept_dirty_.
+  static auto Open(const std::string& path,
+                   const PersistentSkipListOptions& options =
+                       PersistentSkipListOptions{},
+                   const comparator_type& compare = comparator_type{})
+      -> std::unique_ptr<PersistentSkipList> {
+    auto fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+      return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        static_cast<size_t>(st.st_size) < HeadOffset()) {
+      close(fd);
+      return nullptr;
+    }
+    auto size = static_cast<size_t>(st.st_size);
+    auto base =
+        mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+      return nullptr;
+    }
+    auto list = std::unique_ptr<PersistentSkipList>(
+        new PersistentSkipList(static_cast<char*>(base), size, compare));
+    auto header = static_cast<Header*>(base);
+    if (header->magic_ != KpersistentSkipListMagic ||
+        header->version_ != KpersistentSkipListVersion ||
+        header->offset_size_ != sizeof(offset_type) ||
+        header->key_size_ != sizeof(key_type) ||
+        header->value_size_ != sizeof(value_type) ||
+        header->max_level_ < 0 || header->max_level_ > Kmax_level ||
+        header->capacity_ != size || header->used_ > size ||
+        header->used_ < HeadOffset() + Node::Size(header->max_level_) ||
+        header->level_.load(std::memory_order_relaxed) > header->max_level_ ||
+        (header->state_ != Kclean && !options.accept_dirty_)) {
+      return nullptr;
+    }
+    list->header_ = header;
+    list->max_level_ = header->max_level_;
+    // NOTE(shiwen): searches jump around the file, read ahead would mostly
+    // fault in pages no search wants.
+    madvise(base, size, MADV_RANDOM);
+    return list;
+  }
+
+  PersistentSkipList(const PersistentSkipList&) = delete;
+  PersistentSkipList& operator=(const PersistentSkipList&) = delete;
+  // NOTE(shiwen): a list closed without a crash is left clean.
+  ~PersistentSkipList() {
+    if (header_ != nullptr) {
+      Sync();
+    }
+    munmap(base_, size_);
+  }
+
+  // NOTE(shiwen): a flush point. Write every node back to the file, then mark
+  // it clean. Must not run concurrently with Put. Returns false if the kernel
+  // failed to write, the file then stays dirty.
+  auto Sync() -> bool {
+    if (header_->state_ == Kclean) {
+      return true;
+    }
+    if (msync(base_, header_->used_, MS_SYNC) != 0) {
+      return false;
+    }
+    header_->state_ = Kclean;
+    return msync(base_, sizeof(Header), MS_SYNC) == 0;
+  }
+
+  // NOTE(shiwen): one writer at a time. An existing key has its value
+  // overwritten in place.
+  auto Put(const key_type& key, const value_type& value)
+      -> PersistentPutResult {
+    offset_type prevs[Kmax_level + 1];
+    auto level = header_->level_.load(std::memory_order_relaxed);
+    auto next = FindGreaterOrEqual(key, prevs);
+    if (next != nullptr && compare_(next->k_, key) == 0) {
+      if (!MarkDirty()) {
+        return PersistentPutResult::Kfailed;
+      }
+      std::atomic_ref<value_type>(next->v_).store(value,
+                                                  std::memory_order_release);
+      return PersistentPutResult::Kupdated;
+    }
+
+    auto new_node_level = height_policy::RandomLevel(max_level_);
+    auto size = Node::Size(new_node_level);
+    if (size > header_->capacity_ - header_->used_ || !MarkDirty()) {
+      return PersistentPutResult::Kfailed;
+    }
+    auto offset = static_cast<offset_type>(header_->used_);
+    header_->used_ += size;
+    auto new_node = NodeAt(offset);
+    new_node->k_ = key;
+    new_node->v_ = value;
+    for (auto i = level + 1; i <= new_node_level; i++) {
+      prevs[i] = HeadOffset();
+    }
+    for (auto i = 0; i <= new_node_level; i++) {
+      new (&new_node->next_[i]) std::atomic<offset_type>(
+          NodeAt(prevs[i])->next_[i].load(std::memory_order_relaxed));
+    }
+    if (new_node_level > level) {
+      header_->level_.store(new_node_level, std::memory_order_release);
+    }
+    // NOTE(shiwen): publish bottom-up, the node is complete before any link
+    // to it is visible.
+    for (auto i = 0; i <= new_node_level; i++) {
+      NodeAt(prevs[i])->next_[i].store(offset, std::memory_order_release);
+    }
+    header_->count_.fetch_add(1, std::memory_order_relaxed);
+    return PersistentPutResult::Kinserted;
+  }
+
+  auto Get(const key_type& key, value_type& value) const -> bool {
+    auto node = FindGreaterOrEqual(key, nullptr);
+    if (node == nullptr || compare_(node->k_, key) != 0) {
+      return false;
+    }
+    value = LoadValue(node);
+    return true;
+  }
+
+  // NOTE(shiwen): distinct keys stored.
+  auto Count() const -> size_t {
+    return header_->count_.load(std::memory_order_relaxed);
+  }
+
+  // NOTE(shiwen): bytes of the file in use, the header included.
+  auto ApproximateMemoryUsage() const -> size_t { return header_->used_; }
+
+  auto Capacity() const -> size_t { return header_->capacity_; }
+
+  // NOTE(shiwen): true if the file was changed since the last Sync.
+  auto Dirty() const -> bool { return header_->state_ != Kclean; }
+
+ private:
+  enum : uint32_t { Kclean = 1, Kdirty = 2 };
+
+  // NOTE(shiwen): the first bytes of the file. Layout fields let Open
+  // reject a file made with other types.
+  struct Header {
+    uint64_t magic_;
+    uint32_t version_;
+    uint32_t state_;
+    uint32_t offset_size_;
+    uint32_t key_size_;
+    uint32_t value_size_;
+    int32_t max_level_;
+    uint64_t capacity_;
+    // NOTE(shiwen): the end of the last node, where the next one goes.
+    uint64_t used_;
+    std::atomic<uint64_t> count_{0};
+    std::atomic<int32_t> level_{0};
+  };
+
+  struct Node {
+    key_type k_;
+    alignas(std::atomic_ref<value_type>::required_alignment) value_type v_;
+    std::atomic<offset_type> next_[];
+
+    // NOTE(shiwen): rounded up, so the node after it is aligned too.
+    static constexpr auto Size(int32_t level) -> size_t {
+      auto size = sizeof(Node) + (level + 1) * sizeof(std::atomic<offset_type>);
+      return (size + alignof(Node) - 1) / alignof(Node) * alignof(Node);
+    }
+  };
+
+ public:
+  // NOTE(shiwen): nodes are never removed, an iterator stays valid while the
+  // writer runs. It sees every key linked before it got there.
+  class Iterator {
+   public:
+    explicit Iterator(const PersistentSkipList* list) : list_(list) {}
+
+    auto Valid() const -> bool { return node_ != nullptr; }
+    auto key() const -> const key_type& {
+      assert(Valid());
+      return node_->k_;
+    }
+    auto value() const -> value_type {
+      assert(Valid());
+      return LoadValue(node_);
+    }
+    void Next() {
+      assert(Valid());
+      node_ = list_->LoadNext(node_, 0);
+    }
+    // Advance to the first entry with a key >= target.
+    void Seek(const key_type& target) {
+      node_ = list_->FindGreaterOrEqual(target, nullptr);
+    }
+    void SeekToFirst() {
+      node_ = list_->LoadNext(list_->NodeAt(HeadOffset()), 0);
+    }
+
+   private:
+    const PersistentSkipList* list_;
+    Node* node_{nullptr};
+  };
+
+ private:
+  PersistentSkipList(char* base, size_t size, const comparator_type& compare)
+      : base_(base), size_(size), compare_(compare) {}
+
+  static constexpr auto HeadOffset() -> size_t {
+    return (sizeof(Header) + alignof(Node) - 1) / alignof(Node) *
+           alignof(Node);
+  }
+
+  static auto LoadValue(Node* node) -> value_type {
+    return std::atomic_ref<value_type>(node->v_).load(
+        std::memory_order_acquire);
+  }
+
+  auto NodeAt(offset_type offset) const -> Node* {
+    return offset == 0 ? nullptr : reinterpret_cast<Node*>(base_ + offset);
+  }
+
+  auto LoadNext(Node* node, int32_t level) const -> Node* {
+    return NodeAt(node->next_[level].load(std::memory_order_acquire));
+  }
+
+  // NOTE(shiwen): the first node with a key >= key, filling prevs, if given,
+  // with the offsets of its predecessors on every level.
+  auto FindGreaterOrEqual(const key_type& key, offset_type* prevs) const
+      -> Node* {
+    auto cur_offset = static_cast<offset_type>(HeadOffset());
+    Node* next = nullptr;
+    for (auto level = header_->level_.load(std::memory_order_acquire);
+         level >= 0; level--) {
+      while (true) {
+        auto next_offset =
+            NodeAt(cur_offset)->next_[level].load(std::memory_order_acquire);
+        next = NodeAt(next_offset);
+        if (next == nullptr || compare_(next->k_, key) >= 0) {
+          break;
+        }
+        cur_offset = next_offset;
+      }
+      if (prevs != nullptr) {
+        prevs[level] = cur_offset;
+      }
+    }
+    return next;
+  }
+
+  // NOTE(shiwen): the dirty marker reaches the disk before any change it
+  // covers can.
+  auto MarkDirty() -> bool {
+    if (header_->state_ == Kdirty) {
+      return true;
+    }
+    header_->state_ = Kdirty;
+    return msync(base_, sizeof(Header), MS_SYNC) == 0;
+  }
+
+  char* base_;
+  size_t size_;
+  const comparator_type compare_;
+  Header* header_{nullptr};
+  int32_t max_level_{0};
+};
@@ -0,0 +1,160 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "spin_lock.hpp"
+
+// NOTE(shiwen): the DeleteRange tombstones of a MemTable. A tombstone
+// [begin, end) written at sequence s hides every version of a key inside it
+// older than s from snapshots that include s. Tombstones are cut into sorted,
+// non overlapping fragments, each listing the sequences of the tombstones
+// covering it newest first, and the fragment list is republished whole on
+// every Add. Readers load it without a lock and binary search it, and skip
+// even that while there are no tombstones or the key lies outside them all.
+template <typename T, typename C>
+class RangeTombstones {
+ public:
+  using key_type = T;
+  using comparator_type = C;
+
+  explicit RangeTombstones(const comparator_type& compare = comparator_type{})
+      : compare_(compare) {}
+  RangeTombstones(const RangeTombstones&) = delete;
+  RangeTombstones& operator=(const RangeTombstones&) = delete;
+
+  auto Empty() const -> bool {
+    return count_.load(std::memory_order_acquire) == 0;
+  }
+
+  // NOTE(shiwen): begin and end are kept as they are, byte string keys must
+  // point at memory that outlives this object. Empty ranges are dropped.
+  auto Add(const key_type& begin, const key_type& end, uint64_t sequence) {
+    if (compare_(begin, end) >= 0) {
+      return;
+    }
+    std::lock_guard guard(add_lock_);
+    tombstones_.push_back(Tombstone{begin, end, sequence});
+    fragments_.store(BuildFragments(), std::memory_order_release);
+    count_.store(tombstones_.size(), std::memory_order_release);
+  }
+
+  // NOTE(shiwen): the newest sequence <= snapshot of a tombstone covering key,
+  // 0 if there is none.
+  auto MaxCoveringSequence(const key_type& key, uint64_t snapshot) const
+      -> uint64_t {
+    if (Empty()) {
+      return 0;
+    }
+    auto fragments = fragments_.load(std::memory_order_acquire);
+    const auto& list = fragments->fragments_;
+    if (list.empty() || compare_(key, list.front().begin_) < 0 ||
+        compare_(key, list.back().end_) >= 0) {
+      return 0;
+    }
+    // NOTE(shiwen): the last fragment beginning at or before key.
+    auto it = std::upper_bound(list.begin(), list.end(), key,
+                               [this](const key_type& target,
+                                      const FragmentEntry& fragment) {
+                                 return compare_(target, fragment.begin_) < 0;
+                               });
+    --it;
+    if (compare_(key, it->end_) >= 0) {
+      return 0;
+    }
+    auto sequence = std::lower_bound(it->sequences_.begin(),
+                                     it->sequences_.end(), snapshot,
+                                     std::greater<uint64_t>());
+    return sequence == it->sequences_.end() ? 0 : *sequence;
+  }
+
+ private:
+  struct Tombstone {
+    key_type begin_;
+    key_type end_;
+    uint64_t sequence_;
+  };
+
+  struct FragmentEntry {
+    key_type begin_;
+    key_type end_;
+    std::vector<uint64_t> sequences_;  // newest first
+  };
+
+  struct Fragments {
+    std::vector<FragmentEntry> fragments_;
+  };
+
+  // NOTE(shiwen): sweep the sorted boundaries of all tombstones, keeping the
+  // tombstones that cover the gap to the next boundary. Neighbours covered by
+  // the same sequences are merged.
+  auto BuildFragments() const -> std::shared_ptr<const Fragments> {
+    auto less = [this](const key_type& lhs, const key_type& rhs) {
+      return compare_(lhs, rhs) < 0;
+    };
+    std::vector<key_type> bounds;
+    bounds.reserve(tombstones_.size() * 2);
+    for (const auto& tombstone : tombstones_) {
+      bounds.push_back(tombstone.begin_);
+      bounds.push_back(tombstone.end_);
+    }
+    std::sort(bounds.begin(), bounds.end(), less);
+    bounds.erase(std::unique(bounds.begin(), bounds.end(),
+                             [this](const key_type& lhs, const key_type& rhs) {
+                               return compare_(lhs, rhs) == 0;
+                             }),
+                 bounds.end());
+
+    auto by_begin = std::vector<const Tombstone*>{};
+    for (const auto& tombstone : tombstones_) {
+      by_begin.push_back(&tombstone);
+    }
+    std::sort(by_begin.begin(), by_begin.end(),
+              [this](const Tombstone* lhs, const Tombstone* rhs) {
+                return compare_(lhs->begin_, rhs->begin_) < 0;
+              });
+
+    auto result = std::make_shared<Fragments>();
+    auto active = std::vector<const Tombstone*>{};
+    size_t next = 0;
+    for (size_t i = 0; i + 1 < bounds.size(); i++) {
+      const auto& begin = bounds[i];
+      while (next < by_begin.size() &&
+             compare_(by_begin[next]->begin_, begin) <= 0) {
+        active.push_back(by_begin[next++]);
+      }
+      std::erase_if(active, [this, &begin](const Tombstone* tombstone) {
+        return compare_(tombstone->end_, begin) <= 0;
+      });
+      if (active.empty()) {
+        continue;
+      }
+      auto sequences = std::vector<uint64_t>{};
+      for (auto tombstone : active) {
+        sequences.push_back(tombstone->sequence_);
+      }
+      std::sort(sequences.begin(), sequences.end(), std::greater<uint64_t>());
+      auto& list = result->fragments_;
+      if (!list.empty() && compare_(list.back().end_, begin) == 0 &&
+          list.back().sequences_ == sequences) {
+        list.back().end_ = bounds[i + 1];
+        continue;
+      }
+      list.push_back(
+          FragmentEntry{begin, bounds[i + 1], std::move(sequences)});
+    }
+    return result;
+  }
+
+  const comparator_type compare_;
+  NaiveSpinLock add_lock_;
+  std::vector<Tombstone> tombstones_;
+  std::atomic<size_t> count_{0};
+  std::atomic<std::shared_ptr<const Fragments>> fragments_;
+};
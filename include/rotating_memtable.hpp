@@ -0,0 +1,174 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "simple_memtable.hpp"
+#include "write_batch.hpp"
+
+// NOTE(shiwen): a MemTable that never grows past a byte budget. Once the
+// active table uses write_buffer_size bytes it is sealed: it takes no more
+// writes and joins the immutable tables, a fresh table continuing its
+// sequence numbers takes its place. Reads go through the active table, then
+// the immutable ones newest first, and stop at the first table that has a
+// version or a tombstone for the key. Readers never lock, they load the
+// current set of tables and keep it alive for the read. Writers share
+// rotate_lock_ and the one thread that seals the active table takes it
+// exclusively, so a sealed table is never written again. Arenas grow a
+// block at a time, write_buffer_size should span several of them. A table
+// type with a Successor, e.g. ShardedMemTable, builds its own replacement.
+template <typename M = MemTable<>>
+class RotatingMemTable {
+ public:
+  using memtable_type = M;
+  using key_type = typename memtable_type::key_type;
+  using value_type = typename memtable_type::value_type;
+  using Snapshot = typename memtable_type::Snapshot;
+
+  enum : size_t { Kdefault_write_buffer_size = 64 << 20 };
+
+  // NOTE(shiwen): every table logs to wal, if any, which must outlive them.
+  explicit RotatingMemTable(
+      size_t write_buffer_size = Kdefault_write_buffer_size,
+      Wal* wal = nullptr)
+      : write_buffer_size_(write_buffer_size), wal_(wal) {
+    auto tables = std::make_shared<Tables>();
+    tables->active_ = std::make_shared<memtable_type>(0, wal_);
+    tables_.store(std::move(tables), std::memory_order_release);
+  }
+  RotatingMemTable(const RotatingMemTable&) = delete;
+  RotatingMemTable& operator=(const RotatingMemTable&) = delete;
+
+  auto GetSnapshot() const -> Snapshot {
+    return tables_.load(std::memory_order_acquire)->active_->GetSnapshot();
+  }
+
+  auto Get(const key_type& key, value_type& value) const -> bool {
+    return Get(key, value, Snapshot{});
+  }
+
+  auto Get(const key_type& key, value_type& value,
+           const Snapshot& snapshot) const -> bool {
+    auto tables = tables_.load(std::memory_order_acquire);
+    auto result = tables->active_->Lookup(key, value, snapshot);
+    for (const auto& table : tables->immutables_) {
+      if (result != LookupResult::Knot_found) {
+        break;
+      }
+      result = table->Lookup(key, value, snapshot);
+    }
+    return result == LookupResult::Kfound;
+  }
+
+  auto MultiGet(std::span<const key_type> keys, std::span<value_type> values,
+                std::span<bool> found) const -> size_t {
+    size_t hits = 0;
+    for (size_t i = 0; i < keys.size(); i++) {
+      found[i] = Get(keys[i], values[i]);
+      hits += found[i];
+    }
+    return hits;
+  }
+
+  auto Put(const key_type& key, const value_type& value) -> bool {
+    return Apply([&](memtable_type& table) { return table.Put(key, value); });
+  }
+
+  auto Delete(const key_type& key) -> bool {
+    return Apply([&](memtable_type& table) { return table.Delete(key); });
+  }
+
+  auto DeleteRange(const key_type& begin, const key_type& end) -> bool {
+    return Apply(
+        [&](memtable_type& table) { return table.DeleteRange(begin, end); });
+  }
+
+  // NOTE(shiwen): a batch lands in one table whole, the table may go past
+  // write_buffer_size by the size of the batch.
+  auto Write(WriteBatch<key_type, value_type>& batch) -> bool {
+    return Apply([&](memtable_type& table) { return table.Write(batch); });
+  }
+
+  // NOTE(shiwen): the active table and the immutable ones together.
+  auto ApproximateMemoryUsage() const -> size_t {
+    auto tables = tables_.load(std::memory_order_acquire);
+    auto usage = tables->active_->ApproximateMemoryUsage();
+    for (const auto& table : tables->immutables_) {
+      usage += table->ApproximateMemoryUsage();
+    }
+    return usage;
+  }
+
+  // NOTE(shiwen): the sealed tables newest first, e.g. to flush them.
+  auto Immutables() const
+      -> std::vector<std::shared_ptr<const memtable_type>> {
+    return tables_.load(std::memory_order_acquire)->immutables_;
+  }
+
+  // NOTE(shiwen): drop the oldest sealed table once it is flushed. Readers
+  // that already loaded it finish with it, it is freed after the last one.
+  auto PopOldestImmutable() {
+    std::unique_lock guard(rotate_lock_);
+    auto tables = tables_.load(std::memory_order_acquire);
+    if (tables->immutables_.empty()) {
+      return;
+    }
+    auto next = std::make_shared<Tables>(*tables);
+    next->immutables_.pop_back();
+    tables_.store(std::move(next), std::memory_order_release);
+  }
+
+ private:
+  struct Tables {
+    std::shared_ptr<memtable_type> active_;
+    std::vector<std::shared_ptr<const memtable_type>> immutables_;
+  };
+
+  template <typename F>
+  auto Apply(F&& write) -> bool {
+    std::shared_ptr<memtable_type> active;
+    bool result;
+    {
+      std::shared_lock guard(rotate_lock_);
+      active = tables_.load(std::memory_order_acquire)->active_;
+      result = write(*active);
+    }
+    if (active->ApproximateMemoryUsage() >= write_buffer_size_) {
+      Rotate(active);
+    }
+    return result;
+  }
+
+  // NOTE(shiwen): seal full unless another writer already did.
+  auto Rotate(const std::shared_ptr<memtable_type>& full) {
+    std::unique_lock guard(rotate_lock_);
+    auto tables = tables_.load(std::memory_order_acquire);
+    if (tables->active_ != full) {
+      return;
+    }
+    auto next = std::make_shared<Tables>();
+    if constexpr (requires { full->Successor(); }) {
+      next->active_ = full->Successor();
+    } else {
+      next->active_ =
+          std::make_shared<memtable_type>(full->LastSequence(), wal_);
+    }
+    next->immutables_.reserve(tables->immutables_.size() + 1);
+    next->immutables_.push_back(full);
+    next->immutables_.insert(next->immutables_.end(),
+                             tables->immutables_.begin(),
+                             tables->immutables_.end());
+    tables_.store(std::move(next), std::memory_order_release);
+  }
+
+  const size_t write_buffer_size_;
+  Wal* const wal_;
+  std::shared_mutex rotate_lock_;
+  std::atomic<std::shared_ptr<const Tables>> tables_;
+};
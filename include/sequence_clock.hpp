@@ -0,0 +1,83 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+// NOTE(shiwen): hands out sequence numbers to writers and tracks which of
+// them snapshots may see. Writers take a range of sequences, insert their
+// versions, then publish the range. The visible sequence only moves past a
+// range once every range before it is published too. Tables that share a
+// clock share one sequence space, so a snapshot is consistent across them.
+class SequenceClock {
+ public:
+  enum { Kpublish_window = 1 << 10 };
+
+  // NOTE(shiwen): the first range taken starts at last_sequence + 1.
+  explicit SequenceClock(uint64_t last_sequence = 0)
+      : next_sequence_(last_sequence), visible_sequence_(last_sequence) {}
+  SequenceClock(const SequenceClock&) = delete;
+  SequenceClock& operator=(const SequenceClock&) = delete;
+
+  // NOTE(shiwen): take count consecutive sequences, returns the first.
+  auto Take(uint64_t count) -> uint64_t {
+    return next_sequence_.fetch_add(count, std::memory_order_relaxed) + 1;
+  }
+
+  // NOTE(shiwen): the newest sequence handed out, not necessarily visible
+  // yet.
+  auto LastSequence() const -> uint64_t {
+    return next_sequence_.load(std::memory_order_acquire);
+  }
+
+  // NOTE(shiwen): every sequence <= the visible one has been published.
+  auto VisibleSequence() const -> uint64_t {
+    return visible_sequence_.load(std::memory_order_acquire);
+  }
+
+  // NOTE(shiwen): continue after sequence, e.g. once a log is replayed. The
+  // clock must not be shared yet.
+  auto Restart(uint64_t sequence) {
+    next_sequence_.store(sequence, std::memory_order_relaxed);
+    visible_sequence_.store(sequence, std::memory_order_release);
+  }
+
+  // NOTE(shiwen): mark [first, last] inserted, then move visible_sequence_
+  // over every range whose predecessors are all published. Whoever publishes
+  // the oldest pending range moves it, no writer waits for a slower one
+  // unless Kpublish_window sequences are pending. Must be called without any
+  // lock an older writer may need, or a writer waiting for the window could
+  // keep that write from being inserted.
+  auto Publish(uint64_t first, uint64_t last) {
+    while (first - visible_sequence_.load(std::memory_order_acquire) >
+           Kpublish_window) {
+      std::this_thread::yield();
+    }
+    // NOTE(shiwen): seq_cst from here on. Two writers each store their slot
+    // and then read the other's; with acquire/release both reads may miss the
+    // other store, and neither would move visible_sequence_ over the ranges.
+    published_[first % Kpublish_window].store(last, std::memory_order_seq_cst);
+    auto visible = visible_sequence_.load(std::memory_order_seq_cst);
+    while (true) {
+      // NOTE(shiwen): a slot left over from an older range holds a sequence
+      // <= visible.
+      auto end = published_[(visible + 1) % Kpublish_window].load(
+          std::memory_order_seq_cst);
+      if (end <= visible) {
+        return;
+      }
+      if (visible_sequence_.compare_exchange_weak(visible, end,
+                                                  std::memory_order_seq_cst)) {
+        visible = end;
+      }
+    }
+  }
+
+ private:
+  std::atomic<uint64_t> next_sequence_{0};
+  std::atomic<uint64_t> visible_sequence_{0};
+  // NOTE(shiwen): published_[first % Kpublish_window] is the last sequence of
+  // the range starting at first, once that range is inserted.
+  std::unique_ptr<std::atomic<uint64_t>[]> published_ =
+      std::make_unique<std::atomic<uint64_t>[]>(Kpublish_window);
+};
@@ -0,0 +1,454 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "random_gen.hpp"
+#include "sequence_clock.hpp"
+#include "simple_memtable.hpp"
+#include "spin_lock.hpp"
+#include "wal.hpp"
+#include "write_batch.hpp"
+
+// NOTE(shiwen): a key the table keeps past the write that passed it in, byte
+// strings are copied.
+template <typename T>
+struct OwnedKey {
+  using type = T;
+};
+
+template <>
+struct OwnedKey<std::string_view> {
+  using type = std::string;
+};
+
+// NOTE(shiwen): a MemTable split into shards by key range, each shard a
+// MemTable with its own skiplist and state_lock_, so writers of different
+// ranges never share a lock or a cache line of the skiplist. Shard i holds
+// the keys in [splits[i - 1], splits[i]). All shards take their sequence
+// numbers from one SequenceClock, so snapshots and batches that span shards
+// stay consistent, and log to the same Wal.
+//
+// Split points are fixed for the life of a table, moving keys between live
+// shards would break snapshots. Instead every shard samples the keys written
+// to it, and Successor, which RotatingMemTable calls when the table is
+// sealed, cuts its replacement at the quantiles of the writes seen: a hot
+// range takes more samples and ends up split over more shards.
+template <typename M = MemTable<>>
+class ShardedMemTable {
+ public:
+  using memtable_type = M;
+  using key_type = typename memtable_type::key_type;
+  using value_type = typename memtable_type::value_type;
+  using lock_type = typename memtable_type::lock_type;
+  using user_comparator_type = typename memtable_type::user_comparator_type;
+  using owned_key_type = typename OwnedKey<key_type>::type;
+  using Snapshot = typename memtable_type::Snapshot;
+
+  // NOTE(shiwen): one write in Ksample_interval, counted per thread, is
+  // offered to its shard's sample of up to Ksample_size keys.
+  enum { Ksample_interval = 16 };
+  enum { Ksample_size = 1 << 10 };
+
+  // NOTE(shiwen): one shard per core, split evenly over the key space:
+  // the range of an integer key type or the first byte of a byte string.
+  // Keys of other types start in one shard.
+  explicit ShardedMemTable(uint64_t last_sequence = 0, Wal* wal = nullptr)
+      : ShardedMemTable(
+            EvenSplits(std::max(1u, std::thread::hardware_concurrency())),
+            last_sequence, wal) {}
+
+  // NOTE(shiwen): splits must be strictly increasing, there are
+  // splits.size() + 1 shards.
+  explicit ShardedMemTable(std::vector<owned_key_type> splits,
+                           uint64_t last_sequence = 0, Wal* wal = nullptr)
+      : wal_(wal),
+        clock_(std::make_shared<SequenceClock>(last_sequence)),
+        splits_(std::move(splits)),
+        target_shards_(splits_.size() + 1) {
+    for (size_t i = 0; i <= splits_.size(); i++) {
+      shards_.push_back(std::make_unique<Shard>(clock_, wal_));
+    }
+  }
+  ShardedMemTable(const ShardedMemTable&) = delete;
+  ShardedMemTable& operator=(const ShardedMemTable&) = delete;
+
+  // NOTE(shiwen): the split points that cut sample into shards ranges of
+  // about the same number of keys.
+  static auto SplitsFromSample(std::span<const key_type> sample,
+                               size_t shards)
+      -> std::vector<owned_key_type> {
+    std::vector<std::pair<owned_key_type, double>> weighted;
+    weighted.reserve(sample.size());
+    for (const auto& key : sample) {
+      weighted.emplace_back(owned_key_type(key), 1.0);
+    }
+    return QuantileSplits(weighted, shards);
+  }
+
+  auto Shards() const -> size_t { return shards_.size(); }
+
+  auto SplitPoints() const -> const std::vector<owned_key_type>& {
+    return splits_;
+  }
+
+  // NOTE(shiwen): split points for shards shards at the quantiles of the
+  // writes sampled so far. Each shard's sample stands for all the writes of
+  // that shard, so shards that took more writes weigh more. Without samples
+  // the current split points.
+  auto SampledSplits(size_t shards) const -> std::vector<owned_key_type> {
+    std::vector<std::pair<owned_key_type, double>> weighted;
+    for (const auto& shard : shards_) {
+      std::lock_guard guard(shard->sample_lock_);
+      for (const auto& key : shard->sample_) {
+        weighted.emplace_back(
+            key, static_cast<double>(shard->sampled_) /
+                     static_cast<double>(shard->sample_.size()));
+      }
+    }
+    if (weighted.empty()) {
+      return splits_;
+    }
+    return QuantileSplits(weighted, shards);
+  }
+
+  // NOTE(shiwen): an empty table to replace this one once it is full. It
+  // continues the sequence numbers, logs to the same Wal and has as many
+  // shards as this one was built with, cut by SampledSplits.
+  auto Successor() const -> std::shared_ptr<ShardedMemTable> {
+    auto next = std::make_shared<ShardedMemTable>(
+        SampledSplits(target_shards_), LastSequence(), wal_);
+    next->target_shards_ = target_shards_;
+    return next;
+  }
+
+  auto LastSequence() const -> uint64_t { return clock_->LastSequence(); }
+
+  auto GetSnapshot() const -> Snapshot {
+    return Snapshot{clock_->VisibleSequence()};
+  }
+
+  auto Get(const key_type& key, value_type& value) const -> bool {
+    return Get(key, value, Snapshot{});
+  }
+
+  auto Get(const key_type& key, value_type& value,
+           const Snapshot& snapshot) const -> bool {
+    return Lookup(key, value, snapshot) == LookupResult::Kfound;
+  }
+
+  auto Lookup(const key_type& key, value_type& value,
+              const Snapshot& snapshot) const -> LookupResult {
+    return shards_[ShardOf(key)]->table_.Lookup(key, value, snapshot);
+  }
+
+  // NOTE(shiwen): the keys are grouped by shard and every group is one
+  // MultiGet of its shard.
+  auto MultiGet(std::span<const key_type> keys, std::span<value_type> values,
+                std::span<bool> found) const -> size_t {
+    return MultiGet(keys, values, found, Snapshot{});
+  }
+
+  auto MultiGet(std::span<const key_type> keys, std::span<value_type> values,
+                std::span<bool> found, const Snapshot& snapshot) const
+      -> size_t {
+    std::vector<std::vector<size_t>> groups(shards_.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+      groups[ShardOf(keys[i])].push_back(i);
+    }
+    size_t hits = 0;
+    std::vector<key_type> group_keys;
+    std::vector<value_type> group_values;
+    for (size_t shard = 0; shard < shards_.size(); shard++) {
+      const auto& group = groups[shard];
+      if (group.empty()) {
+        continue;
+      }
+      if (group.size() == keys.size()) {
+        return shards_[shard]->table_.MultiGet(keys, values, found, snapshot);
+      }
+      group_keys.clear();
+      for (auto i : group) {
+        group_keys.push_back(keys[i]);
+      }
+      group_values.assign(group.size(), value_type{});
+      auto group_found = std::make_unique<bool[]>(group.size());
+      hits += shards_[shard]->table_.MultiGet(
+          group_keys, group_values,
+          std::span<bool>(group_found.get(), group.size()), snapshot);
+      for (size_t j = 0; j < group.size(); j++) {
+        found[group[j]] = group_found[j];
+        if (group_found[j]) {
+          values[group[j]] = group_values[j];
+        }
+      }
+    }
+    return hits;
+  }
+
+  auto Put(const key_type& key, const value_type& value) -> bool {
+    auto& shard = *shards_[ShardOf(key)];
+    Sample(shard, key);
+    return shard.table_.Put(key, value);
+  }
+
+  auto Delete(const key_type& key) -> bool {
+    auto& shard = *shards_[ShardOf(key)];
+    Sample(shard, key);
+    return shard.table_.Delete(key);
+  }
+
+  // NOTE(shiwen): one sequence and one log record, the tombstone is added to
+  // every shard the range overlaps.
+  auto DeleteRange(const key_type& begin, const key_type& end) -> bool {
+    auto sequence = clock_->Take(1);
+    if (!LogToWal<key_type, value_type>(
+            wal_, sequence, 1, [&](auto& record) {
+              EncodeWalOp(record, WalOpType::Kdelete_range, ObjectBytes(begin),
+                          ObjectBytes(end));
+            })) {
+      clock_->Publish(sequence, sequence);
+      return false;
+    }
+    auto first = ShardOf(begin);
+    auto last = std::max(first, ShardsBefore(end));
+    for (auto shard = first; shard <= last; shard++) {
+      shards_[shard]->table_.AddRangeTombstone(begin, end, sequence);
+    }
+    clock_->Publish(sequence, sequence);
+    return true;
+  }
+
+  // NOTE(shiwen): the batch is sorted in place and logged as one record with
+  // consecutive sequence numbers. Sorted keys of one shard are adjacent, each
+  // run of them is inserted under its shard's lock only, and the whole batch
+  // becomes visible to snapshots at once.
+  auto Write(WriteBatch<key_type, value_type>& batch) -> bool {
+    batch.SortAndDedup(compare_);
+    if (batch.Count() == 0) {
+      return true;
+    }
+    auto first = clock_->Take(batch.Count());
+    auto last = first + batch.Count() - 1;
+    std::span<const typename WriteBatch<key_type, value_type>::Entry> entries(
+        batch.Entries());
+    if (!LogToWal<key_type, value_type>(
+            wal_, first, static_cast<uint32_t>(entries.size()),
+            [&](auto& record) {
+              EncodeWalBatch<key_type, value_type>(record, entries);
+            })) {
+      clock_->Publish(first, last);
+      return false;
+    }
+    size_t begin = 0;
+    while (begin < entries.size()) {
+      auto shard = ShardOf(entries[begin].key_);
+      auto end = entries.size();
+      if (shard < splits_.size()) {
+        const auto& split = splits_[shard];
+        end = static_cast<size_t>(
+            std::partition_point(
+                entries.begin() + begin, entries.end(),
+                [&](const auto& entry) {
+                  return compare_(entry.key_, split) < 0;
+                }) -
+            entries.begin());
+      }
+      for (auto i = begin; i < end; i++) {
+        Sample(*shards_[shard], entries[i].key_);
+      }
+      shards_[shard]->table_.InsertSequenced(
+          entries.subspan(begin, end - begin), first + begin);
+      begin = end;
+    }
+    clock_->Publish(first, last);
+    return true;
+  }
+
+  // NOTE(shiwen): shards hold disjoint ranges in key order, a scan walks them
+  // one after another.
+  template <typename F>
+  auto Scan(const key_type& begin, const key_type& end, F&& callback) const {
+    Scan(begin, end, std::forward<F>(callback), Snapshot{});
+  }
+
+  template <typename F>
+  auto Scan(const key_type& begin, const key_type& end, F&& callback,
+            const Snapshot& snapshot) const {
+    auto stopped = false;
+    auto last = ShardsBefore(end);
+    for (auto shard = ShardOf(begin); shard <= last && !stopped; shard++) {
+      shards_[shard]->table_.Scan(
+          begin, end,
+          [&](const key_type& key, const value_type& value) {
+            if constexpr (std::is_same_v<
+                              std::invoke_result_t<F&, const key_type&,
+                                                   const value_type&>,
+                              bool>) {
+              stopped = !callback(key, value);
+              return !stopped;
+            } else {
+              callback(key, value);
+              return true;
+            }
+          },
+          snapshot);
+    }
+  }
+
+  template <typename F>
+  auto ForEachNewest(F&& callback,
+                     const Snapshot& snapshot = Snapshot{}) const {
+    for (const auto& shard : shards_) {
+      shard->table_.ForEachNewest(callback, snapshot);
+    }
+  }
+
+  auto ApproximateMemoryUsage() const -> size_t {
+    size_t usage = 0;
+    for (const auto& shard : shards_) {
+      usage += shard->table_.ApproximateMemoryUsage();
+    }
+    return usage;
+  }
+
+  auto Count() const -> size_t {
+    size_t count = 0;
+    for (const auto& shard : shards_) {
+      count += shard->table_.Count();
+    }
+    return count;
+  }
+
+ private:
+  // NOTE(shiwen): aligned so the locks of neighbouring shards do not share
+  // a cache line.
+  struct alignas(KcacheLineSize) Shard {
+    Shard(std::shared_ptr<SequenceClock> clock, Wal* wal)
+        : table_(std::move(clock), wal) {}
+
+    memtable_type table_;
+    // NOTE(shiwen): not lock_type, the sample needs a real lock even when
+    // the table's writers share none.
+    mutable NaiveSpinLock sample_lock_{};
+    std::vector<owned_key_type> sample_;
+    // NOTE(shiwen): the keys offered to sample_, it keeps each of them with
+    // the same probability.
+    uint64_t sampled_{0};
+  };
+
+  static auto EvenSplits(size_t shards) -> std::vector<owned_key_type> {
+    std::vector<owned_key_type> splits;
+    if constexpr (std::is_integral_v<key_type>) {
+      using unsigned_type = std::make_unsigned_t<key_type>;
+      auto range =
+          static_cast<double>(std::numeric_limits<unsigned_type>::max());
+      for (size_t i = 1; i < shards; i++) {
+        auto offset = static_cast<unsigned_type>(
+            range * static_cast<double>(i) / static_cast<double>(shards));
+        splits.push_back(static_cast<key_type>(
+            static_cast<unsigned_type>(std::numeric_limits<key_type>::min()) +
+            offset));
+      }
+    } else if constexpr (std::is_same_v<key_type, std::string_view>) {
+      shards = std::min<size_t>(shards, 256);
+      for (size_t i = 1; i < shards; i++) {
+        splits.emplace_back(1, static_cast<char>(i * 256 / shards));
+      }
+    }
+    return splits;
+  }
+
+  // NOTE(shiwen): walk the weighted keys in key order and cut after every
+  // 1 / shards of the total weight. A key never splits from itself, so a few
+  // very hot keys may leave fewer shards.
+  static auto QuantileSplits(
+      std::vector<std::pair<owned_key_type, double>>& weighted, size_t shards)
+      -> std::vector<owned_key_type> {
+    const auto compare = user_comparator_type{};
+    std::sort(weighted.begin(), weighted.end(),
+              [&compare](const auto& lhs, const auto& rhs) {
+                return compare(lhs.first, rhs.first) < 0;
+              });
+    auto total = 0.0;
+    for (const auto& [key, weight] : weighted) {
+      total += weight;
+    }
+    std::vector<owned_key_type> splits;
+    auto step = total / static_cast<double>(std::max<size_t>(1, shards));
+    auto seen = 0.0;
+    for (const auto& [key, weight] : weighted) {
+      if (splits.size() + 1 >= shards) {
+        break;
+      }
+      if (seen >= step * static_cast<double>(splits.size() + 1) &&
+          (splits.empty() || compare(splits.back(), key) < 0)) {
+        splits.push_back(key);
+      }
+      seen += weight;
+    }
+    return splits;
+  }
+
+  // NOTE(shiwen): the shard holding key, the number of splits <= key.
+  auto ShardOf(const key_type& key) const -> size_t {
+    return static_cast<size_t>(
+        std::upper_bound(splits_.begin(), splits_.end(), key,
+                         [this](const key_type& lhs,
+                                const owned_key_type& rhs) {
+                           return compare_(lhs, rhs) < 0;
+                         }) -
+        splits_.begin());
+  }
+
+  // NOTE(shiwen): the last shard holding keys < end, the number of splits
+  // < end.
+  auto ShardsBefore(const key_type& end) const -> size_t {
+    return static_cast<size_t>(
+        std::lower_bound(splits_.begin(), splits_.end(), end,
+                         [this](const owned_key_type& lhs,
+                                const key_type& rhs) {
+                           return compare_(lhs, rhs) < 0;
+                         }) -
+        splits_.begin());
+  }
+
+  // NOTE(shiwen): reservoir sampling of one write in Ksample_interval.
+  auto Sample(Shard& shard, const key_type& key) {
+    thread_local uint64_t writes = 0;
+    if (++writes % Ksample_interval != 0) {
+      return;
+    }
+    thread_local auto rnd = Random(static_cast<uint32_t>(
+        std::hash<std::thread::id>{}(std::this_thread::get_id())));
+    std::lock_guard guard(shard.sample_lock_);
+    shard.sampled_++;
+    if (shard.sample_.size() < Ksample_size) {
+      shard.sample_.emplace_back(key);
+      return;
+    }
+    auto slot = (static_cast<uint64_t>(rnd.Next()) << 31 | rnd.Next()) %
+                shard.sampled_;
+    if (slot < Ksample_size) {
+      shard.sample_[slot] = owned_key_type(key);
+    }
+  }
+
+  Wal* const wal_;
+  std::shared_ptr<SequenceClock> clock_;
+  const user_comparator_type compare_{};
+  std::vector<owned_key_type> splits_;
+  size_t target_shards_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+};
@@ -1,11 +1,31 @@
 #pragma once
+#include <algorithm>
+#include <cassert>
+#include <chrono>
 #include <concepts>
+#include <deque>
 #include <cstdint>
+#include <functional>
+#include <thread>
 #include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
+#include "arena.hpp"
+#include "bulk_load.hpp"
+#include "internal_key.hpp"
 #include "lock_free_skip_list.hpp"
+#include "range_tombstone.hpp"
+#include "sequence_clock.hpp"
 #include "simple_skip_list.hpp"
 #include "spin_lock.hpp"
+#include "stats.hpp"
+#include "wal.hpp"
+#include "write_batch.hpp"
 
 template <typename T>
 concept LockConcept = requires(T t) {
@@ -18,45 +38,625 @@ concept SkiplistConcept = requires(SkipListType list, const T& const_key,
                                    const U& const_value, U& mut_value) {
   { list.Get(const_key, mut_value) } -> std::same_as<bool>;
   { list.Put(const_key, const_value) } -> std::same_as<bool>;
+  typename SkipListType::Iterator;
+  typename SkipListType::Splice;
 };
 
+// NOTE(shiwen): the skiplist type MemTable stores, S with its key, arena and
+// comparator swapped, e.g. SkipList<T, U, Arena> ->
+// SkipList<InternalKey<T>, U, HugePageArena, InternalComparator<C>>.
+template <typename S, typename K, typename A, typename C>
+struct RebindSkipList;
+
+template <template <typename, typename, typename, typename, typename...>
+          class S,
+          typename T, typename U, typename OldA, typename OldC,
+          typename... Rest, typename K, typename A, typename C>
+struct RebindSkipList<S<T, U, OldA, OldC, Rest...>, K, A, C> {
+  using type = S<K, U, A, C, Rest...>;
+};
+
+// NOTE(shiwen): the keys and values a MemTable can write to a Wal.
+template <typename T>
+concept WalEncodable =
+    std::is_same_v<T, std::string_view> || std::is_trivially_copyable_v<T>;
+
+// NOTE(shiwen): append the count operations encode_ops writes, starting at
+// sequence, to wal if there is one. encode_ops is only instantiated for keys
+// and values a Wal can hold.
+template <typename K, typename V, typename F>
+auto LogToWal(Wal* wal, uint64_t sequence, uint32_t count, F&& encode_ops)
+    -> bool {
+  if constexpr (WalEncodable<K> && WalEncodable<V>) {
+    if (wal == nullptr) {
+      return true;
+    }
+    std::string record;
+    EncodeWalHeader(record, sequence, count);
+    encode_ops(record);
+    return wal->Append(record);
+  } else {
+    assert(wal == nullptr);
+    return true;
+  }
+}
+
+// NOTE(shiwen): the operations of a sorted batch, in the record of a Write.
+template <typename K, typename V>
+void EncodeWalBatch(
+    std::string& record,
+    std::span<const typename WriteBatch<K, V>::Entry> entries) {
+  for (const auto& entry : entries) {
+    EncodeWalOp(record,
+                entry.deletion_ ? WalOpType::Kdelete : WalOpType::Kput,
+                ObjectBytes(entry.key_),
+                entry.deletion_ ? std::string_view{}
+                                : ObjectBytes(entry.value_));
+  }
+}
+
+// NOTE(shiwen): what one table knows about a key. Knot_found lets a lookup
+// over several tables move on to an older one, Kdeleted stops it. Kcorruption
+// comes only from a table read back from a damaged file.
+enum class LookupResult { Knot_found, Kfound, Kdeleted, Kcorruption };
+
+// NOTE(shiwen): every write gets the next sequence number and adds a new
+// version, nothing is overwritten. A snapshot sees the newest version of each
+// key with a sequence <= its own. Reads without a snapshot see the newest
+// version already inserted. With a Wal every write is appended to it, with
+// its sequence numbers, before it is inserted, and fails if the append does.
 template <typename T = uint32_t, typename U = uint32_t,
-          typename L = NaiveSpinLock, typename S = SkipList<T, U>>
-  requires LockConcept<L> && SkiplistConcept<T, U, S>
+          typename L = NaiveSpinLock, typename S = SkipList<T, U>,
+          typename A = typename S::arena_type>
+  requires LockConcept<L> && SkiplistConcept<T, U, S> && ArenaConcept<A>
 class MemTable {
  public:
   using key_type = T;
   using value_type = U;
   using lock_type = L;
-  using skiplist_type = S;
+  using arena_type = A;
+  using user_comparator_type = typename S::comparator_type;
+  using internal_key_type = InternalKey<key_type>;
+  using skiplist_type =
+      typename RebindSkipList<S, internal_key_type, A,
+                              InternalComparator<user_comparator_type>>::type;
+  // NOTE(shiwen): the stats policy of S, NoStats if it has none.
+  using stats_policy = typename StatsPolicyOf<skiplist_type>::type;
+
+  static constexpr value_type tomb = ValueTraits<value_type>::Tombstone();
+
+  struct Snapshot {
+    uint64_t sequence_{KmaxSequence};
+  };
+
+  // NOTE(shiwen): the first write gets last_sequence + 1, so a table that
+  // replaces a full one continues its sequence numbers and snapshots stay
+  // comparable across both. wal, if any, must outlive the table.
+  explicit MemTable(uint64_t last_sequence = 0, Wal* wal = nullptr)
+      : MemTable(std::make_shared<SequenceClock>(last_sequence), wal) {}
+
+  // NOTE(shiwen): a table taking its sequence numbers from clock, which
+  // other tables may share, e.g. the shards of a ShardedMemTable.
+  MemTable(std::shared_ptr<SequenceClock> clock, Wal* wal)
+      : wal_(wal), clock_(std::move(clock)) {
+    skip_list_ = std::make_shared<skiplist_type>();
+  }
+
+  // NOTE(shiwen): the sequence of the newest write handed out, not
+  // necessarily visible yet.
+  auto LastSequence() const -> uint64_t {
+    return clock_->LastSequence();
+  }
+
+  // NOTE(shiwen): every write with a sequence <= the snapshot's has been
+  // inserted, nothing blocks. A write still being inserted by another thread
+  // holds back the snapshots of the writes after it.
+  auto GetSnapshot() const -> Snapshot {
+    return Snapshot{clock_->VisibleSequence()};
+  }
+
+  auto Get(const key_type& key, value_type& value) const -> bool {
+    return Get(key, value, Snapshot{});
+  }
+
+  auto Get(const key_type& key, value_type& value,
+           const Snapshot& snapshot) const -> bool {
+    return Lookup(key, value, snapshot) == LookupResult::Kfound;
+  }
 
-  const uint32_t tomb = 0xFFFFFFFF;
+  // NOTE(shiwen): Get that tells a deleted key from one this table never saw.
+  // value is only set on Kfound.
+  auto Lookup(const key_type& key, value_type& value,
+              const Snapshot& snapshot) const -> LookupResult {
+    auto timer = StatsTimer(stats_, StatsOp::Kget);
+    auto iter = typename skiplist_type::Iterator(skip_list_.get());
+    iter.Seek(internal_key_type{key, snapshot.sequence_});
+    return ReadVisible(iter, key, value, snapshot);
+  }
 
-  explicit MemTable() { skip_list_ = std::make_shared<skiplist_type>(); }
+  // NOTE(shiwen): Get for a batch of keys, found[i] tells whether values[i]
+  // was set. Skiplists with a MultiSeek interleave the searches, the others
+  // get one Get per key. Returns the number of keys found.
+  auto MultiGet(std::span<const key_type> keys, std::span<value_type> values,
+                std::span<bool> found) const -> size_t {
+    return MultiGet(keys, values, found, Snapshot{});
+  }
 
-  auto Get(const key_type& key, value_type& value) -> bool {
-    auto skiplist_res = skip_list_->Get(key, value);
-    if (skiplist_res == true) {
-      return value != tomb;
+  auto MultiGet(std::span<const key_type> keys, std::span<value_type> values,
+                std::span<bool> found, const Snapshot& snapshot) const
+      -> size_t {
+    size_t hits = 0;
+    using Iterator = typename skiplist_type::Iterator;
+    if constexpr (requires(std::span<const internal_key_type> targets,
+                           std::span<Iterator> iterators) {
+                    skip_list_->MultiSeek(targets, iterators);
+                  }) {
+      std::vector<internal_key_type> targets;
+      std::vector<Iterator> iterators;
+      targets.reserve(keys.size());
+      iterators.reserve(keys.size());
+      for (const auto& key : keys) {
+        targets.push_back(internal_key_type{key, snapshot.sequence_});
+        iterators.emplace_back(skip_list_.get());
+      }
+      skip_list_->MultiSeek(targets, iterators);
+      for (size_t i = 0; i < keys.size(); i++) {
+        found[i] = ReadVisible(iterators[i], keys[i], values[i], snapshot) ==
+                   LookupResult::Kfound;
+        hits += found[i];
+      }
+    } else {
+      for (size_t i = 0; i < keys.size(); i++) {
+        found[i] = Get(keys[i], values[i], snapshot);
+        hits += found[i];
+      }
     }
-    return false;
+    return hits;
   }
 
   auto Put(const key_type& key, const value_type& value) -> bool {
-    state_lock_.lock();
-    skip_list_->Put(key, value);
-    state_lock_.unlock();
-    return true;
+    return Insert(WalOpType::Kput, key, value);
   }
 
   auto Delete(const key_type& key) -> bool {
-    state_lock_.lock();
-    skip_list_->Put(key, tomb);
-    state_lock_.unlock();
+    return Insert(WalOpType::Kdelete, key, tomb);
+  }
+
+  // NOTE(shiwen): delete every key in [begin, end) with one range tombstone
+  // instead of a tombstone per key. Versions written later stay visible.
+  auto DeleteRange(const key_type& begin, const key_type& end) -> bool {
+    auto sequence = clock_->Take(1);
+    if (!LogWrite(sequence, 1, [&](auto& record) {
+          EncodeWalOp(record, WalOpType::Kdelete_range, ObjectBytes(begin),
+                      ObjectBytes(end));
+        })) {
+      clock_->Publish(sequence, sequence);
+      return false;
+    }
+    AddRangeTombstone(begin, end, sequence);
+    clock_->Publish(sequence, sequence);
     return true;
   }
 
+  // NOTE(shiwen): the batch is sorted in place. All of it is logged as one
+  // record and inserted under one state_lock_ acquisition with consecutive
+  // sequence numbers, each key starting its search from the previous key's
+  // predecessors, and becomes visible to snapshots at once.
+  auto Write(WriteBatch<key_type, value_type>& batch) -> bool {
+    batch.SortAndDedup(skip_list_->compare_.user_comparator_);
+    if (batch.Count() == 0) {
+      return true;
+    }
+    auto first = clock_->Take(batch.Count());
+    auto last = first + batch.Count() - 1;
+    if (!LogWrite(first, batch.Count(), [&](auto& record) {
+          EncodeWalBatch<key_type, value_type>(record, batch.Entries());
+        })) {
+      clock_->Publish(first, last);
+      return false;
+    }
+    InsertSequenced(batch.Entries(), first);
+    clock_->Publish(first, last);
+    return true;
+  }
+
+  // NOTE(shiwen): the inserts of Write and DeleteRange, for a writer that
+  // took the sequences from this table's clock and logged the write itself,
+  // e.g. a ShardedMemTable spreading one write over several shards. entries
+  // are sorted by key, entries[i] gets sequence first + i. The caller
+  // publishes the sequences.
+  auto InsertSequenced(
+      std::span<const typename WriteBatch<key_type, value_type>::Entry>
+          entries,
+      uint64_t first) {
+    auto splice = typename skiplist_type::Splice{};
+    LockState();
+    for (const auto& entry : entries) {
+      skip_list_->Put(internal_key_type{entry.key_, first++},
+                      entry.deletion_ ? tomb : entry.value_, splice);
+    }
+    state_lock_.unlock();
+  }
+
+  auto AddRangeTombstone(const key_type& begin, const key_type& end,
+                         uint64_t sequence) {
+    LockState();
+    range_tombstones_.Add(CopyKey(begin), CopyKey(end), sequence);
+    state_lock_.unlock();
+  }
+
+  // NOTE(shiwen): replay the Wal at path into this table, which must be empty
+  // and not yet shared. The log is mapped and cut into block aligned chunks
+  // parsed by threads threads, each sorting the versions it found, then the
+  // sorted chunks are merged and appended to the skiplist left to right, so
+  // no insert searches or locks. Sequence numbers continue after the last one
+  // replayed. A missing log fails, an empty one recovers nothing.
+  auto Recover(const std::string& path,
+               size_t threads = std::thread::hardware_concurrency())
+      -> WalRecoveryStats
+    requires WalEncodable<key_type> && WalEncodable<value_type>
+  {
+    auto start = std::chrono::steady_clock::now();
+    auto stats = WalRecoveryStats{};
+    auto file = MappedFile::Open(path);
+    if (file == nullptr) {
+      return stats;
+    }
+    auto log = file->Contents();
+    threads = std::max<size_t>(1, threads);
+
+    struct Version {
+      internal_key_type key_;
+      value_type value_;
+    };
+    struct Range {
+      key_type begin_;
+      key_type end_;
+      uint64_t sequence_;
+    };
+    struct Chunk {
+      std::vector<Version> versions_;
+      std::vector<Range> ranges_;
+      uint64_t records_{0};
+      uint64_t malformed_bytes_{0};
+      uint64_t last_sequence_{0};
+      // NOTE(shiwen): fragmented records, which the reader reassembles in a
+      // buffer it reuses.
+      std::deque<std::string> owned_;
+    };
+    std::vector<Chunk> chunks(threads);
+    stats.dropped_bytes_ = ParallelReadWal(
+        log, threads, [&chunks, log](size_t thread, std::string_view record) {
+          auto& chunk = chunks[thread];
+          chunk.records_++;
+          if constexpr (std::is_same_v<key_type, std::string_view> ||
+                        std::is_same_v<value_type, std::string_view>) {
+            if (record.data() < log.data() ||
+                record.data() >= log.data() + log.size()) {
+              record = chunk.owned_.emplace_back(record);
+            }
+          }
+          // NOTE(shiwen): a key, end key or value of the wrong size, e.g.
+          // from a log of other types, makes the rest of the record malformed.
+          auto ok = DecodeWalRecord(
+              record, [&chunk](WalOpType type, uint64_t sequence,
+                               std::string_view key, std::string_view value) {
+                auto fits =
+                    FitsObject<key_type>(key.size()) &&
+                    (type != WalOpType::Kdelete_range ||
+                     FitsObject<key_type>(value.size())) &&
+                    (type != WalOpType::Kput ||
+                     FitsObject<value_type>(value.size()));
+                if (!fits) {
+                  return false;
+                }
+                chunk.last_sequence_ = std::max(chunk.last_sequence_, sequence);
+                if (type == WalOpType::Kdelete_range) {
+                  chunk.ranges_.push_back(
+                      Range{ObjectFromBytes<key_type>(key),
+                            ObjectFromBytes<key_type>(value), sequence});
+                  return true;
+                }
+                chunk.versions_.push_back(Version{
+                    internal_key_type{ObjectFromBytes<key_type>(key),
+                                      sequence},
+                    type == WalOpType::Kdelete
+                        ? tomb
+                        : ObjectFromBytes<value_type>(value)});
+                return true;
+              });
+          if (!ok) {
+            chunk.malformed_bytes_ += record.size();
+          }
+        });
+
+    const auto& compare = skip_list_->compare_;
+    auto less = [&compare](const Version& lhs, const Version& rhs) {
+      return compare(lhs.key_, rhs.key_) < 0;
+    };
+    {
+      std::vector<std::thread> sorters;
+      for (size_t i = 1; i < chunks.size(); i++) {
+        sorters.emplace_back([&chunks, &less, i] {
+          std::sort(chunks[i].versions_.begin(), chunks[i].versions_.end(),
+                    less);
+        });
+      }
+      std::sort(chunks[0].versions_.begin(), chunks[0].versions_.end(), less);
+      for (auto& sorter : sorters) {
+        sorter.join();
+      }
+    }
+
+    std::vector<Version> versions;
+    std::vector<size_t> bounds{0};
+    for (auto& chunk : chunks) {
+      versions.insert(versions.end(), chunk.versions_.begin(),
+                      chunk.versions_.end());
+      bounds.push_back(versions.size());
+      stats.records_ += chunk.records_;
+      stats.dropped_bytes_ += chunk.malformed_bytes_;
+      stats.last_sequence_ =
+          std::max(stats.last_sequence_, chunk.last_sequence_);
+      chunk.versions_ = {};
+    }
+    MergeSortedRuns(versions.begin(), bounds, less);
+
+    // NOTE(shiwen): internal keys are unique, so the merged versions are
+    // linked in one pass when nothing was written before.
+    auto bulk_loaded = false;
+    if constexpr (requires { skip_list_->BulkLoad(versions.begin(),
+                                                  versions.end()); }) {
+      if (skip_list_->Count() == 0) {
+        BulkLoadOptions options;
+        options.sorted_ = true;
+        skip_list_->BulkLoad(versions.begin(), versions.end(), options);
+        bulk_loaded = true;
+      }
+    }
+    if (!bulk_loaded) {
+      auto splice = typename skiplist_type::Splice{};
+      for (const auto& version : versions) {
+        skip_list_->Put(version.key_, version.value_, splice);
+      }
+    }
+    for (const auto& chunk : chunks) {
+      for (const auto& range : chunk.ranges_) {
+        range_tombstones_.Add(CopyKey(range.begin_), CopyKey(range.end_),
+                              range.sequence_);
+      }
+      stats.operations_ += chunk.ranges_.size();
+    }
+    stats.operations_ += versions.size();
+
+    auto last = std::max(stats.last_sequence_, LastSequence());
+    clock_->Restart(last);
+    stats.ok_ = true;
+    stats.bytes_ = log.size();
+    stats.seconds_ = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    return stats;
+  }
+
+  // NOTE(shiwen): the lock writers take, e.g. to read the Stats of an
+  // InstrumentedLock.
+  auto StateLock() const -> const lock_type& { return state_lock_; }
+
+  // NOTE(shiwen): the skiplist's search and allocation counters, with the
+  // latencies of this table's operations: Lookup and the Puts and Deletes
+  // that went through Insert, and the waits for state_lock_.
+  auto GetStats() const -> StatsSnapshot
+    requires stats_policy::Kenabled
+  {
+    auto snapshot = skip_list_->GetStats();
+    snapshot.latency_ = stats_.Snapshot().latency_;
+    return snapshot;
+  }
+
+  // NOTE(shiwen): the skiplist's arena, which also holds the keys of range
+  // tombstones.
+  auto ApproximateMemoryUsage() const -> size_t {
+    return skip_list_->ApproximateMemoryUsage();
+  }
+
+  // NOTE(shiwen): versions stored, tombstones included.
+  auto Count() const -> size_t { return skip_list_->Count(); }
+
+  // NOTE(shiwen): visit every live key in [begin, end) in key order with its
+  // newest value visible to snapshot, without taking state_lock_. If callback
+  // returns bool, false stops the scan.
+  template <typename F>
+  auto Scan(const key_type& begin, const key_type& end, F&& callback) const {
+    Scan(begin, end, std::forward<F>(callback), Snapshot{});
+  }
+
+  template <typename F>
+  auto Scan(const key_type& begin, const key_type& end, F&& callback,
+            const Snapshot& snapshot) const {
+    auto iter = typename skiplist_type::Iterator(skip_list_.get());
+    iter.Seek(internal_key_type{begin, snapshot.sequence_});
+    VisitNewest(
+        iter, &end,
+        [&](const key_type& key, const value_type& value, bool deleted) {
+          if (deleted) {
+            return true;
+          }
+          if constexpr (std::is_same_v<
+                            std::invoke_result_t<F&, const key_type&,
+                                                 const value_type&>,
+                            bool>) {
+            return callback(key, value);
+          } else {
+            callback(key, value);
+            return true;
+          }
+        },
+        snapshot);
+  }
+
+  // NOTE(shiwen): visit every key in key order with its newest version
+  // visible to snapshot, deleted ones included, e.g. to flush the table.
+  // callback(key, value, deleted), value is a tombstone when deleted by a
+  // point delete and the shadowed value when deleted by a range tombstone.
+  template <typename F>
+  auto ForEachNewest(F&& callback,
+                     const Snapshot& snapshot = Snapshot{}) const {
+    auto iter = typename skiplist_type::Iterator(skip_list_.get());
+    iter.SeekToFirst();
+    VisitNewest(
+        iter, nullptr,
+        [&](const key_type& key, const value_type& value, bool deleted) {
+          callback(key, value, deleted);
+          return true;
+        },
+        snapshot);
+  }
+
  private:
+  // NOTE(shiwen): versions of one key VisitNewest steps over before seeking.
+  enum { Kmax_version_steps = 8 };
+
+  // NOTE(shiwen): the sequence is taken before the write is logged and the
+  // lock is taken after, so concurrent writers share the Wal's group commit.
+  // Two writes of the same key may be inserted out of sequence order, the
+  // internal keys still order them by sequence. A write that fails to log
+  // still publishes its sequence, or the writes after it would never become
+  // visible.
+  auto Insert(WalOpType type, const key_type& key, const value_type& value)
+      -> bool {
+    auto timer = StatsTimer(
+        stats_, type == WalOpType::Kput ? StatsOp::Kput : StatsOp::Kdelete);
+    auto sequence = clock_->Take(1);
+    if (!LogWrite(sequence, 1, [&](auto& record) {
+          EncodeWalOp(record, type, ObjectBytes(key),
+                      type == WalOpType::Kput ? ObjectBytes(value)
+                                              : std::string_view{});
+        })) {
+      clock_->Publish(sequence, sequence);
+      return false;
+    }
+    LockState();
+    skip_list_->Put(internal_key_type{key, sequence}, value);
+    state_lock_.unlock();
+    clock_->Publish(sequence, sequence);
+    return true;
+  }
+
+  void LockState() {
+    auto start = stats_.Start();
+    state_lock_.lock();
+    stats_.Finish(StatsOp::Klock_wait, start);
+  }
+
+  template <typename F>
+  auto LogWrite(uint64_t sequence, uint32_t count, F&& encode_ops) -> bool {
+    return LogToWal<key_type, value_type>(wal_, sequence, count,
+                                          std::forward<F>(encode_ops));
+  }
+
+  // NOTE(shiwen): from iter up to end (nullptr for no end), hand
+  // visit(user_key, value, deleted) the newest version of each key visible to
+  // snapshot until it returns false.
+  template <typename I, typename F>
+  auto VisitNewest(I& iter, const key_type* end, F&& visit,
+                   const Snapshot& snapshot) const {
+    const auto& user_compare = skip_list_->compare_.user_comparator_;
+    while (iter.Valid()) {
+      auto internal_key = iter.key();
+      const auto& user_key = internal_key.user_key_;
+      if (end != nullptr && user_compare(user_key, *end) >= 0) {
+        return;
+      }
+      if (internal_key.sequence_ > snapshot.sequence_) {
+        // NOTE(shiwen): too new, the visible version of this key is further
+        // along.
+        SkipVersions(iter, user_key, snapshot.sequence_);
+        continue;
+      }
+      auto value = iter.value();
+      auto deleted = ValueTraits<value_type>::IsTombstone(value) ||
+                     RangeDeleted(user_key, internal_key.sequence_, snapshot);
+      if (!visit(user_key, value, deleted)) {
+        return;
+      }
+      // NOTE(shiwen): skip the older versions of this key.
+      SkipVersions(iter, user_key, 0);
+      if (iter.Valid() && user_compare(iter.key().user_key_, user_key) == 0) {
+        iter.Next();
+      }
+    }
+  }
+
+  // NOTE(shiwen): move iter past the versions of user_key newer than
+  // sequence. They are adjacent, so stepping over them is cheaper than a seek
+  // from the head; a key with a long run of versions falls back to the seek.
+  template <typename I>
+  void SkipVersions(I& iter, const key_type& user_key,
+                    uint64_t sequence) const {
+    const auto& user_compare = skip_list_->compare_.user_comparator_;
+    for (auto steps = 0; iter.Valid(); steps++) {
+      auto internal_key = iter.key();
+      if (internal_key.sequence_ <= sequence ||
+          user_compare(internal_key.user_key_, user_key) != 0) {
+        return;
+      }
+      if (steps == Kmax_version_steps) {
+        iter.Seek(internal_key_type{user_key, sequence});
+        return;
+      }
+      iter.Next();
+    }
+  }
+
+  // NOTE(shiwen): iter was sought to (key, sequence), it is on the newest
+  // version of key visible at sequence if there is one. Without a version a
+  // covering range tombstone still deletes the key for older tables.
+  template <typename I>
+  auto ReadVisible(const I& iter, const key_type& key, value_type& value,
+                   const Snapshot& snapshot) const -> LookupResult {
+    const auto& user_compare = skip_list_->compare_.user_comparator_;
+    if (!iter.Valid() || user_compare(iter.key().user_key_, key) != 0) {
+      return RangeDeleted(key, 0, snapshot) ? LookupResult::Kdeleted
+                                            : LookupResult::Knot_found;
+    }
+    if (RangeDeleted(key, iter.key().sequence_, snapshot)) {
+      return LookupResult::Kdeleted;
+    }
+    auto current = iter.value();
+    if (ValueTraits<value_type>::IsTombstone(current)) {
+      return LookupResult::Kdeleted;
+    }
+    value = current;
+    return LookupResult::Kfound;
+  }
+
+  // NOTE(shiwen): true if a range tombstone visible to snapshot is newer than
+  // the version of key written at sequence.
+  auto RangeDeleted(const key_type& key, uint64_t sequence,
+                    const Snapshot& snapshot) const -> bool {
+    return !range_tombstones_.Empty() &&
+           range_tombstones_.MaxCoveringSequence(key, snapshot.sequence_) >
+               sequence;
+  }
+
+  // NOTE(shiwen): byte string keys of range tombstones are copied into the
+  // skiplist's arena, which every writer already allocates from.
+  auto CopyKey(const key_type& key) -> key_type {
+    if constexpr (std::is_same_v<key_type, std::string_view>) {
+      return DecodeLengthPrefixed(
+          EncodeLengthPrefixed(key, skip_list_->arena_));
+    } else {
+      return key;
+    }
+  }
+
   std::shared_ptr<skiplist_type> skip_list_;
-  lock_type state_lock_{};
+  Wal* wal_;
+  RangeTombstones<key_type, user_comparator_type> range_tombstones_;
+  std::shared_ptr<SequenceClock> clock_;
+  [[no_unique_address]] mutable stats_policy stats_;
+  // NOTE(shiwen): last and on a line of its own, writers bouncing the lock
+  // do not evict the fields every reader loads.
+  alignas(KcacheLineSize) lock_type state_lock_{};
 };
@@ -1,20 +1,40 @@
+#pragma once
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <cstdint>
 #include <cstdlib>
 #include <ctime>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
-#include "random_gen.hpp"
+#include "arena.hpp"
+#include "bulk_load.hpp"
+#include "comparator.hpp"
+#include "epoch.hpp"
+#include "height_policy.hpp"
+#include "key_slot.hpp"
+#include "stats.hpp"
+#include "value_slot.hpp"
 
 template <typename T = uint32_t, typename U = uint32_t>
 struct Node {
   using key_type = T;
   using value_type = U;
   using NodePtr = Node*;
-  T k_;
-  U v_;
+  KeySlot<T> k_;
+  ValueSlot<U> v_;
+  // NOTE(shiwen): the node's top level once Put has linked it on every level,
+  // -1 before. Erase waits for it, so no level is linked after erasure began.
+  std::atomic<int32_t> top_level_;
+  // NOTE(shiwen): the low bit of next_lists_[level] is set when the node is
+  // being erased from that level, the link never changes again after that.
   std::atomic<NodePtr> next_lists_[];
 
   auto static GetNodeSize(int32_t max_node_level) {
@@ -23,151 +43,874 @@ struct Node {
     return sizeof(Node) + (max_node_level + 1) * sizeof(std::atomic<NodePtr>);
   }
 
+  static auto IsMarked(NodePtr node_ptr) -> bool {
+    return (reinterpret_cast<uintptr_t>(node_ptr) & 1) != 0;
+  }
+
+  static auto Unmarked(NodePtr node_ptr) -> NodePtr {
+    return reinterpret_cast<NodePtr>(reinterpret_cast<uintptr_t>(node_ptr) &
+                                     ~uintptr_t{1});
+  }
+
+  // NOTE(shiwen): the next node, whether or not this one is being erased.
   auto LoadNext(int32_t level) -> NodePtr {
+    return Unmarked(next_lists_[level].load(std::memory_order_acquire));
+  }
+
+  // NOTE(shiwen): the link with its mark.
+  auto LoadLink(int32_t level) -> NodePtr {
     return next_lists_[level].load(std::memory_order_acquire);
   }
 
+  // NOTE(shiwen): erased once marked on level 0.
+  auto Erased() -> bool { return IsMarked(LoadLink(0)); }
+
+  // NOTE(shiwen): returns false if the level was marked already.
+  auto Mark(int32_t level) -> bool {
+    auto next = LoadLink(level);
+    while (!IsMarked(next)) {
+      auto marked = reinterpret_cast<NodePtr>(
+          reinterpret_cast<uintptr_t>(next) | 1);
+      if (next_lists_[level].compare_exchange_weak(
+              next, marked, std::memory_order::acq_rel,
+              std::memory_order::acquire)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
   auto StoreNext(int32_t level, NodePtr node_ptr) {
     next_lists_[level].store(node_ptr, std::memory_order::release);
   }
+
+  auto NoBarrierStoreNext(int32_t level, NodePtr node_ptr) {
+    next_lists_[level].store(node_ptr, std::memory_order::relaxed);
+  }
+
+  auto CasNext(int32_t level, NodePtr expected, NodePtr node_ptr) -> bool {
+    return next_lists_[level].compare_exchange_strong(
+        expected, node_ptr, std::memory_order::release,
+        std::memory_order::relaxed);
+  }
 };
 
-// NOTE(shiwen): Multiple threads can read the skiplist at the same time, but
-// write operations must be mutually exclusive.
-template <typename T = uint32_t, typename U = uint32_t>
+// NOTE(shiwen): Multiple threads can read and write the skiplist at the same
+// time. Put links a new node bottom-up with a CAS on each level, so the arena
+// must be thread safe as well. Erase marks a node on every level, then
+// unlinks it the way Harris' list does: a search that meets a marked node
+// unlinks it before moving on. Readers pin the epoch domain, an erased node
+// is reused only once every reader that could reach it has unpinned.
+// S collects search path and latency stats, NoStats compiles them out.
+template <typename T = uint32_t, typename U = uint32_t,
+          typename A = ConcurrentArena, typename C = DefaultComparator<T>,
+          typename H = DefaultHeightPolicy, typename S = NoStats>
 struct SkipList {
   using key_type = T;
   using value_type = U;
+  using arena_type = A;
+  using comparator_type = C;
   using NodePtr = Node<key_type, value_type>*;
 
-  enum { Kmax_level = 15 };  // the height is 16.
-  enum { Kp = 4 };
+  using Probe = typename KeySlot<key_type>::Probe;
+
+  static_assert(ArenaConcept<arena_type>);
+
+  using height_policy = H;
+  using stats_policy = S;
+
+  enum : int32_t { Kmax_level = height_policy::Kmax_level };
+  enum : uint32_t { Kp = height_policy::Kp };
+  enum { Kmulti_get_lanes = 8 };
+  // NOTE(shiwen): every Kreclaim_interval erasures try to reclaim.
+  enum { Kreclaim_interval = 1 << 6 };
+  // NOTE(shiwen): declared before head_, the head node lives in the arena.
+  arena_type arena_;
   NodePtr head_;
   std::atomic<int32_t> level_;  // the skiplist level (initially 0)
+  // NOTE(shiwen): the highest level a node may reach, see
+  // HeightPolicy::MaxLevelFor.
+  const int32_t max_level_;
+  const comparator_type compare_;
+  // NOTE(shiwen): never reused, tells the per-thread splice caches of
+  // different lists apart.
+  const uint64_t id_;
+  std::atomic<size_t> entry_count_{0};
+  // NOTE(shiwen): erased nodes wait in retired_ until no reader can reach
+  // them, then free_nodes_[height] keeps them for NewNode to reuse. Only the
+  // nodes are reused, byte strings and boxed values stay in the arena.
+  RetireList<Node<key_type, value_type>> retired_;
+  std::atomic<uint64_t> erase_count_{0};
+  NaiveSpinLock free_lock_;
+  NodePtr free_nodes_[Kmax_level + 1]{};
+  std::atomic<size_t> free_count_{0};
+  // NOTE(shiwen): bumped by const searches too.
+  [[no_unique_address]] mutable stats_policy stats_;
 
   // key_type first_key_;
   // key_type last_key_;
 
-  Random rnd_;
-
-  explicit SkipList();
+  // NOTE(shiwen): expected_entries, if known, caps the tower heights at the
+  // level it needs.
+  explicit SkipList(const comparator_type& compare = comparator_type{},
+                    size_t expected_entries = 0);
+  // NOTE(shiwen): a list holding the (key, value) pairs in [first, last),
+  // see BulkLoad. options.expected_entries_ may cap the tower heights.
+  template <std::input_iterator It>
+  SkipList(It first, It last,
+           const BulkLoadOptions& options = BulkLoadOptions{},
+           const comparator_type& compare = comparator_type{});
   SkipList(SkipList&& other) = delete;
   ~SkipList();
 
+  auto NewNode(const key_type& key, const value_type& value,
+               int32_t level) -> NodePtr;
+  auto PopFreeNode(int32_t level) -> NodePtr;
+  void PushFreeNode(NodePtr node, int32_t level);
   auto GetRandomLevel() -> int32_t;
+  auto FindSpliceForLevel(const Probe& probe, NodePtr before, int32_t level,
+                          NodePtr* out_prev, NodePtr* out_next) const
+      -> bool;
+  auto FindSplice(const Probe& probe, int32_t top_level,
+                  int32_t bottom_level, NodePtr* prevs, NodePtr* nexts) const;
+  auto RefreshSplice(const Probe& probe, int32_t level, NodePtr* prevs,
+                     NodePtr* nexts) const;
+  auto UnlinkErased(const Probe& probe, int32_t top_level) const;
+  // NOTE(shiwen): the nodes around the last key put through it, like the
+  // splice of RocksDB's InlineSkipList. Brackets are nested, prevs_[i] <= key
+  // of the last put <= nexts_[i] and every level lies inside the one above.
+  // The next put starts from the lowest level whose bracket still contains
+  // its key, so sequential or clustered keys skip the upper levels entirely.
+  // Levels [0, height_] are filled, an empty splice has height_ -1. A splice
+  // filled in another epoch is dropped, its nodes may have been reused.
+  struct Splice {
+    int32_t height_{-1};
+    uint64_t epoch_{0};
+    NodePtr prevs_[Kmax_level + 1];
+    NodePtr nexts_[Kmax_level + 1];
+  };
+
+  // NOTE(shiwen): true if key lies in (prev, next].
+  auto BracketContains(const Probe& probe, NodePtr prev, NodePtr next) const
+      -> bool {
+    return (prev == head_ || prev->k_.Compare(probe, compare_) < 0) &&
+           (next == nullptr || next->k_.Compare(probe, compare_) >= 0);
+  }
+
+  // NOTE(shiwen): fill the list, which must be empty and not yet shared,
+  // with the (key, value) pairs in [first, last). Unsorted input is copied
+  // and sorted first, the last pair of a key wins. Nodes are then appended
+  // left to right, each level linked to the last node on it, without a
+  // search. Returns the number of keys.
+  template <typename It>
+  auto BulkLoad(It first, It last,
+                const BulkLoadOptions& options = BulkLoadOptions{}) -> size_t;
   auto Put(const key_type& key, const value_type& value) -> bool;
+  auto Put(const key_type& key, const value_type& value, Splice& splice)
+      -> bool;
   auto Get(const key_type& key, value_type& value) const -> bool;
+  // NOTE(shiwen): lock free like Put. Returns false if key was not there.
+  // Keys must be trivially destructible, the node is reused in place.
+  auto Erase(const key_type& key) -> bool
+    requires std::is_trivially_destructible_v<key_type>;
+  // NOTE(shiwen): move the erased nodes no reader can reach any more to the
+  // free lists. Erase calls it now and then, returns the nodes moved.
+  auto Reclaim() -> size_t;
+  // NOTE(shiwen): bytes taken from the arena, nodes and boxed values alike.
+  auto ApproximateMemoryUsage() const -> size_t {
+    return arena_.MemoryUsage();
+  }
+  // NOTE(shiwen): distinct keys inserted, puts that overwrite a value do not
+  // count.
+  auto Count() const -> size_t {
+    return entry_count_.load(std::memory_order_relaxed);
+  }
+  auto GetStats() const -> StatsSnapshot
+    requires stats_policy::Kenabled
+  {
+    return stats_.Snapshot();
+  }
+  // NOTE(shiwen): Seek iterators[i] to targets[i] for every target. Up to
+  // Kmulti_get_lanes searches run interleaved, each hop prefetches the node
+  // its lane reads next and moves on to the other lanes while it loads.
+  class Iterator;
+  auto MultiSeek(std::span<const key_type> targets,
+                 std::span<Iterator> iterators) const;
+  auto FindGreaterOrEqual(const key_type& key) const -> NodePtr;
+  auto FindLast() const -> NodePtr;
+  // NOTE(shiwen): node, or the first node after it that is not erased.
+  static auto SkipErased(NodePtr node) -> NodePtr {
+    while (node != nullptr && node->Erased()) {
+      node = node->LoadNext(0);
+    }
+    return node;
+  }
+
+  // NOTE(shiwen): an iterator pins the epoch domain until it is destroyed, so
+  // its node is never reused under it and it stays valid while writers run.
+  // It sees every key linked and not erased before it got there, with the
+  // newest value of each. It must stay on the thread that made it.
+  class Iterator {
+   public:
+    enum { Kprefetch_distance = 4 };
+
+    explicit Iterator(const SkipList* list) : list_(list) {}
+
+    auto Valid() const -> bool { return node_ != nullptr; }
+    auto key() const -> typename KeySlot<key_type>::view_type {
+      assert(Valid());
+      return node_->k_.Load();
+    }
+    auto value() const -> value_type {
+      assert(Valid());
+      return node_->v_.Load();
+    }
+    void Next();
+    // Advance to the first entry with a key >= target.
+    void Seek(const key_type& target);
+    void SeekToFirst();
+    void SeekToLast();
+
+   private:
+    friend struct SkipList;
+
+    void Reset(NodePtr node);
+
+    EpochGuard guard_;
+    const SkipList* list_;
+    NodePtr node_{nullptr};
+    // NOTE(shiwen): a level 0 cursor running Kprefetch_distance nodes ahead of
+    // node_, every node it reaches is prefetched.
+    NodePtr ahead_{nullptr};
+    int32_t ahead_distance_{0};
+  };
 };
 
-template <typename T, typename U>
-SkipList<T, U>::SkipList() : rnd_(time(nullptr)) {
-  auto head_node_size = Node<>::GetNodeSize(Kmax_level);
-  // NOTE(shiwen): use malloc to allocate memories, can be optimaized by arena.
-  head_ = static_cast<NodePtr>(malloc(head_node_size));
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+SkipList<T, U, A, C, H, S>::SkipList(const comparator_type& compare,
+                                     size_t expected_entries)
+    : max_level_(height_policy::MaxLevelFor(expected_entries)),
+      compare_(compare),
+      id_([] {
+        static std::atomic<uint64_t> next_id{1};
+        return next_id.fetch_add(1, std::memory_order_relaxed);
+      }()) {
+  // NOTE(shiwen): the head key is never compared.
+  head_ = NewNode(key_type{}, value_type{}, max_level_);
+  head_->top_level_.store(max_level_, std::memory_order_relaxed);
+  level_.store(0, std::memory_order_relaxed);
+}
 
-  // TODO(shiwen): did we need to initial the head_ ?
-  // BUG(shiwen): placement new to initialize atomics
-  // new (head_) Node<T, U>();
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+SkipList<T, U, A, C, H, S>::~SkipList() {
+  // NOTE(shiwen): all nodes live in arena_, which releases its blocks.
+}
 
-  // NOTE(shiwen): change this, min value of the key_type
-  head_->k_ = 0;
-  for (auto i = 0; i <= Kmax_level; i++) {
-    head_->StoreNext(i, nullptr);
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+auto SkipList<T, U, A, C, H, S>::NewNode(const key_type& key,
+                                         const value_type& value,
+                                         int32_t level) -> NodePtr {
+  auto new_node = PopFreeNode(level);
+  if (new_node == nullptr) {
+    auto new_node_size = Node<T, U>::GetNodeSize(level);
+    new_node = reinterpret_cast<NodePtr>(arena_.AllocateAligned(
+        new_node_size, alignof(Node<T, U>)));
+    stats_.Allocate(new_node_size);
   }
-  level_.store(0, std::memory_order_relaxed);
+  new_node->k_.Init(key, arena_, compare_);
+  new_node->v_.Init(value, arena_);
+  new (&new_node->top_level_) std::atomic<int32_t>(-1);
+  for (auto i = 0; i <= level; i++) {
+    new (&new_node->next_lists_[i]) std::atomic<NodePtr>(nullptr);
+  }
+  return new_node;
 }
 
-template <typename T, typename U>
-SkipList<T, U>::~SkipList() {
-  NodePtr current = head_;
-  while (current) {
-    NodePtr next = current->LoadNext(0);
-    free(current);
-    current = next;
+// NOTE(shiwen): lists that never erase only pay for the load of free_count_.
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+auto SkipList<T, U, A, C, H, S>::PopFreeNode(int32_t level) -> NodePtr {
+  if (free_count_.load(std::memory_order_relaxed) == 0) {
+    return nullptr;
   }
+  std::lock_guard<NaiveSpinLock> guard(free_lock_);
+  auto node = free_nodes_[level];
+  if (node != nullptr) {
+    free_nodes_[level] = node->LoadNext(0);
+    free_count_.fetch_sub(1, std::memory_order_relaxed);
+  }
+  return node;
+}
+
+// NOTE(shiwen): node must be unreachable, its level 0 link chains the free
+// list.
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+void SkipList<T, U, A, C, H, S>::PushFreeNode(NodePtr node, int32_t level) {
+  std::lock_guard<NaiveSpinLock> guard(free_lock_);
+  node->NoBarrierStoreNext(0, free_nodes_[level]);
+  free_nodes_[level] = node;
+  free_count_.fetch_add(1, std::memory_order_relaxed);
 }
 
-template <typename T, typename U>
-auto SkipList<T, U>::Get(const key_type& key, value_type& value) const -> bool {
-  // NOTE(shiwen): check [first_key, last_key].
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+auto SkipList<T, U, A, C, H, S>::Get(const key_type& key,
+                                     value_type& value) const -> bool {
+  auto timer = StatsTimer(stats_, StatsOp::Kget);
+  auto guard = EpochGuard{};
+  auto probe = Probe(key, compare_);
   auto cur_node = head_;
   for (auto cur_node_level = level_.load(std::memory_order_acquire);
        cur_node_level >= 0; cur_node_level--) {
     while (true) {
       NodePtr next = cur_node->LoadNext(cur_node_level);
-      if (next == nullptr || next->k_ > key) {
+      if (next == nullptr) {
         break;
       }
-      if (next->k_ == key) {
-        // NOTE(shiwen): if dupliacate key, need to get the bottom value.
-        if (cur_node_level == 0) {
-          value = next->v_;
-          return true;
-        }
+      stats_.Compare();
+      auto cmp = next->k_.Compare(probe, compare_);
+      if (cmp > 0) {
         break;
       }
+      if (cmp == 0) {
+        // NOTE(shiwen): keys are unique among the nodes not erased. A node
+        // put again after an erasure may sit behind the erased one until
+        // Erase unlinks it, so look further down.
+        if (next->Erased()) {
+          break;
+        }
+        value = next->v_.Load();
+        return true;
+      }
+      stats_.Hop(cur_node_level);
       cur_node = next;
     }
   }
   return false;
 }
 
-template <typename T, typename U>
-auto SkipList<T, U>::GetRandomLevel() -> int32_t {
-  auto level = 0;
-  while (level < Kmax_level && rnd_.OneIn(Kp)) {
-    ++level;
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+auto SkipList<T, U, A, C, H, S>::Erase(const key_type& key) -> bool
+  requires std::is_trivially_destructible_v<key_type>
+{
+  auto timer = StatsTimer(stats_, StatsOp::Kdelete);
+  auto guard = EpochGuard{};
+  auto probe = Probe(key, compare_);
+  NodePtr prevs[Kmax_level + 1];
+  NodePtr nexts[Kmax_level + 1];
+  FindSplice(probe, level_.load(std::memory_order_acquire), 0, prevs, nexts);
+  auto node = nexts[0];
+  if (node == nullptr || node->k_.Compare(probe, compare_) != 0) {
+    return false;
+  }
+  // NOTE(shiwen): a Put still linking the node is nearly done.
+  auto wait = SpinWait{};
+  auto top_level = node->top_level_.load(std::memory_order_acquire);
+  while (top_level < 0) {
+    wait.Pause();
+    top_level = node->top_level_.load(std::memory_order_acquire);
   }
-  return level;
+  // NOTE(shiwen): mark top-down, whoever marks level 0 erased the key.
+  for (auto level = top_level; level > 0; level--) {
+    node->Mark(level);
+  }
+  if (!node->Mark(0)) {
+    return false;
+  }
+  // NOTE(shiwen): nothing links to a marked node again, once it is unlinked on
+  // every level no new reader can reach it.
+  UnlinkErased(probe, top_level);
+  entry_count_.fetch_sub(1, std::memory_order_relaxed);
+  stats_.Height(top_level, -1);
+  retired_.Retire(node);
+  if ((erase_count_.fetch_add(1, std::memory_order_relaxed) + 1) %
+          Kreclaim_interval ==
+      0) {
+    Reclaim();
+  }
+  return true;
 }
 
-// NOTE(shiwen): Additional synchronization mechanisms should be added at the
-// upper layer to ensure that only one thread can call the put method at a time.
-template <typename T, typename U>
-auto SkipList<T, U>::Put(const key_type& key, const value_type& value) -> bool {
-  auto prevs = std::vector<NodePtr>(Kmax_level + 1);
-  auto nexts = std::vector<NodePtr>(Kmax_level + 1);
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+auto SkipList<T, U, A, C, H, S>::Reclaim() -> size_t {
+  return retired_.Reclaim([this](NodePtr node) {
+    PushFreeNode(node, node->top_level_.load(std::memory_order_relaxed));
+  });
+}
 
-  auto old_level = level_.load(std::memory_order_acquire);
-  auto cur_node = head_;
-  for (auto cur_node_level = old_level; cur_node_level >= 0; cur_node_level--) {
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+auto SkipList<T, U, A, C, H, S>::MultiSeek(
+    std::span<const key_type> targets, std::span<Iterator> iterators) const {
+  assert(iterators.size() >= targets.size());
+  struct Lane {
+    size_t index_;
+    Probe probe_;
+    NodePtr node_;
+    NodePtr next_;
+    int32_t level_;
+  };
+  Lane lanes[Kmulti_get_lanes];
+  size_t active = 0;
+  size_t next_index = 0;
+  auto start = [&](Lane& lane) {
+    lane.index_ = next_index;
+    lane.probe_ = Probe(targets[next_index++], compare_);
+    lane.node_ = head_;
+    lane.level_ = level_.load(std::memory_order_acquire);
+    lane.next_ = head_->LoadNext(lane.level_);
+    __builtin_prefetch(lane.next_);
+  };
+  while (active < Kmulti_get_lanes && next_index < targets.size()) {
+    start(lanes[active++]);
+  }
+
+  while (active > 0) {
+    for (size_t i = 0; i < active;) {
+      auto& lane = lanes[i];
+      // NOTE(shiwen): one hop of FindGreaterOrEqual, next_ was prefetched by
+      // the last one.
+      auto next = lane.next_;
+      auto cmp = 1;
+      if (next != nullptr) {
+        stats_.Compare();
+        cmp = next->k_.Compare(lane.probe_, compare_);
+      }
+      auto done = false;
+      if (cmp < 0) {
+        stats_.Hop(lane.level_);
+        lane.node_ = next;
+      } else if ((cmp == 0 && !next->Erased()) || lane.level_ == 0) {
+        iterators[lane.index_].Reset(next);
+        done = true;
+      } else {
+        lane.level_--;
+      }
+
+      if (!done) {
+        lane.next_ = lane.node_->LoadNext(lane.level_);
+        __builtin_prefetch(lane.next_);
+        i++;
+      } else if (next_index < targets.size()) {
+        start(lane);
+        i++;
+      } else {
+        lane = lanes[--active];
+      }
+    }
+  }
+}
+
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+template <std::input_iterator It>
+SkipList<T, U, A, C, H, S>::SkipList(It first, It last,
+    const BulkLoadOptions& options, const comparator_type& compare)
+    : SkipList(compare, ExpectedEntries(first, last, options)) {
+  BulkLoad(first, last, options);
+}
+
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+template <typename It>
+auto SkipList<T, U, A, C, H, S>::BulkLoad(It first, It last,
+    const BulkLoadOptions& options) -> size_t {
+  assert(head_->LoadNext(0) == nullptr);
+  if (!options.sorted_) {
+    auto entries = SortForBulkLoad<key_type, value_type>(
+        first, last, compare_, options.sort_threads_);
+    auto sorted = options;
+    sorted.sorted_ = true;
+    return BulkLoad(entries.begin(), entries.end(), sorted);
+  }
+  NodePtr prevs[Kmax_level + 1];
+  std::fill(std::begin(prevs), std::end(prevs), head_);
+  auto max_level = level_.load(std::memory_order_relaxed);
+  size_t count = 0;
+  for (; first != last; ++first) {
+    const auto& [key, value] = *first;
+    auto level = options.heights_ == TowerHeights::Kbalanced
+                     ? BalancedHeight(count + 1, Kp, max_level_)
+                     : GetRandomLevel();
+    auto new_node = NewNode(key, value, level);
+    new_node->top_level_.store(level, std::memory_order_relaxed);
+    for (auto i = 0; i <= level; i++) {
+      prevs[i]->NoBarrierStoreNext(i, new_node);
+      prevs[i] = new_node;
+    }
+    stats_.Height(level, 1);
+    max_level = std::max(max_level, level);
+    count++;
+  }
+  entry_count_.fetch_add(count, std::memory_order_relaxed);
+  level_.store(max_level, std::memory_order_release);
+  return count;
+}
+
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+auto SkipList<T, U, A, C, H, S>::GetRandomLevel() -> int32_t {
+  return height_policy::RandomLevel(max_level_);
+}
+
+// NOTE(shiwen): find the nodes around key on one level, starting from before,
+// which must be on that level and have a smaller key. Nodes being erased are
+// unlinked on the way, so neither of the two found is marked on that level.
+// Returns false if before itself is being erased, it can not be linked to.
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+auto SkipList<T, U, A, C, H, S>::FindSpliceForLevel(
+    const Probe& probe, NodePtr before, int32_t level, NodePtr* out_prev,
+    NodePtr* out_next) const -> bool {
+  NodePtr next_node = before->LoadLink(level);
+  while (true) {
+    if (Node<T, U>::IsMarked(next_node)) {
+      return false;
+    }
+    if (next_node == nullptr) {
+      break;
+    }
+    NodePtr after = next_node->LoadLink(level);
+    if (Node<T, U>::IsMarked(after)) {
+      after = Node<T, U>::Unmarked(after);
+      next_node = before->CasNext(level, next_node, after)
+                      ? after
+                      : before->LoadLink(level);
+      continue;
+    }
+    stats_.Compare();
+    if (next_node->k_.Compare(probe, compare_) >= 0) {
+      break;
+    }
+    stats_.Hop(level);
+    before = next_node;
+    next_node = after;
+  }
+  *out_prev = before;
+  *out_next = next_node;
+  return true;
+}
+
+// NOTE(shiwen): search levels [bottom_level, top_level] from head_, which is
+// never erased.
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+auto SkipList<T, U, A, C, H, S>::FindSplice(const Probe& probe,
+                                            int32_t top_level,
+                                            int32_t bottom_level,
+                                            NodePtr* prevs,
+                                            NodePtr* nexts) const {
+  auto level = top_level;
+  auto before = head_;
+  while (level >= bottom_level) {
+    if (!FindSpliceForLevel(probe, before, level, &prevs[level],
+                            &nexts[level])) {
+      level = top_level;
+      before = head_;
+      continue;
+    }
+    before = prevs[level];
+    level--;
+  }
+}
+
+// NOTE(shiwen): search one level of a splice again, from the top if its
+// predecessor is being erased.
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+auto SkipList<T, U, A, C, H, S>::RefreshSplice(const Probe& probe,
+                                               int32_t level, NodePtr* prevs,
+                                               NodePtr* nexts) const {
+  if (!FindSpliceForLevel(probe, prevs[level], level, &prevs[level],
+                          &nexts[level])) {
+    FindSplice(probe, level_.load(std::memory_order_acquire), level, prevs,
+               nexts);
+  }
+}
+
+// NOTE(shiwen): unlink every marked node of key on levels [0, top_level]. A
+// Put whose splice was taken before an erasure may have linked a node of the
+// same key in front of the erased one, where FindSplice stops, so walk on
+// past the nodes of key.
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+auto SkipList<T, U, A, C, H, S>::UnlinkErased(const Probe& probe,
+                                              int32_t top_level) const {
+  NodePtr prevs[Kmax_level + 1];
+  NodePtr nexts[Kmax_level + 1];
+  FindSplice(probe, level_.load(std::memory_order_acquire), 0, prevs, nexts);
+  auto level = top_level;
+  while (level >= 0) {
+    auto before = prevs[level];
+    NodePtr next_node = before->LoadLink(level);
     while (true) {
-      NodePtr next_node = cur_node->LoadNext(cur_node_level);
-      if (next_node == nullptr || next_node->k_ >= key) {
-        prevs[cur_node_level] = cur_node;
-        nexts[cur_node_level] = next_node;
+      if (Node<T, U>::IsMarked(next_node) || next_node == nullptr ||
+          next_node->k_.Compare(probe, compare_) > 0) {
         break;
       }
-      cur_node = next_node;
+      NodePtr after = next_node->LoadLink(level);
+      if (Node<T, U>::IsMarked(after)) {
+        after = Node<T, U>::Unmarked(after);
+        next_node = before->CasNext(level, next_node, after)
+                        ? after
+                        : before->LoadLink(level);
+        continue;
+      }
+      before = next_node;
+      next_node = after;
+    }
+    if (Node<T, U>::IsMarked(next_node)) {
+      // NOTE(shiwen): before is being erased, search the level again.
+      FindSplice(probe, level_.load(std::memory_order_acquire), level, prevs,
+                 nexts);
+      continue;
     }
+    level--;
   }
+}
 
-  // init the new node
-  auto new_node_level = GetRandomLevel();
-  auto new_node_size = Node<>::GetNodeSize(new_node_level);
-  auto new_node = static_cast<NodePtr>(malloc(new_node_size));
-  new_node->k_ = key;
-  new_node->v_ = value;
-  if (new_node_level > level_) {
-    // BUG(shiwen): Xiaopeng mentioned that two atomic variables should not
-    // appear in the same function.
-    for (auto level = old_level + 1; level <= new_node_level; level++) {
-      prevs[level] = head_;
-      nexts[level] = nullptr;
+// NOTE(shiwen): lock free, can be called by many writers at the same time.
+// Every writer thread keeps its own cached splice for this list.
+// Returns true if a new node was inserted, false if an existing key had its
+// value overwritten in place.
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+auto SkipList<T, U, A, C, H, S>::Put(const key_type& key,
+                                     const value_type& value) -> bool {
+  thread_local struct {
+    uint64_t owner_{0};
+    Splice splice_;
+  } cache;
+  if (cache.owner_ != id_) {
+    cache.owner_ = id_;
+    cache.splice_ = Splice{};
+  }
+  return Put(key, value, cache.splice_);
+}
+
+// NOTE(shiwen): a splice belongs to one writer, concurrent writers each need
+// their own.
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+auto SkipList<T, U, A, C, H, S>::Put(const key_type& key,
+                                     const value_type& value,
+                                     Splice& splice) -> bool {
+  auto timer = StatsTimer(stats_, StatsOp::Kput);
+  auto guard = EpochGuard{};
+  if (splice.epoch_ != guard.Epoch()) {
+    splice.height_ = -1;
+    splice.epoch_ = guard.Epoch();
+  }
+  auto probe = Probe(key, compare_);
+  auto& prevs = splice.prevs_;
+  auto& nexts = splice.nexts_;
+
+  auto max_level = level_.load(std::memory_order_acquire);
+  // NOTE(shiwen): levels the splice has never seen bracket the whole list.
+  // They always contain key but are no tighter than a search from the top, so
+  // only the levels seen before can save work.
+  auto seen_height = splice.height_;
+  for (auto level = seen_height + 1; level <= max_level; level++) {
+    prevs[level] = head_;
+    nexts[level] = nullptr;
+  }
+  splice.height_ = std::max(splice.height_, max_level);
+
+  auto start_level = 0;
+  while (start_level <= seen_height &&
+         !BracketContains(probe, prevs[start_level], nexts[start_level])) {
+    start_level++;
+  }
+  if (start_level > seen_height) {
+    start_level = max_level;
+    prevs[max_level] = head_;
+  }
+
+  for (auto level = start_level; level >= 0; level--) {
+    auto before = level == start_level ? prevs[level] : prevs[level + 1];
+    if (!FindSpliceForLevel(probe, before, level, &prevs[level],
+                            &nexts[level])) {
+      // NOTE(shiwen): a node of the splice is being erased, start over from
+      // the top.
+      start_level = max_level;
+      prevs[start_level] = head_;
+      level = start_level + 1;
+      continue;
+    }
+    auto next_node = nexts[level];
+    if (next_node != nullptr &&
+        next_node->k_.Compare(probe, compare_) == 0) {
+      next_node->v_.Store(value, arena_);
+      stats_.Duplicate();
+      // NOTE(shiwen): keep the brackets nested for the levels not searched.
+      for (auto lower_level = level - 1; lower_level >= 0; lower_level--) {
+        prevs[lower_level] = prevs[level];
+        nexts[lower_level] = next_node;
+      }
+      return false;
     }
-    level_.store(new_node_level, std::memory_order_release);
   }
 
-  // NOTE(shiwen): these operations do not need sync mechanisms.
-  for (auto level = 0; level <= new_node_level; level++) {
-    assert(level <= Kmax_level);
-    new_node->StoreNext(level, nexts[level]);
+  auto new_node_level = GetRandomLevel();
+  while (new_node_level > max_level &&
+         !level_.compare_exchange_weak(max_level, new_node_level,
+                                       std::memory_order_acq_rel)) {
+  }
+  // NOTE(shiwen): the levels above start_level still contain key but may be
+  // stale, other writers may already use the levels above max_level.
+  for (auto level = std::min<int32_t>(new_node_level, splice.height_);
+       level > start_level; level--) {
+    RefreshSplice(probe, level, prevs, nexts);
   }
+  for (auto level = new_node_level; level > splice.height_; level--) {
+    FindSpliceForLevel(probe, head_, level, &prevs[level], &nexts[level]);
+  }
+  splice.height_ = std::max(splice.height_, new_node_level);
+
+  auto new_node = NewNode(key, value, new_node_level);
 
+  // NOTE(shiwen): link bottom-up, so a node reachable on some level is always
+  // reachable on every level below it. When a CAS loses against another
+  // writer or an erasure, only that level's splice is recomputed, starting
+  // from the old predecessor unless it is being erased. A successor being
+  // erased counts as a lost CAS, linking in front of it would hide it from
+  // the search that unlinks it.
   for (auto level = 0; level <= new_node_level; level++) {
     assert(level <= Kmax_level);
-    prevs[level]->StoreNext(level, new_node);
+    while (true) {
+      if (nexts[level] == nullptr ||
+          !Node<T, U>::IsMarked(nexts[level]->LoadLink(level))) {
+        new_node->NoBarrierStoreNext(level, nexts[level]);
+        if (prevs[level]->CasNext(level, nexts[level], new_node)) {
+          break;
+        }
+      }
+      RefreshSplice(probe, level, prevs, nexts);
+      // NOTE(shiwen): another writer linked the same key first, the new node
+      // was never published so it goes straight back to the free list.
+      if (level == 0 && nexts[0] != nullptr &&
+          nexts[0]->k_.Compare(probe, compare_) == 0) {
+        nexts[0]->v_.Store(value, arena_);
+        stats_.Duplicate();
+        PushFreeNode(new_node, new_node_level);
+        return false;
+      }
+    }
+    prevs[level] = new_node;
   }
+  new_node->top_level_.store(new_node_level, std::memory_order_release);
 
+  entry_count_.fetch_add(1, std::memory_order_relaxed);
+  stats_.Height(new_node_level, 1);
   return true;
 }
+
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+auto SkipList<T, U, A, C, H, S>::FindGreaterOrEqual(const key_type& key) const
+    -> NodePtr {
+  auto probe = Probe(key, compare_);
+  auto cur_node = head_;
+  NodePtr next = nullptr;
+  for (auto cur_node_level = level_.load(std::memory_order_acquire);
+       cur_node_level >= 0; cur_node_level--) {
+    while (true) {
+      next = cur_node->LoadNext(cur_node_level);
+      if (next == nullptr) {
+        break;
+      }
+      stats_.Compare();
+      if (next->k_.Compare(probe, compare_) >= 0) {
+        break;
+      }
+      stats_.Hop(cur_node_level);
+      cur_node = next;
+    }
+  }
+  return next;
+}
+
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+auto SkipList<T, U, A, C, H, S>::FindLast() const -> NodePtr {
+  while (true) {
+    auto cur_node = head_;
+    for (auto cur_node_level = level_.load(std::memory_order_acquire);
+         cur_node_level >= 0; cur_node_level--) {
+      while (true) {
+        auto next = cur_node->LoadNext(cur_node_level);
+        if (next == nullptr) {
+          break;
+        }
+        cur_node = next;
+      }
+    }
+    if (cur_node == head_ || !cur_node->Erased()) {
+      return cur_node == head_ ? nullptr : cur_node;
+    }
+    // NOTE(shiwen): the last node is being erased, unlink it and look again.
+    NodePtr prevs[Kmax_level + 1];
+    NodePtr nexts[Kmax_level + 1];
+    FindSplice(Probe(cur_node->k_.Load(), compare_),
+               level_.load(std::memory_order_acquire), 0, prevs, nexts);
+  }
+}
+
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+void SkipList<T, U, A, C, H, S>::Iterator::Reset(NodePtr node) {
+  node_ = SkipErased(node);
+  ahead_ = node;
+  ahead_distance_ = 0;
+}
+
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+void SkipList<T, U, A, C, H, S>::Iterator::Next() {
+  assert(Valid());
+  node_ = node_->LoadNext(0);
+  // NOTE(shiwen): ahead_ only counts the distance, erased nodes are skipped
+  // whenever node_ reaches them.
+  if (node_ != nullptr && node_->Erased()) {
+    node_ = SkipErased(node_);
+    ahead_distance_ = 0;
+  }
+  if (ahead_distance_ == 0) {
+    ahead_ = node_;
+  } else {
+    ahead_distance_--;
+  }
+  while (ahead_ != nullptr && ahead_distance_ < Kprefetch_distance) {
+    auto next = ahead_->LoadNext(0);
+    if (next == nullptr) {
+      break;
+    }
+    __builtin_prefetch(next);
+    ahead_ = next;
+    ahead_distance_++;
+  }
+}
+
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+void SkipList<T, U, A, C, H, S>::Iterator::Seek(const key_type& target) {
+  Reset(list_->FindGreaterOrEqual(target));
+}
+
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+void SkipList<T, U, A, C, H, S>::Iterator::SeekToFirst() {
+  Reset(list_->head_->LoadNext(0));
+}
+
+template <typename T, typename U, typename A, typename C, typename H,
+          typename S>
+void SkipList<T, U, A, C, H, S>::Iterator::SeekToLast() {
+  Reset(list_->FindLast());
+}
@@ -0,0 +1,515 @@
+#pragma once
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "coding.hpp"
+#include "comparator.hpp"
+#include "crc32c.hpp"
+#include "simple_memtable.hpp"
+
+// NOTE(shiwen): a sorted run is an immutable file of unique keys in
+// comparator order, each with a value or a deletion marker, so a run flushed
+// from a MemTable still hides older data for the keys deleted in it.
+//
+//   [data block]...[index block][footer]
+//
+// A data block holds whole entries
+//   type (1 byte) | varint32 key size | key | varint32 value size | value
+// followed by the fixed32 offset of each entry in the block, the fixed32
+// entry count and the masked crc32c of everything before it. Blocks are cut
+// once they reach KsortedRunBlockSize. The index block has one entry per data
+// block,
+//   varint32 key size | last key of the block | fixed64 offset | fixed32 size
+// followed by its masked crc32c. The footer is the fixed64 offset and size of
+// the index block, the fixed64 entry count and the fixed64 magic number.
+// Keys and values are stored as ObjectBytes.
+enum class SortedRunEntryType : uint8_t { Kvalue = 0, Kdeletion = 1 };
+
+constexpr size_t KsortedRunBlockSize = 4 << 10;
+constexpr size_t KsortedRunFooterSize = 32;
+constexpr size_t KsortedRunCrcSize = 4;
+constexpr uint64_t KsortedRunMagic = 0x736B69706C697374;  // "skiplist"
+
+// NOTE(shiwen): streams keys added in strictly increasing order into a sorted
+// run, at most one data block is buffered. The file is written under
+// path + ".tmp" and renamed over path by Finish, so path either holds a whole
+// run or is left alone. Every call returns false once anything failed.
+template <typename T = uint32_t, typename U = uint32_t,
+          typename C = DefaultComparator<T>>
+class SortedRunWriter {
+ public:
+  using key_type = T;
+  using value_type = U;
+  using comparator_type = C;
+
+  explicit SortedRunWriter(const comparator_type& compare = comparator_type{})
+      : compare_(compare) {}
+  SortedRunWriter(const SortedRunWriter&) = delete;
+  SortedRunWriter& operator=(const SortedRunWriter&) = delete;
+  ~SortedRunWriter() {
+    if (file_ != nullptr) {
+      std::fclose(file_);
+      std::remove(TempPath().c_str());
+    }
+  }
+
+  auto Open(const std::string& path) -> bool {
+    path_ = path;
+    file_ = std::fopen(TempPath().c_str(), "wb");
+    ok_ = file_ != nullptr;
+    return ok_;
+  }
+
+  auto Add(const key_type& key, const value_type& value, bool deleted = false)
+      -> bool {
+    if (!ok_ || (count_ > 0 && compare_(last_key_, key) >= 0)) {
+      return ok_ = false;
+    }
+    auto key_bytes = ObjectBytes(key);
+    auto value_bytes = deleted ? std::string_view{} : ObjectBytes(value);
+    offsets_.push_back(static_cast<uint32_t>(block_.size()));
+    auto type = deleted ? SortedRunEntryType::Kdeletion
+                        : SortedRunEntryType::Kvalue;
+    block_.push_back(static_cast<char>(type));
+    AppendLengthPrefixed(block_, key_bytes);
+    AppendLengthPrefixed(block_, value_bytes);
+    last_key_bytes_.assign(key_bytes);
+    last_key_ = ObjectFromBytes<key_type>(last_key_bytes_);
+    count_++;
+    if (block_.size() >= KsortedRunBlockSize) {
+      FlushBlock();
+    }
+    return ok_;
+  }
+
+  // NOTE(shiwen): write the index and footer, sync and publish the file.
+  auto Finish() -> bool {
+    if (!ok_) {
+      return false;
+    }
+    FlushBlock();
+    auto index_offset = offset_;
+    AppendCrc(index_);
+    Write(index_);
+    std::string footer(KsortedRunFooterSize, '\0');
+    EncodeFixed64(footer.data(), index_offset);
+    EncodeFixed64(footer.data() + 8, index_.size());
+    EncodeFixed64(footer.data() + 16, count_);
+    EncodeFixed64(footer.data() + 24, KsortedRunMagic);
+    Write(footer);
+    ok_ = ok_ && std::fflush(file_) == 0 && fsync(fileno(file_)) == 0;
+    ok_ = std::fclose(file_) == 0 && ok_;
+    file_ = nullptr;
+    ok_ = ok_ && std::rename(TempPath().c_str(), path_.c_str()) == 0;
+    if (!ok_) {
+      std::remove(TempPath().c_str());
+    }
+    return ok_;
+  }
+
+  auto Count() const -> uint64_t { return count_; }
+
+ private:
+  static void AppendLengthPrefixed(std::string& dst, std::string_view bytes) {
+    char buf[KmaxVarint32Length];
+    auto end = EncodeVarint32(buf, static_cast<uint32_t>(bytes.size()));
+    dst.append(buf, end - buf);
+    dst.append(bytes);
+  }
+
+  static void AppendFixed32(std::string& dst, uint32_t value) {
+    char buf[4];
+    EncodeFixed32(buf, value);
+    dst.append(buf, sizeof(buf));
+  }
+
+  static void AppendFixed64(std::string& dst, uint64_t value) {
+    char buf[8];
+    EncodeFixed64(buf, value);
+    dst.append(buf, sizeof(buf));
+  }
+
+  static void AppendCrc(std::string& dst) {
+    AppendFixed32(dst, MaskCrc(Crc32c(dst.data(), dst.size())));
+  }
+
+  auto TempPath() const -> std::string { return path_ + ".tmp"; }
+
+  void Write(const std::string& bytes) {
+    ok_ = ok_ && std::fwrite(bytes.data(), 1, bytes.size(), file_) ==
+                     bytes.size();
+    offset_ += bytes.size();
+  }
+
+  void FlushBlock() {
+    if (offsets_.empty()) {
+      return;
+    }
+    for (auto offset : offsets_) {
+      AppendFixed32(block_, offset);
+    }
+    AppendFixed32(block_, static_cast<uint32_t>(offsets_.size()));
+    AppendCrc(block_);
+    AppendLengthPrefixed(index_, last_key_bytes_);
+    AppendFixed64(index_, offset_);
+    AppendFixed32(index_, static_cast<uint32_t>(block_.size()));
+    Write(block_);
+    block_.clear();
+    offsets_.clear();
+  }
+
+  const comparator_type compare_;
+  std::string path_;
+  std::FILE* file_{nullptr};
+  bool ok_{false};
+  uint64_t offset_{0};
+  uint64_t count_{0};
+  std::string block_;
+  std::vector<uint32_t> offsets_;
+  std::string index_;
+  // NOTE(shiwen): owns the bytes last_key_ may point into.
+  std::string last_key_bytes_;
+  key_type last_key_{};
+};
+
+// NOTE(shiwen): flush the newest version of every key in memtable visible to
+// snapshot into a sorted run at path. Range tombstones are applied to the
+// keys of this table and written as deletions, they do not reach keys
+// outside of it.
+template <typename M>
+auto WriteSortedRun(const M& memtable, const std::string& path,
+                    const typename M::Snapshot& snapshot =
+                        typename M::Snapshot{}) -> bool {
+  auto writer = SortedRunWriter<typename M::key_type, typename M::value_type,
+                                typename M::user_comparator_type>{};
+  if (!writer.Open(path)) {
+    return false;
+  }
+  memtable.ForEachNewest(
+      [&writer](const typename M::key_type& key,
+                const typename M::value_type& value,
+                bool deleted) { writer.Add(key, value, deleted); },
+      snapshot);
+  return writer.Finish();
+}
+
+// NOTE(shiwen): serves a sorted run straight from a read only mapping of the
+// file. Byte string keys and values point into the mapping and stay valid as
+// long as the reader. Open checks the footer and the index block, entries are
+// bounds checked against their block as they are decoded: a corrupt one ends
+// iteration with Corrupted() set and makes Lookup return Kcorruption. Only
+// VerifyChecksums catches bytes that were flipped within bounds.
+template <typename T = uint32_t, typename U = uint32_t,
+          typename C = DefaultComparator<T>>
+class SortedRunReader {
+ public:
+  using key_type = T;
+  using value_type = U;
+  using comparator_type = C;
+
+  // NOTE(shiwen): nullptr if the file cannot be mapped or is not a whole
+  // sorted run.
+  static auto Open(const std::string& path,
+                   const comparator_type& compare = comparator_type{})
+      -> std::unique_ptr<SortedRunReader> {
+    auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        static_cast<size_t>(st.st_size) < KsortedRunFooterSize) {
+      close(fd);
+      return nullptr;
+    }
+    auto size = static_cast<size_t>(st.st_size);
+    auto base = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+      return nullptr;
+    }
+    auto reader = std::unique_ptr<SortedRunReader>(new SortedRunReader(
+        static_cast<const char*>(base), size, compare));
+    if (!reader->LoadIndex()) {
+      return nullptr;
+    }
+    return reader;
+  }
+
+  SortedRunReader(const SortedRunReader&) = delete;
+  SortedRunReader& operator=(const SortedRunReader&) = delete;
+  ~SortedRunReader() { munmap(const_cast<char*>(data_), size_); }
+
+  auto Count() const -> uint64_t { return count_; }
+
+ private:
+  struct Block {
+    std::string_view last_key_;
+    uint64_t offset_;
+    uint64_t size_;
+    // NOTE(shiwen): the entry offsets of the block, fixed32 each.
+    const char* offsets_;
+    uint32_t count_;
+  };
+
+  struct Entry {
+    std::string_view key_;
+    std::string_view value_;
+    bool deleted_{false};
+  };
+
+ public:
+  // NOTE(shiwen): a position in the run, entries are decoded in place.
+  class Iterator {
+   public:
+    explicit Iterator(const SortedRunReader* run) : run_(run) {}
+
+    auto Valid() const -> bool { return block_ < run_->blocks_.size(); }
+
+    // NOTE(shiwen): the iterator stopped at an entry that does not fit its
+    // block.
+    auto Corrupted() const -> bool { return corrupted_; }
+
+    void SeekToFirst() { SeekToBlock(0, 0); }
+
+    // NOTE(shiwen): the first entry whose key is >= target.
+    void Seek(const key_type& target) {
+      const auto& blocks = run_->blocks_;
+      auto block = std::partition_point(
+          blocks.begin(), blocks.end(), [this, &target](const Block& b) {
+            return run_->compare_(ObjectFromBytes<key_type>(b.last_key_),
+                                  target) < 0;
+          });
+      if (block == blocks.end()) {
+        block_ = blocks.size();
+        return;
+      }
+      const auto& entries = *block;
+      uint32_t lo = 0;
+      uint32_t hi = entries.count_;
+      while (lo < hi) {
+        auto mid = lo + (hi - lo) / 2;
+        if (!run_->DecodeEntry(entries, mid, entry_)) {
+          Corrupt();
+          return;
+        }
+        auto key = ObjectFromBytes<key_type>(entry_.key_);
+        if (run_->compare_(key, target) < 0) {
+          lo = mid + 1;
+        } else {
+          hi = mid;
+        }
+      }
+      SeekToBlock(block - blocks.begin(), lo);
+    }
+
+    void Next() {
+      if (++index_ == run_->blocks_[block_].count_) {
+        SeekToBlock(block_ + 1, 0);
+      } else if (!run_->DecodeEntry(run_->blocks_[block_], index_, entry_)) {
+        Corrupt();
+      }
+    }
+
+    auto key() const -> key_type {
+      return ObjectFromBytes<key_type>(entry_.key_);
+    }
+    auto value() const -> value_type {
+      return ObjectFromBytes<value_type>(entry_.value_);
+    }
+    auto deleted() const -> bool { return entry_.deleted_; }
+
+   private:
+    void SeekToBlock(size_t block, uint32_t index) {
+      block_ = block;
+      index_ = index;
+      if (block_ < run_->blocks_.size() &&
+          !run_->DecodeEntry(run_->blocks_[block_], index_, entry_)) {
+        Corrupt();
+      }
+    }
+
+    void Corrupt() {
+      block_ = run_->blocks_.size();
+      corrupted_ = true;
+    }
+
+    const SortedRunReader* run_;
+    size_t block_{0};
+    uint32_t index_{0};
+    Entry entry_{};
+    bool corrupted_{false};
+  };
+
+  // NOTE(shiwen): like MemTable::Lookup, Kdeleted if the run deleted key.
+  auto Lookup(const key_type& key, value_type& value) const -> LookupResult {
+    auto iter = Iterator(this);
+    iter.Seek(key);
+    if (iter.Corrupted()) {
+      return LookupResult::Kcorruption;
+    }
+    if (!iter.Valid() || compare_(iter.key(), key) != 0) {
+      return LookupResult::Knot_found;
+    }
+    if (iter.deleted()) {
+      return LookupResult::Kdeleted;
+    }
+    value = iter.value();
+    return LookupResult::Kfound;
+  }
+
+  auto Get(const key_type& key, value_type& value) const -> bool {
+    return Lookup(key, value) == LookupResult::Kfound;
+  }
+
+  // NOTE(shiwen): visit every live key in [begin, end) in key order. If
+  // callback returns bool, false stops the scan. False if the scan stopped at
+  // a corrupt entry.
+  template <typename F>
+  auto Scan(const key_type& begin, const key_type& end, F&& callback) const
+      -> bool {
+    auto iter = Iterator(this);
+    for (iter.Seek(begin); iter.Valid(); iter.Next()) {
+      auto key = iter.key();
+      if (compare_(key, end) >= 0) {
+        return true;
+      }
+      if (iter.deleted()) {
+        continue;
+      }
+      if constexpr (std::is_same_v<
+                        std::invoke_result_t<F&, const key_type&,
+                                             const value_type&>,
+                        bool>) {
+        if (!callback(key, iter.value())) {
+          return true;
+        }
+      } else {
+        callback(key, iter.value());
+      }
+    }
+    return !iter.Corrupted();
+  }
+
+  // NOTE(shiwen): check the crc32c of every data block.
+  auto VerifyChecksums() const -> bool {
+    for (const auto& block : blocks_) {
+      auto contents = block.offset_ + block.size_ - KsortedRunCrcSize;
+      if (!CrcMatches(data_ + block.offset_, contents - block.offset_)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  SortedRunReader(const char* data, size_t size,
+                  const comparator_type& compare)
+      : compare_(compare), data_(data), size_(size) {}
+
+  // NOTE(shiwen): bytes[0, n) followed by their masked crc32c.
+  static auto CrcMatches(const char* bytes, size_t n) -> bool {
+    return UnmaskCrc(DecodeFixed32(bytes + n)) == Crc32c(bytes, n);
+  }
+
+  auto LoadIndex() -> bool {
+    auto footer = data_ + size_ - KsortedRunFooterSize;
+    if (DecodeFixed64(footer + 24) != KsortedRunMagic) {
+      return false;
+    }
+    auto index_offset = DecodeFixed64(footer);
+    auto index_size = DecodeFixed64(footer + 8);
+    count_ = DecodeFixed64(footer + 16);
+    if (index_size < KsortedRunCrcSize ||
+        index_offset > size_ - KsortedRunFooterSize ||
+        index_size > size_ - KsortedRunFooterSize - index_offset ||
+        !CrcMatches(data_ + index_offset, index_size - KsortedRunCrcSize)) {
+      return false;
+    }
+    auto ptr = data_ + index_offset;
+    auto limit = ptr + index_size - KsortedRunCrcSize;
+    while (ptr < limit) {
+      uint32_t key_size;
+      ptr = DecodeVarint32(ptr, limit, &key_size);
+      if (ptr == nullptr || static_cast<size_t>(limit - ptr) < key_size + 12) {
+        return false;
+      }
+      if (!FitsObject<key_type>(key_size)) {
+        return false;
+      }
+      auto block = Block{};
+      block.last_key_ = std::string_view(ptr, key_size);
+      block.offset_ = DecodeFixed64(ptr + key_size);
+      block.size_ = DecodeFixed32(ptr + key_size + 8);
+      ptr += key_size + 12;
+      // NOTE(shiwen): a block holds at least one entry, its offset, the
+      // count and the crc.
+      if (block.size_ < 8 + KsortedRunCrcSize ||
+          block.offset_ > index_offset ||
+          block.size_ > index_offset - block.offset_) {
+        return false;
+      }
+      auto trailer = data_ + block.offset_ + block.size_ -
+                     KsortedRunCrcSize - 4;
+      block.count_ = DecodeFixed32(trailer);
+      if (block.count_ == 0 ||
+          block.count_ > (block.size_ - 8 - KsortedRunCrcSize) / 4) {
+        return false;
+      }
+      block.offsets_ = trailer - 4 * static_cast<size_t>(block.count_);
+      blocks_.push_back(block);
+    }
+    return true;
+  }
+
+  // NOTE(shiwen): false if the entry does not lie within the entries of its
+  // block or a fixed size key or value has the wrong size.
+  auto DecodeEntry(const Block& block, uint32_t index, Entry& entry) const
+      -> bool {
+    auto begin = data_ + block.offset_;
+    auto limit = block.offsets_;
+    auto offset = DecodeFixed32(block.offsets_ + 4 * index);
+    if (offset >= static_cast<size_t>(limit - begin)) {
+      return false;
+    }
+    auto ptr = begin + offset;
+    auto type = static_cast<SortedRunEntryType>(*ptr++);
+    if (type != SortedRunEntryType::Kvalue &&
+        type != SortedRunEntryType::Kdeletion) {
+      return false;
+    }
+    entry.deleted_ = type == SortedRunEntryType::Kdeletion;
+    uint32_t size;
+    ptr = DecodeVarint32(ptr, limit, &size);
+    if (ptr == nullptr || static_cast<size_t>(limit - ptr) < size ||
+        !FitsObject<key_type>(size)) {
+      return false;
+    }
+    entry.key_ = std::string_view(ptr, size);
+    ptr = DecodeVarint32(ptr + size, limit, &size);
+    if (ptr == nullptr || static_cast<size_t>(limit - ptr) < size ||
+        (!entry.deleted_ && !FitsObject<value_type>(size))) {
+      return false;
+    }
+    entry.value_ = std::string_view(ptr, size);
+    return true;
+  }
+
+  const comparator_type compare_;
+  const char* data_;
+  size_t size_;
+  uint64_t count_{0};
+  std::vector<Block> blocks_;
+};
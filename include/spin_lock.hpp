@@ -1,7 +1,50 @@
+#pragma once
+#include <algorithm>
 #include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <thread>
 
-#include "atomic"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+constexpr size_t KcacheLineSize = 64;
+
+// NOTE(shiwen): tell the core it is spinning, so it backs off the memory bus
+// and leaves its pipeline to the other hyperthread.
+inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  _mm_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield" ::: "memory");
+#else
+  std::this_thread::yield();
+#endif
+}
+
+// NOTE(shiwen): a waiter pauses Kspins times, then yields its core on every
+// call. A spin lock waiter that never yields can burn the time slice the
+// holder needs to finish when there are more threads than cores, fair locks
+// suffer most since only one waiter may take the lock next.
+class SpinWait {
+ public:
+  enum { Kspins = 1 << 8 };
+
+  void Pause() {
+    if (spins_ < Kspins) {
+      spins_++;
+      CpuRelax();
+    } else {
+      std::this_thread::yield();
+    }
+  }
+
+ private:
+  uint32_t spins_{0};
+};
 
 class NaiveSpinLock {
  public:
@@ -13,6 +56,11 @@ class NaiveSpinLock {
       std::this_thread::yield();
     }
   }
+  auto try_lock() -> bool {
+    auto expected = false;
+    return lock_.compare_exchange_strong(expected, true,
+                                         std::memory_order::acquire);
+  }
   void unlock() { lock_.store(false, std::memory_order::release); }
 
  private:
@@ -22,5 +70,346 @@ class NaiveSpinLock {
 class NoLock {
  public:
   void lock() {}
+  auto try_lock() -> bool { return true; }
   void unlock() {}
-};
\ No newline at end of file
+};
+
+// NOTE(shiwen): test and test-and-set. Waiters spin on a load of their own
+// cached copy of the line and only try the exchange once it reads free, so
+// a release does not start a storm of writes. After every failed attempt a
+// waiter pauses twice as long, up to Kmax_backoff pauses, then yields.
+class alignas(KcacheLineSize) BackoffSpinLock {
+ public:
+  enum { Kmax_backoff = 1 << 10 };
+
+  void lock() {
+    uint32_t backoff = 1;
+    while (true) {
+      if (!lock_.load(std::memory_order_relaxed) &&
+          !lock_.exchange(true, std::memory_order_acquire)) {
+        return;
+      }
+      if (backoff < Kmax_backoff) {
+        for (uint32_t i = 0; i < backoff; i++) {
+          CpuRelax();
+        }
+        backoff *= 2;
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  }
+  auto try_lock() -> bool {
+    return !lock_.load(std::memory_order_relaxed) &&
+           !lock_.exchange(true, std::memory_order_acquire);
+  }
+  void unlock() { lock_.store(false, std::memory_order_release); }
+
+ private:
+  std::atomic<bool> lock_{false};
+};
+
+// NOTE(shiwen): a FIFO spin lock, waiters are served in arrival order so
+// none starves. Each waiter pauses in proportion to how far back in line it
+// is. next_ and serving_ sit on separate lines, arrivals do not disturb the
+// waiters polling serving_.
+class alignas(KcacheLineSize) TicketLock {
+ public:
+  void lock() {
+    auto ticket = next_.fetch_add(1, std::memory_order_relaxed);
+    auto wait = SpinWait{};
+    while (true) {
+      auto serving = serving_.load(std::memory_order_acquire);
+      if (serving == ticket) {
+        return;
+      }
+      auto ahead = ticket - serving;
+      if (ahead > Kmax_spinning_waiters) {
+        std::this_thread::yield();
+        continue;
+      }
+      for (uint32_t i = 0; i < ahead; i++) {
+        wait.Pause();
+      }
+    }
+  }
+  auto try_lock() -> bool {
+    auto serving = serving_.load(std::memory_order_acquire);
+    auto ticket = serving;
+    return next_.compare_exchange_strong(ticket, serving + 1,
+                                         std::memory_order_acquire,
+                                         std::memory_order_relaxed);
+  }
+  void unlock() {
+    serving_.store(serving_.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_release);
+  }
+
+ private:
+  // NOTE(shiwen): waiters further back than this yield their core instead of
+  // spinning, e.g. when there are more threads than cores.
+  enum { Kmax_spinning_waiters = 8 };
+
+  std::atomic<uint32_t> next_{0};
+  alignas(KcacheLineSize) std::atomic<uint32_t> serving_{0};
+};
+
+// NOTE(shiwen): the Mellor-Crummey and Scott queue lock. Every waiter spins
+// on a flag in its own queue node, the one cache line a release writes
+// belongs to the next waiter only, so contention does not grow with the
+// number of waiters. Arrival order is kept.
+//
+// lock() takes no node, every thread owns Kmax_nesting of them and uses one
+// per MCS lock it holds. A thread releases its MCS locks in the reverse order
+// it took them, as scoped guards do.
+class alignas(KcacheLineSize) McsLock {
+ public:
+  enum { Kmax_nesting = 8 };
+
+  void lock() {
+    auto& slots = Slots();
+    assert(slots.depth_ < Kmax_nesting);
+    auto node = &slots.nodes_[slots.depth_++];
+    node->next_.store(nullptr, std::memory_order_relaxed);
+    node->locked_.store(true, std::memory_order_relaxed);
+    auto prev = tail_.exchange(node, std::memory_order_acq_rel);
+    if (prev != nullptr) {
+      prev->next_.store(node, std::memory_order_release);
+      auto wait = SpinWait{};
+      while (node->locked_.load(std::memory_order_acquire)) {
+        wait.Pause();
+      }
+    }
+    holder_ = node;
+  }
+  auto try_lock() -> bool {
+    auto& slots = Slots();
+    assert(slots.depth_ < Kmax_nesting);
+    auto node = &slots.nodes_[slots.depth_];
+    node->next_.store(nullptr, std::memory_order_relaxed);
+    Node* expected = nullptr;
+    if (!tail_.compare_exchange_strong(expected, node,
+                                       std::memory_order_acq_rel,
+                                       std::memory_order_relaxed)) {
+      return false;
+    }
+    slots.depth_++;
+    holder_ = node;
+    return true;
+  }
+  void unlock() {
+    auto node = holder_;
+    auto next = node->next_.load(std::memory_order_acquire);
+    if (next == nullptr) {
+      auto expected = node;
+      if (tail_.compare_exchange_strong(expected, nullptr,
+                                        std::memory_order_acq_rel,
+                                        std::memory_order_relaxed)) {
+        Slots().depth_--;
+        return;
+      }
+      // NOTE(shiwen): a waiter swapped itself in as the tail but has not
+      // linked itself behind node yet.
+      auto wait = SpinWait{};
+      while ((next = node->next_.load(std::memory_order_acquire)) == nullptr) {
+        wait.Pause();
+      }
+    }
+    next->locked_.store(false, std::memory_order_release);
+    Slots().depth_--;
+  }
+
+ private:
+  struct alignas(KcacheLineSize) Node {
+    std::atomic<Node*> next_{nullptr};
+    std::atomic<bool> locked_{false};
+  };
+
+  struct NodeSlots {
+    Node nodes_[Kmax_nesting];
+    int depth_{0};
+  };
+
+  static auto Slots() -> NodeSlots& {
+    thread_local NodeSlots slots;
+    return slots;
+  }
+
+  std::atomic<Node*> tail_{nullptr};
+  // NOTE(shiwen): the node of the thread holding the lock, only that thread
+  // reads or writes it.
+  Node* holder_{nullptr};
+};
+
+// NOTE(shiwen): a reader-writer spin lock, lock/unlock are exclusive and
+// lock_shared/unlock_shared shared, as std::shared_mutex. A writer first
+// sets Kwriter, which keeps new readers out, then waits for the readers
+// already in to leave, so a stream of readers cannot starve it.
+class alignas(KcacheLineSize) SharedSpinLock {
+ public:
+  void lock() {
+    uint32_t backoff = 1;
+    while ((state_.fetch_or(Kwriter, std::memory_order_acquire) & Kwriter) !=
+           0) {
+      Pause(backoff);
+    }
+    auto wait = SpinWait{};
+    while (state_.load(std::memory_order_acquire) != Kwriter) {
+      wait.Pause();
+    }
+  }
+  auto try_lock() -> bool {
+    uint32_t expected = 0;
+    return state_.compare_exchange_strong(expected, Kwriter,
+                                          std::memory_order_acquire,
+                                          std::memory_order_relaxed);
+  }
+  void unlock() { state_.store(0, std::memory_order_release); }
+
+  void lock_shared() {
+    uint32_t backoff = 1;
+    while (!try_lock_shared()) {
+      Pause(backoff);
+    }
+  }
+  auto try_lock_shared() -> bool {
+    auto state = state_.load(std::memory_order_relaxed);
+    return (state & Kwriter) == 0 &&
+           state_.compare_exchange_weak(state, state + 1,
+                                        std::memory_order_acquire,
+                                        std::memory_order_relaxed);
+  }
+  void unlock_shared() { state_.fetch_sub(1, std::memory_order_release); }
+
+ private:
+  enum : uint32_t { Kwriter = 1u << 31 };
+  enum { Kmax_backoff = 1 << 10 };
+
+  static void Pause(uint32_t& backoff) {
+    if (backoff < Kmax_backoff) {
+      for (uint32_t i = 0; i < backoff; i++) {
+        CpuRelax();
+      }
+      backoff *= 2;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+
+  // NOTE(shiwen): Kwriter plus the number of readers inside.
+  std::atomic<uint32_t> state_{0};
+};
+
+// NOTE(shiwen): what an InstrumentedLock saw. An acquisition is contended
+// when the lock was not free at once, only those are timed, in
+// wait_histogram_[i] when they waited [2^i, 2^(i+1)) nanoseconds.
+struct LockStats {
+  enum { Khistogram_buckets = 32 };
+
+  uint64_t acquisitions_{0};
+  uint64_t contended_{0};
+  uint64_t wait_nanos_{0};
+  uint64_t max_wait_nanos_{0};
+  uint64_t wait_histogram_[Khistogram_buckets]{};
+
+  auto ContendedRatio() const -> double {
+    return acquisitions_ == 0 ? 0.0
+                              : static_cast<double>(contended_) /
+                                    static_cast<double>(acquisitions_);
+  }
+
+  auto MeanWaitNanos() const -> double {
+    return contended_ == 0 ? 0.0
+                           : static_cast<double>(wait_nanos_) /
+                                 static_cast<double>(contended_);
+  }
+};
+
+// NOTE(shiwen): L that counts its acquisitions and times the contended ones,
+// e.g. MemTable<T, U, InstrumentedLock<McsLock>>. Locks with a try_lock try
+// it first and only read the clock when it fails, the others time every
+// acquisition and count it as contended past Kcontended_nanos. The counters
+// are only written by the holder, Stats can be read at any time.
+template <typename L>
+class InstrumentedLock {
+ public:
+  using lock_type = L;
+
+  enum { Kcontended_nanos = 1 << 10 };
+
+  void lock() {
+    if constexpr (requires { lock_.try_lock(); }) {
+      if (lock_.try_lock()) {
+        Bump(acquisitions_);
+        return;
+      }
+      auto start = std::chrono::steady_clock::now();
+      lock_.lock();
+      Record(start);
+    } else {
+      auto start = std::chrono::steady_clock::now();
+      lock_.lock();
+      Record(start);
+    }
+  }
+  auto try_lock() -> bool
+    requires requires(L lock) { lock.try_lock(); }
+  {
+    if (!lock_.try_lock()) {
+      return false;
+    }
+    Bump(acquisitions_);
+    return true;
+  }
+  void unlock() { lock_.unlock(); }
+
+  auto Stats() const -> LockStats {
+    LockStats stats;
+    stats.acquisitions_ = acquisitions_.load(std::memory_order_relaxed);
+    stats.contended_ = contended_.load(std::memory_order_relaxed);
+    stats.wait_nanos_ = wait_nanos_.load(std::memory_order_relaxed);
+    stats.max_wait_nanos_ = max_wait_nanos_.load(std::memory_order_relaxed);
+    for (int i = 0; i < LockStats::Khistogram_buckets; i++) {
+      stats.wait_histogram_[i] =
+          wait_histogram_[i].load(std::memory_order_relaxed);
+    }
+    return stats;
+  }
+
+ private:
+  static void Bump(std::atomic<uint64_t>& counter, uint64_t delta = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + delta,
+                  std::memory_order_relaxed);
+  }
+
+  void Record(std::chrono::steady_clock::time_point start) {
+    auto nanos = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count());
+    Bump(acquisitions_);
+    if constexpr (!requires { lock_.try_lock(); }) {
+      if (nanos < Kcontended_nanos) {
+        return;
+      }
+    }
+    Bump(contended_);
+    Bump(wait_nanos_, nanos);
+    if (nanos > max_wait_nanos_.load(std::memory_order_relaxed)) {
+      max_wait_nanos_.store(nanos, std::memory_order_relaxed);
+    }
+    auto bucket = 0;
+    while (bucket + 1 < LockStats::Khistogram_buckets &&
+           (nanos >> (bucket + 1)) != 0) {
+      bucket++;
+    }
+    Bump(wait_histogram_[bucket]);
+  }
+
+  L lock_;
+  std::atomic<uint64_t> acquisitions_{0};
+  std::atomic<uint64_t> contended_{0};
+  std::atomic<uint64_t> wait_nanos_{0};
+  std::atomic<uint64_t> max_wait_nanos_{0};
+  std::atomic<uint64_t> wait_histogram_[LockStats::Khistogram_buckets]{};
+};
@@ -0,0 +1,305 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "spin_lock.hpp"
+
+// NOTE(shiwen): the operations timed by a stats policy. Klock_wait is the
+// time a MemTable writer waits for state_lock_.
+enum class StatsOp : uint32_t { Kget, Kput, Kdelete, Klock_wait, Kcount };
+
+// NOTE(shiwen): an HDR style histogram of nanoseconds. Values below
+// Ksub_buckets get a bucket each, above that every power of two is cut into
+// Ksub_buckets buckets, so a percentile is off by at most 1/Ksub_buckets of
+// itself while the whole uint64_t range fits in Kbuckets counters.
+class LatencyHistogram {
+ public:
+  enum { Ksub_bucket_bits = 3 };
+  enum { Ksub_buckets = 1 << Ksub_bucket_bits };
+  enum { Kbuckets = (64 - Ksub_bucket_bits + 1) * Ksub_buckets };
+
+  static constexpr auto BucketOf(uint64_t value) -> size_t {
+    if (value < Ksub_buckets) {
+      return value;
+    }
+    auto exponent = static_cast<size_t>(std::bit_width(value)) - 1;
+    auto sub = (value >> (exponent - Ksub_bucket_bits)) & (Ksub_buckets - 1);
+    return (exponent - Ksub_bucket_bits + 1) * Ksub_buckets + sub;
+  }
+
+  // NOTE(shiwen): the smallest value that falls into bucket.
+  static constexpr auto BucketFloor(size_t bucket) -> uint64_t {
+    if (bucket < Ksub_buckets) {
+      return bucket;
+    }
+    auto exponent = bucket / Ksub_buckets + Ksub_bucket_bits - 1;
+    auto sub = static_cast<uint64_t>(bucket % Ksub_buckets);
+    return (Ksub_buckets + sub) << (exponent - Ksub_bucket_bits);
+  }
+
+  void Record(uint64_t value, uint64_t count = 1) {
+    counts_[BucketOf(value)] += count;
+    count_ += count;
+    sum_ += value * count;
+    max_ = std::max(max_, value);
+  }
+
+  void Merge(const LatencyHistogram& other) {
+    for (size_t i = 0; i < Kbuckets; i++) {
+      counts_[i] += other.counts_[i];
+    }
+    count_ += other.count_;
+    sum_ += other.sum_;
+    max_ = std::max(max_, other.max_);
+  }
+
+  auto Count() const -> uint64_t { return count_; }
+  auto Max() const -> uint64_t { return max_; }
+  auto Mean() const -> double {
+    return count_ == 0 ? 0 : static_cast<double>(sum_) / count_;
+  }
+
+  // NOTE(shiwen): the floor of the bucket holding the value at quantile q in
+  // [0, 1], never above Max().
+  auto Percentile(double q) const -> uint64_t {
+    if (count_ == 0) {
+      return 0;
+    }
+    auto rank = std::max<uint64_t>(
+        1, static_cast<uint64_t>(q * static_cast<double>(count_) + 0.5));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < Kbuckets; i++) {
+      seen += counts_[i];
+      if (seen >= rank) {
+        return std::min(BucketFloor(i), max_);
+      }
+    }
+    return max_;
+  }
+
+  auto BucketCount(size_t bucket) const -> uint64_t { return counts_[bucket]; }
+
+ private:
+  friend class ThreadStats;
+
+  std::array<uint64_t, Kbuckets> counts_{};
+  uint64_t count_{0};
+  uint64_t sum_{0};
+  uint64_t max_{0};
+};
+
+// NOTE(shiwen): what a stats policy collected, summed over every thread.
+struct StatsSnapshot {
+  enum { Kmax_levels = 64 };
+
+  // NOTE(shiwen): nodes a search moved to on each level.
+  std::array<uint64_t, Kmax_levels> hops_{};
+  // NOTE(shiwen): keys compared while moving along a level.
+  uint64_t comparisons_{0};
+  // NOTE(shiwen): nodes taken from the arena, erased nodes reused are not.
+  uint64_t allocations_{0};
+  uint64_t allocated_bytes_{0};
+  // NOTE(shiwen): puts of a key already there, which overwrote its value.
+  uint64_t duplicates_{0};
+  // NOTE(shiwen): linked nodes by top level, erased ones excluded.
+  std::array<uint64_t, Kmax_levels> heights_{};
+  std::array<LatencyHistogram, static_cast<size_t>(StatsOp::Kcount)>
+      latency_{};
+
+  auto Latency(StatsOp op) const -> const LatencyHistogram& {
+    return latency_[static_cast<size_t>(op)];
+  }
+
+  auto Hops() const -> uint64_t {
+    uint64_t hops = 0;
+    for (auto level_hops : hops_) {
+      hops += level_hops;
+    }
+    return hops;
+  }
+};
+
+// NOTE(shiwen): the default stats policy. Every hook is empty and the object
+// is empty, a [[no_unique_address]] member of this type compiles to nothing.
+class NoStats {
+ public:
+  static constexpr bool Kenabled = false;
+
+  void Hop(int32_t /*level*/) {}
+  void Compare() {}
+  void Allocate(size_t /*bytes*/) {}
+  void Duplicate() {}
+  void Height(int32_t /*level*/, int64_t /*delta*/) {}
+  auto Start() const -> uint64_t { return 0; }
+  void Finish(StatsOp /*op*/, uint64_t /*start*/) {}
+};
+
+// NOTE(shiwen): counts into a shard per thread, allocated on its first use.
+// A shard has one writer, so a counter is bumped by a plain load and store
+// instead of a locked add. Threads past Kmax_shards share shards and may lose
+// a few counts. Snapshot sums the shards while writers run, so the counters
+// of one snapshot need not be consistent with each other.
+class ThreadStats {
+ public:
+  static constexpr bool Kenabled = true;
+  enum { Kmax_shards = 64 };
+
+  ThreadStats() = default;
+  ThreadStats(const ThreadStats&) = delete;
+  ThreadStats& operator=(const ThreadStats&) = delete;
+  ~ThreadStats() {
+    for (auto& shard : shards_) {
+      delete shard.load(std::memory_order_relaxed);
+    }
+  }
+
+  void Hop(int32_t level) { Bump(Local().hops_[LevelIndex(level)]); }
+  void Compare() { Bump(Local().comparisons_); }
+  void Allocate(size_t bytes) {
+    auto& shard = Local();
+    Bump(shard.allocations_);
+    Bump(shard.allocated_bytes_, bytes);
+  }
+  void Duplicate() { Bump(Local().duplicates_); }
+  // NOTE(shiwen): per shard counts may wrap below zero when a node is erased
+  // by another thread than the one that linked it, their sum does not.
+  void Height(int32_t level, int64_t delta) {
+    Bump(Local().heights_[LevelIndex(level)], static_cast<uint64_t>(delta));
+  }
+
+  auto Start() const -> uint64_t {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+  }
+
+  void Finish(StatsOp op, uint64_t start) {
+    auto nanos = Start() - start;
+    auto& histogram = Local().latency_[static_cast<size_t>(op)];
+    Bump(histogram.counts_[LatencyHistogram::BucketOf(nanos)]);
+    Bump(histogram.sum_, nanos);
+    if (nanos > histogram.max_.load(std::memory_order_relaxed)) {
+      histogram.max_.store(nanos, std::memory_order_relaxed);
+    }
+  }
+
+  auto Snapshot() const -> StatsSnapshot {
+    auto snapshot = StatsSnapshot{};
+    for (const auto& slot : shards_) {
+      auto shard = slot.load(std::memory_order_acquire);
+      if (shard == nullptr) {
+        continue;
+      }
+      for (size_t i = 0; i < StatsSnapshot::Kmax_levels; i++) {
+        snapshot.hops_[i] += Read(shard->hops_[i]);
+        snapshot.heights_[i] += Read(shard->heights_[i]);
+      }
+      snapshot.comparisons_ += Read(shard->comparisons_);
+      snapshot.allocations_ += Read(shard->allocations_);
+      snapshot.allocated_bytes_ += Read(shard->allocated_bytes_);
+      snapshot.duplicates_ += Read(shard->duplicates_);
+      for (size_t op = 0; op < snapshot.latency_.size(); op++) {
+        const auto& histogram = shard->latency_[op];
+        auto& merged = snapshot.latency_[op];
+        for (size_t i = 0; i < LatencyHistogram::Kbuckets; i++) {
+          auto count = Read(histogram.counts_[i]);
+          merged.counts_[i] += count;
+          merged.count_ += count;
+        }
+        merged.sum_ += Read(histogram.sum_);
+        merged.max_ = std::max(merged.max_, Read(histogram.max_));
+      }
+    }
+    return snapshot;
+  }
+
+ private:
+  struct AtomicHistogram {
+    std::atomic<uint64_t> counts_[LatencyHistogram::Kbuckets]{};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> max_{0};
+  };
+
+  struct alignas(KcacheLineSize) Shard {
+    std::atomic<uint64_t> hops_[StatsSnapshot::Kmax_levels]{};
+    std::atomic<uint64_t> heights_[StatsSnapshot::Kmax_levels]{};
+    std::atomic<uint64_t> comparisons_{0};
+    std::atomic<uint64_t> allocations_{0};
+    std::atomic<uint64_t> allocated_bytes_{0};
+    std::atomic<uint64_t> duplicates_{0};
+    AtomicHistogram latency_[static_cast<size_t>(StatsOp::Kcount)];
+  };
+
+  static void Bump(std::atomic<uint64_t>& counter, uint64_t delta = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + delta,
+                  std::memory_order_relaxed);
+  }
+
+  static auto LevelIndex(int32_t level) -> size_t {
+    return std::min<size_t>(level, StatsSnapshot::Kmax_levels - 1);
+  }
+
+  static auto Read(const std::atomic<uint64_t>& counter) -> uint64_t {
+    return counter.load(std::memory_order_relaxed);
+  }
+
+  static auto ThreadIndex() -> size_t {
+    static std::atomic<size_t> next_index{0};
+    thread_local auto index =
+        next_index.fetch_add(1, std::memory_order_relaxed);
+    return index;
+  }
+
+  auto Local() -> Shard& {
+    auto& slot = shards_[ThreadIndex() % Kmax_shards];
+    auto shard = slot.load(std::memory_order_acquire);
+    if (shard != nullptr) {
+      return *shard;
+    }
+    auto fresh = new Shard();
+    if (slot.compare_exchange_strong(shard, fresh, std::memory_order_acq_rel,
+                                     std::memory_order_acquire)) {
+      return *fresh;
+    }
+    delete fresh;
+    return *shard;
+  }
+
+  std::atomic<Shard*> shards_[Kmax_shards]{};
+};
+
+// NOTE(shiwen): times one operation into stats from construction to
+// destruction. With NoStats it is empty and the clock is never read.
+template <typename S>
+class StatsTimer {
+ public:
+  StatsTimer(S& stats, StatsOp op)
+      : stats_(stats), op_(op), start_(stats.Start()) {}
+  StatsTimer(const StatsTimer&) = delete;
+  StatsTimer& operator=(const StatsTimer&) = delete;
+  ~StatsTimer() { stats_.Finish(op_, start_); }
+
+ private:
+  S& stats_;
+  StatsOp op_;
+  uint64_t start_;
+};
+
+// NOTE(shiwen): the stats policy of a skiplist type, NoStats for the ones
+// without.
+template <typename S>
+struct StatsPolicyOf {
+  using type = NoStats;
+};
+
+template <typename S>
+  requires requires { typename S::stats_policy; }
+struct StatsPolicyOf<S> {
+  using type = typename S::stats_policy;
+};
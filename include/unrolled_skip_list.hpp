@@ -0,0 +1,548 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <string_view>
+#include <type_traits>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "arena.hpp"
+#include "comparator.hpp"
+#include "height_policy.hpp"
+
+// NOTE(shiwen): index of the first of the count sorted keys that is >= key.
+// 32-bit keys under the default comparator are compared 8 (AVX2) or 4 (SSE2)
+// at a time, SSE/AVX only have signed compares, so unsigned keys get their
+// sign bit flipped first.
+template <typename T, typename C>
+inline auto BlockLowerBound(const T* keys, uint32_t count, const T& key,
+                            const C& compare) -> uint32_t {
+#if defined(__AVX2__) || defined(__SSE2__)
+  if constexpr (sizeof(T) == 4 && std::is_integral_v<T> &&
+                std::is_same_v<C, DefaultComparator<T>>) {
+    constexpr auto Kflip = std::is_signed_v<T> ? 0 : INT32_MIN;
+    uint32_t mask = 0;
+#if defined(__AVX2__)
+    auto flip = _mm256_set1_epi32(Kflip);
+    auto target = _mm256_xor_si256(_mm256_set1_epi32(key), flip);
+    for (uint32_t i = 0; i < count; i += 8) {
+      auto block = _mm256_xor_si256(
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i)),
+          flip);
+      auto less = _mm256_cmpgt_epi32(target, block);
+      mask |= static_cast<uint32_t>(
+                  _mm256_movemask_ps(_mm256_castsi256_ps(less)))
+              << i;
+    }
+#else
+    auto flip = _mm_set1_epi32(Kflip);
+    auto target = _mm_xor_si128(_mm_set1_epi32(key), flip);
+    for (uint32_t i = 0; i < count; i += 4) {
+      auto block = _mm_xor_si128(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i)), flip);
+      auto less = _mm_cmpgt_epi32(target, block);
+      mask |= static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(less)))
+              << i;
+    }
+#endif
+    // NOTE(shiwen): slots past count hold garbage, drop their bits.
+    mask &= count >= 32 ? ~0u : (1u << count) - 1;
+    return static_cast<uint32_t>(__builtin_popcount(mask));
+  }
+#endif
+  uint32_t index = 0;
+  while (index < count && compare(keys[index], key) < 0) {
+    index++;
+  }
+  return index;
+}
+
+// NOTE(shiwen): one node holds a sorted block of up to Kblock_size keys, a
+// cache line of them, and the tower is indexed by the smallest key. Readers
+// copy out of a block under a seqlock (version_ is odd while the writer
+// changes the block) and retry if it moved under them.
+template <typename T = uint32_t, typename U = uint32_t>
+struct UnrolledNode {
+  using key_type = T;
+  using value_type = U;
+  using UnrolledNodePtr = UnrolledNode*;
+
+  static_assert(std::is_trivially_copyable_v<T> &&
+                    std::is_trivially_copyable_v<U>,
+                "blocks are copied while readers run");
+
+  enum { Kblock_size = KcacheLineSize / sizeof(T) };
+
+  // NOTE(shiwen): the values are read through std::atomic_ref, which may need
+  // more than their natural alignment.
+  alignas(KcacheLineSize) T keys_[Kblock_size];
+  alignas(std::atomic_ref<U>::required_alignment) U values_[Kblock_size];
+  std::atomic<uint32_t> version_;
+  std::atomic<uint32_t> count_;
+  std::atomic<UnrolledNodePtr> next_lists_[];
+
+  auto static GetUnrolledNodeSize(int32_t max_node_level) {
+    // NOTE(shiwen): remember the size of struct which contains the flexible
+    // array.
+    return sizeof(UnrolledNode) +
+           (max_node_level + 1) * sizeof(std::atomic<UnrolledNodePtr>);
+  }
+
+  auto LoadNext(int32_t level) -> UnrolledNodePtr {
+    return next_lists_[level].load(std::memory_order_acquire);
+  }
+
+  auto StoreNext(int32_t level, UnrolledNodePtr node_ptr) {
+    next_lists_[level].store(node_ptr, std::memory_order::release);
+  }
+
+  // NOTE(shiwen): an insert at the front of the block moves keys_[0] with
+  // the other keys, so it is read under the version like them.
+  auto MinKey() const -> T {
+    while (true) {
+      auto version = BeginRead();
+      auto key = keys_[0];
+      if (ValidateRead(version)) {
+        return key;
+      }
+    }
+  }
+
+  auto BeginWrite() {
+    version_.store(version_.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+
+  auto EndWrite() {
+    version_.store(version_.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_release);
+  }
+
+  auto BeginRead() const -> uint32_t {
+    while (true) {
+      auto version = version_.load(std::memory_order_acquire);
+      if ((version & 1) == 0) {
+        return version;
+      }
+#if defined(__SSE2__)
+      _mm_pause();
+#endif
+    }
+  }
+
+  auto ValidateRead(uint32_t version) const -> bool {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return version_.load(std::memory_order_relaxed) == version;
+  }
+};
+
+// NOTE(shiwen): Multiple threads can read the skiplist at the same time, but
+// write operations must be mutually exclusive. Blocks split when they are
+// full. Nothing removes keys (deletes are tombstone values), so blocks never
+// drain below half full and there is nothing to merge. Keys are stored by
+// value, byte string keys need SkipList or NaiveSkipList.
+template <typename T = uint32_t, typename U = uint32_t, typename A = Arena,
+          typename C = DefaultComparator<T>, typename H = DefaultHeightPolicy>
+struct UnrolledSkipList {
+  using key_type = T;
+  using value_type = U;
+  using arena_type = A;
+  using comparator_type = C;
+  using UnrolledNodePtr = UnrolledNode<key_type, value_type>*;
+
+  static_assert(ArenaConcept<arena_type>);
+  static_assert(!std::is_same_v<key_type, std::string_view> &&
+                !std::is_same_v<value_type, std::string_view>);
+
+  using height_policy = H;
+
+  enum : int32_t { Kmax_level = height_policy::Kmax_level };
+  enum : uint32_t { Kp = height_policy::Kp };
+  enum { Kblock_size = UnrolledNode<key_type, value_type>::Kblock_size };
+  // NOTE(shiwen): declared before head_, the head node lives in the arena.
+  arena_type arena_;
+  UnrolledNodePtr head_;
+  std::atomic<int32_t> level_;  // the skiplist level (initially 0)
+  // NOTE(shiwen): the highest level a node may reach, see
+  // HeightPolicy::MaxLevelFor.
+  const int32_t max_level_;
+  const comparator_type compare_;
+  std::atomic<size_t> entry_count_{0};
+
+  // NOTE(shiwen): the block the last put went to. A put whose key still
+  // falls into that block's range skips the search.
+  struct Splice {
+    UnrolledNodePtr block_{nullptr};
+  };
+
+  // NOTE(shiwen): the cached splice of Put, writers are mutually exclusive.
+  Splice splice_;
+
+  // NOTE(shiwen): expected_entries, if known, caps the tower heights at the
+  // level its blocks need.
+  explicit UnrolledSkipList(const comparator_type& compare = comparator_type{},
+                            size_t expected_entries = 0);
+  UnrolledSkipList(UnrolledSkipList&& other) = delete;
+  ~UnrolledSkipList();
+
+  auto NewNode(int32_t level) -> UnrolledNodePtr;
+  auto GetRandomLevel() -> int32_t;
+  // NOTE(shiwen): the last block whose smallest key is <= key, head_ if none.
+  auto FindBlock(const key_type& key,
+                 UnrolledNodePtr* prevs = nullptr) const -> UnrolledNodePtr;
+  auto FindLast() const -> UnrolledNodePtr;
+  auto LinkBlock(UnrolledNodePtr block, int32_t level);
+  auto InsertIntoBlock(UnrolledNodePtr block, uint32_t index,
+                       const key_type& key, const value_type& value);
+  auto Put(const key_type& key, const value_type& value) -> bool;
+  auto Put(const key_type& key, const value_type& value, Splice& splice)
+      -> bool;
+  auto Get(const key_type& key, value_type& value) const -> bool;
+  // NOTE(shiwen): bytes taken from the arena, nodes and boxed values alike.
+  auto ApproximateMemoryUsage() const -> size_t {
+    return arena_.MemoryUsage();
+  }
+  // NOTE(shiwen): distinct keys inserted, puts that overwrite a value do not
+  // count.
+  auto Count() const -> size_t {
+    return entry_count_.load(std::memory_order_relaxed);
+  }
+
+  // NOTE(shiwen): copies one block at a time, so a concurrent split or shift
+  // never makes it skip or repeat a key.
+  class Iterator {
+   public:
+    explicit Iterator(const UnrolledSkipList* list) : list_(list) {}
+
+    auto Valid() const -> bool { return index_ < count_; }
+    auto key() const -> const key_type& {
+      assert(Valid());
+      return keys_[index_];
+    }
+    auto value() const -> value_type {
+      assert(Valid());
+      return values_[index_];
+    }
+    void Next();
+    // Advance to the first entry with a key >= target.
+    void Seek(const key_type& target);
+    void SeekToFirst();
+    void SeekToLast();
+
+   private:
+    // NOTE(shiwen): copy block and position at the first key >= target.
+    // Moves on to the following blocks when there is none.
+    void Load(UnrolledNodePtr block, const key_type* target);
+
+    const UnrolledSkipList* list_;
+    UnrolledNodePtr block_{nullptr};
+    uint32_t index_{0};
+    uint32_t count_{0};
+    key_type keys_[Kblock_size];
+    value_type values_[Kblock_size];
+  };
+};
+
+template <typename T, typename U, typename A, typename C, typename H>
+UnrolledSkipList<T, U, A, C, H>::UnrolledSkipList(
+    const comparator_type& compare, size_t expected_entries)
+    : max_level_(height_policy::MaxLevelFor(
+          expected_entries == 0
+              ? 0
+              : std::max<size_t>(1, expected_entries / Kblock_size))),
+      compare_(compare) {
+  head_ = NewNode(max_level_);
+  level_.store(0, std::memory_order_relaxed);
+}
+
+template <typename T, typename U, typename A, typename C, typename H>
+UnrolledSkipList<T, U, A, C, H>::~UnrolledSkipList() {
+  // NOTE(shiwen): all nodes live in arena_, which releases its blocks.
+}
+
+template <typename T, typename U, typename A, typename C, typename H>
+auto UnrolledSkipList<T, U, A, C, H>::NewNode(int32_t level)
+    -> UnrolledNodePtr {
+  auto new_node_size = UnrolledNode<T, U>::GetUnrolledNodeSize(level);
+  auto new_node = reinterpret_cast<UnrolledNodePtr>(
+      arena_.AllocateAligned(new_node_size, KcacheLineSize));
+  new (&new_node->version_) std::atomic<uint32_t>(0);
+  new (&new_node->count_) std::atomic<uint32_t>(0);
+  for (auto i = 0; i <= level; i++) {
+    new (&new_node->next_lists_[i]) std::atomic<UnrolledNodePtr>(nullptr);
+  }
+  return new_node;
+}
+
+template <typename T, typename U, typename A, typename C, typename H>
+auto UnrolledSkipList<T, U, A, C, H>::GetRandomLevel() -> int32_t {
+  return height_policy::RandomLevel(max_level_);
+}
+
+template <typename T, typename U, typename A, typename C, typename H>
+auto UnrolledSkipList<T, U, A, C, H>::FindBlock(const key_type& key,
+                                                UnrolledNodePtr* prevs) const
+    -> UnrolledNodePtr {
+  auto cur_node = head_;
+  for (auto cur_node_level = level_.load(std::memory_order_acquire);
+       cur_node_level >= 0; cur_node_level--) {
+    while (true) {
+      auto next = cur_node->LoadNext(cur_node_level);
+      if (next == nullptr || compare_(key, next->MinKey()) < 0) {
+        break;
+      }
+      cur_node = next;
+    }
+    if (prevs != nullptr) {
+      prevs[cur_node_level] = cur_node;
+    }
+  }
+  return cur_node;
+}
+
+template <typename T, typename U, typename A, typename C, typename H>
+auto UnrolledSkipList<T, U, A, C, H>::FindLast() const -> UnrolledNodePtr {
+  auto cur_node = head_;
+  for (auto cur_node_level = level_.load(std::memory_order_acquire);
+       cur_node_level >= 0; cur_node_level--) {
+    while (true) {
+      auto next = cur_node->LoadNext(cur_node_level);
+      if (next == nullptr) {
+        break;
+      }
+      cur_node = next;
+    }
+  }
+  return cur_node;
+}
+
+template <typename T, typename U, typename A, typename C, typename H>
+auto UnrolledSkipList<T, U, A, C, H>::Get(const key_type& key,
+                                          value_type& value) const -> bool {
+  auto block = FindBlock(key);
+  if (block == head_) {
+    return false;
+  }
+  while (true) {
+    auto version = block->BeginRead();
+    // NOTE(shiwen): a split may have moved key into a following block.
+    auto next = block->LoadNext(0);
+    if (next != nullptr && compare_(key, next->MinKey()) >= 0) {
+      block = next;
+      continue;
+    }
+    auto count = std::min<uint32_t>(
+        block->count_.load(std::memory_order_relaxed), Kblock_size);
+    auto index = BlockLowerBound(block->keys_, count, key, compare_);
+    auto found = index < count && compare_(block->keys_[index], key) == 0;
+    if (found) {
+      value = std::atomic_ref<value_type>(block->values_[index])
+                  .load(std::memory_order_relaxed);
+    }
+    if (block->ValidateRead(version)) {
+      return found;
+    }
+  }
+}
+
+template <typename T, typename U, typename A, typename C, typename H>
+auto UnrolledSkipList<T, U, A, C, H>::LinkBlock(UnrolledNodePtr block,
+                                                int32_t level) {
+  UnrolledNodePtr prevs[Kmax_level + 1];
+  auto old_level = level_.load(std::memory_order_relaxed);
+  FindBlock(block->MinKey(), prevs);
+  if (level > old_level) {
+    for (auto i = old_level + 1; i <= level; i++) {
+      prevs[i] = head_;
+    }
+    level_.store(level, std::memory_order_release);
+  }
+  // NOTE(shiwen): bottom-up, level 0 publishes the block.
+  for (auto i = 0; i <= level; i++) {
+    block->StoreNext(i, prevs[i]->LoadNext(i));
+    prevs[i]->StoreNext(i, block);
+  }
+}
+
+template <typename T, typename U, typename A, typename C, typename H>
+auto UnrolledSkipList<T, U, A, C, H>::InsertIntoBlock(UnrolledNodePtr block,
+                                                      uint32_t index,
+                                                      const key_type& key,
+                                                      const value_type& value) {
+  auto count = block->count_.load(std::memory_order_relaxed);
+  assert(count < Kblock_size && index <= count);
+  block->BeginWrite();
+  std::memmove(&block->keys_[index + 1], &block->keys_[index],
+               (count - index) * sizeof(key_type));
+  std::memmove(&block->values_[index + 1], &block->values_[index],
+               (count - index) * sizeof(value_type));
+  block->keys_[index] = key;
+  block->values_[index] = value;
+  block->count_.store(count + 1, std::memory_order_relaxed);
+  block->EndWrite();
+}
+
+// NOTE(shiwen): Additional synchronization mechanisms should be added at the
+// upper layer to ensure that only one thread can call the put method at a time.
+// Returns true if a new key was inserted, false if an existing key had its
+// value overwritten in place.
+template <typename T, typename U, typename A, typename C, typename H>
+auto UnrolledSkipList<T, U, A, C, H>::Put(const key_type& key,
+                                          const value_type& value) -> bool {
+  return Put(key, value, splice_);
+}
+
+template <typename T, typename U, typename A, typename C, typename H>
+auto UnrolledSkipList<T, U, A, C, H>::Put(const key_type& key,
+                                          const value_type& value,
+                                          Splice& splice) -> bool {
+  auto block = splice.block_;
+  if (block == nullptr || compare_(key, block->MinKey()) < 0 ||
+      (block->LoadNext(0) != nullptr &&
+       compare_(key, block->LoadNext(0)->MinKey()) >= 0)) {
+    block = FindBlock(key);
+  }
+  if (block == head_) {
+    block = head_->LoadNext(0);
+    if (block == nullptr) {
+      // NOTE(shiwen): the first block.
+      auto new_node_level = GetRandomLevel();
+      block = NewNode(new_node_level);
+      block->keys_[0] = key;
+      block->values_[0] = value;
+      block->count_.store(1, std::memory_order_relaxed);
+      LinkBlock(block, new_node_level);
+      splice.block_ = block;
+      entry_count_.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+    // NOTE(shiwen): key becomes the smallest key of the first block.
+  }
+  splice.block_ = block;
+
+  auto count = block->count_.load(std::memory_order_relaxed);
+  auto index = BlockLowerBound(block->keys_, count, key, compare_);
+  if (index < count && compare_(block->keys_[index], key) == 0) {
+    std::atomic_ref<value_type>(block->values_[index])
+        .store(value, std::memory_order_relaxed);
+    return false;
+  }
+  if (count < Kblock_size) {
+    InsertIntoBlock(block, index, key, value);
+    entry_count_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  auto new_node_level = GetRandomLevel();
+  auto new_block = NewNode(new_node_level);
+  if (index == count) {
+    // NOTE(shiwen): key is larger than the whole full block, start a new one
+    // instead of splitting. Appends fill blocks completely this way.
+    new_block->keys_[0] = key;
+    new_block->values_[0] = value;
+    new_block->count_.store(1, std::memory_order_relaxed);
+    LinkBlock(new_block, new_node_level);
+    splice.block_ = new_block;
+    entry_count_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // NOTE(shiwen): split, the upper half moves to new_block. It is published
+  // while block still holds every key, so for a moment the upper half is in
+  // both blocks with the same values. Readers of block then wait on its
+  // version while it drops the upper half.
+  constexpr uint32_t Khalf = Kblock_size / 2;
+  std::memcpy(new_block->keys_, &block->keys_[Khalf],
+              Khalf * sizeof(key_type));
+  std::memcpy(new_block->values_, &block->values_[Khalf],
+              Khalf * sizeof(value_type));
+  new_block->count_.store(Khalf, std::memory_order_relaxed);
+  LinkBlock(new_block, new_node_level);
+  block->BeginWrite();
+  block->count_.store(Khalf, std::memory_order_relaxed);
+  block->EndWrite();
+
+  if (index <= Khalf) {
+    InsertIntoBlock(block, index, key, value);
+  } else {
+    InsertIntoBlock(new_block, index - Khalf, key, value);
+    splice.block_ = new_block;
+  }
+  entry_count_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+template <typename T, typename U, typename A, typename C, typename H>
+void UnrolledSkipList<T, U, A, C, H>::Iterator::Load(UnrolledNodePtr block,
+                                                     const key_type* target) {
+  block_ = block == list_->head_ ? list_->head_->LoadNext(0) : block;
+  index_ = 0;
+  count_ = 0;
+  while (block_ != nullptr) {
+    while (true) {
+      auto version = block_->BeginRead();
+      count_ = std::min<uint32_t>(
+          block_->count_.load(std::memory_order_relaxed), Kblock_size);
+      std::memcpy(keys_, block_->keys_, count_ * sizeof(key_type));
+      std::memcpy(values_, block_->values_, count_ * sizeof(value_type));
+      if (block_->ValidateRead(version)) {
+        break;
+      }
+    }
+    index_ = target == nullptr
+                 ? 0
+                 : BlockLowerBound(keys_, count_, *target, list_->compare_);
+    if (index_ < count_) {
+      return;
+    }
+    block_ = block_->LoadNext(0);
+  }
+  count_ = 0;
+}
+
+template <typename T, typename U, typename A, typename C, typename H>
+void UnrolledSkipList<T, U, A, C, H>::Iterator::Next() {
+  assert(Valid());
+  if (++index_ < count_) {
+    return;
+  }
+  // NOTE(shiwen): the block may have split since it was copied, continue
+  // after the last key seen instead of at the old next block.
+  auto last_key = keys_[count_ - 1];
+  auto block = block_;
+  while (true) {
+    Load(block, &last_key);
+    if (!Valid() || list_->compare_(last_key, key()) < 0) {
+      return;
+    }
+    if (++index_ < count_) {
+      return;
+    }
+    block = block_->LoadNext(0);
+  }
+}
+
+template <typename T, typename U, typename A, typename C, typename H>
+void UnrolledSkipList<T, U, A, C, H>::Iterator::Seek(const key_type& target) {
+  Load(list_->FindBlock(target), &target);
+}
+
+template <typename T, typename U, typename A, typename C, typename H>
+void UnrolledSkipList<T, U, A, C, H>::Iterator::SeekToFirst() {
+  Load(list_->head_->LoadNext(0), nullptr);
+}
+
+template <typename T, typename U, typename A, typename C, typename H>
+void UnrolledSkipList<T, U, A, C, H>::Iterator::SeekToLast() {
+  Load(list_->FindLast(), nullptr);
+  if (Valid()) {
+    index_ = count_ - 1;
+  }
+}
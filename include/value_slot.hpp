@@ -0,0 +1,119 @@
+#pragma once
+#include <atomic>
+#include <limits>
+#include <new>
+#include <string_view>
+#include <type_traits>
+
+#include "coding.hpp"
+
+// NOTE(shiwen): the value part of a skiplist node. Put on an existing key
+// overwrites the value in place while readers may be loading it, so the slot
+// must publish a whole value atomically.
+template <typename U>
+constexpr auto IsInlineValue() -> bool {
+  if constexpr (std::is_same_v<U, std::string_view>) {
+    return false;
+  } else if constexpr (std::is_trivially_copyable_v<U>) {
+    return std::atomic_ref<U>::is_always_lock_free;
+  }
+  return false;
+}
+
+template <typename U, bool Kinline = IsInlineValue<U>()>
+struct ValueSlot;
+
+// NOTE(shiwen): small trivially copyable values are stored in the node and
+// read/written through std::atomic_ref.
+template <typename U>
+struct ValueSlot<U, true> {
+  alignas(std::atomic_ref<U>::required_alignment) U v_;
+
+  template <typename A>
+  auto Init(const U& value, A& /*arena*/) {
+    v_ = value;
+  }
+
+  auto Load() const -> U {
+    return std::atomic_ref<U>(const_cast<U&>(v_))
+        .load(std::memory_order_acquire);
+  }
+
+  template <typename A>
+  auto Store(const U& value, A& /*arena*/) {
+    std::atomic_ref<U>(v_).store(value, std::memory_order_release);
+  }
+};
+
+// NOTE(shiwen): everything else is boxed in the arena and the box pointer is
+// swapped. Old boxes are not reclaimed before the arena dies, a reader may
+// still be copying out of them.
+template <typename U>
+struct ValueSlot<U, false> {
+  std::atomic<const U*> v_;
+
+  template <typename A>
+  auto Init(const U& value, A& arena) {
+    new (&v_) std::atomic<const U*>(arena.template New<U>(value));
+  }
+
+  auto Load() const -> U { return *v_.load(std::memory_order_acquire); }
+
+  template <typename A>
+  auto Store(const U& value, A& arena) {
+    v_.store(arena.template New<U>(value), std::memory_order_release);
+  }
+};
+
+// NOTE(shiwen): byte string values are copied into the arena length-prefixed
+// and the slot swaps a pointer to them. A value whose data() is null, e.g.
+// std::string_view{}, is stored as a null pointer and loads back as one.
+template <>
+struct ValueSlot<std::string_view, false> {
+  std::atomic<const char*> v_;
+
+  template <typename A>
+  auto Init(std::string_view value, A& arena) {
+    new (&v_) std::atomic<const char*>(Encode(value, arena));
+  }
+
+  auto Load() const -> std::string_view {
+    auto data = v_.load(std::memory_order_acquire);
+    return data == nullptr ? std::string_view{} : DecodeLengthPrefixed(data);
+  }
+
+  template <typename A>
+  auto Store(std::string_view value, A& arena) {
+    v_.store(Encode(value, arena), std::memory_order_release);
+  }
+
+ private:
+  template <typename A>
+  static auto Encode(std::string_view value, A& arena) -> const char* {
+    return value.data() == nullptr ? nullptr
+                                   : EncodeLengthPrefixed(value, arena);
+  }
+};
+
+// NOTE(shiwen): the value MemTable stores for a deleted key. Arithmetic
+// values use their maximum; any other value type must specialize this.
+template <typename U>
+struct ValueTraits {
+  static_assert(std::numeric_limits<U>::is_specialized,
+                "specialize ValueTraits<U>");
+
+  static constexpr auto Tombstone() -> U {
+    return std::numeric_limits<U>::max();
+  }
+  static constexpr auto IsTombstone(const U& value) -> bool {
+    return value == Tombstone();
+  }
+};
+
+template <>
+struct ValueTraits<std::string_view> {
+  static constexpr auto Tombstone() -> std::string_view { return {}; }
+  static constexpr auto IsTombstone(std::string_view value) -> bool {
+    return value.data() == nullptr;
+  }
+};
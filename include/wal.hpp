@@ -0,0 +1,574 @@
+#pragma once
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "coding.hpp"
+#include "crc32c.hpp"
+
+// NOTE(shiwen): the write-ahead log uses the LevelDB log format. The file is a
+// sequence of Kwal_block_size blocks, a record is cut into fragments that
+// never cross a block, each behind a 7 byte header
+//   masked crc32c of type and payload (fixed32) | length (fixed16) | type
+// A block tail too short for a header is zero filled. Since every block
+// starts with a header, a reader can start at any block boundary.
+enum { Kwal_block_size = 32 << 10 };
+enum { Kwal_header_size = 4 + 2 + 1 };
+
+enum class WalRecordType : uint8_t {
+  Kzero = 0,  // preallocated or zero filled space
+  Kfull = 1,
+  Kfirst = 2,
+  Kmiddle = 3,
+  Klast = 4,
+};
+
+// NOTE(shiwen): Kalways syncs before a write returns, Kinterval syncs in the
+// background every sync_interval_, so a crash loses at most that much, Knone
+// leaves it to the OS.
+enum class WalSyncPolicy { Kalways, Kinterval, Knone };
+
+struct WalOptions {
+  WalSyncPolicy sync_policy_{WalSyncPolicy::Kalways};
+  std::chrono::milliseconds sync_interval_{100};
+};
+
+// NOTE(shiwen): appends records with group commit. A writer queues its
+// record, the writer at the head of the queue becomes the leader, appends the
+// records of everyone queued behind it with one write and syncs once, then
+// wakes them up. Followers only wait, so n concurrent writers cost one write
+// and one fdatasync instead of n. Once a write or sync fails every later
+// Append fails too.
+class Wal {
+ public:
+  enum { Kmax_group_bytes = 1 << 20 };
+
+  // NOTE(shiwen): appends to path, creating it if needed. nullptr on error.
+  static auto Open(const std::string& path,
+                   const WalOptions& options = WalOptions{})
+      -> std::unique_ptr<Wal> {
+    auto fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                   0644);
+    if (fd < 0) {
+      return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      return nullptr;
+    }
+    return std::unique_ptr<Wal>(new Wal(
+        fd, static_cast<size_t>(st.st_size) % Kwal_block_size, options));
+  }
+
+  Wal(const Wal&) = delete;
+  Wal& operator=(const Wal&) = delete;
+  ~Wal() {
+    if (syncer_.joinable()) {
+      {
+        std::lock_guard guard(mutex_);
+        stop_ = true;
+      }
+      syncer_cv_.notify_one();
+      syncer_.join();
+    }
+    if (options_.sync_policy_ != WalSyncPolicy::Knone) {
+      fdatasync(fd_);
+    }
+    close(fd_);
+  }
+
+  // NOTE(shiwen): true once record is in the log, and synced under
+  // Kalways.
+  auto Append(std::string_view record) -> bool {
+    auto writer = Writer{record};
+    std::unique_lock lock(mutex_);
+    writers_.push_back(&writer);
+    while (!writer.done_ && &writer != writers_.front()) {
+      writer.cv_.wait(lock);
+    }
+    if (writer.done_) {
+      return writer.ok_;
+    }
+
+    // NOTE(shiwen): the leader takes everyone queued so far.
+    auto last = writers_.begin();
+    size_t group_bytes = 0;
+    for (auto it = writers_.begin(); it != writers_.end(); ++it) {
+      if (it != writers_.begin() &&
+          group_bytes + (*it)->record_.size() > Kmax_group_bytes) {
+        break;
+      }
+      group_bytes += (*it)->record_.size();
+      last = it;
+    }
+    auto group = std::vector<Writer*>(writers_.begin(), last + 1);
+    auto ok = ok_;
+    lock.unlock();
+
+    if (ok) {
+      buffer_.clear();
+      for (auto member : group) {
+        EncodeRecord(member->record_);
+      }
+      ok = WriteAll(buffer_.data(), buffer_.size());
+      if (ok && options_.sync_policy_ == WalSyncPolicy::Kalways) {
+        ok = fdatasync(fd_) == 0;
+      }
+    }
+
+    lock.lock();
+    ok_ = ok_ && ok;
+    for (auto member : group) {
+      writers_.pop_front();
+      member->ok_ = ok;
+      member->done_ = true;
+      if (member != &writer) {
+        member->cv_.notify_one();
+      }
+    }
+    if (!writers_.empty()) {
+      writers_.front()->cv_.notify_one();
+    }
+    return ok;
+  }
+
+  // NOTE(shiwen): sync everything appended so far, whatever the policy.
+  auto Sync() -> bool {
+    auto ok = fdatasync(fd_) == 0;
+    std::lock_guard guard(mutex_);
+    ok_ = ok_ && ok;
+    return ok;
+  }
+
+ private:
+  struct Writer {
+    explicit Writer(std::string_view record) : record_(record) {}
+
+    std::string_view record_;
+    bool done_{false};
+    bool ok_{false};
+    std::condition_variable cv_;
+  };
+
+  Wal(int fd, size_t block_offset, const WalOptions& options)
+      : fd_(fd), block_offset_(block_offset), options_(options) {
+    if (options_.sync_policy_ == WalSyncPolicy::Kinterval) {
+      syncer_ = std::thread([this] { SyncLoop(); });
+    }
+  }
+
+  // NOTE(shiwen): fragment record into buffer_, only the leader calls this.
+  void EncodeRecord(std::string_view record) {
+    auto begin = true;
+    do {
+      auto left = Kwal_block_size - block_offset_;
+      if (left < Kwal_header_size) {
+        buffer_.append(left, '\0');
+        block_offset_ = 0;
+        left = Kwal_block_size;
+      }
+      auto fragment = std::min(record.size(), left - Kwal_header_size);
+      auto end = fragment == record.size();
+      auto type = begin && end ? WalRecordType::Kfull
+                  : begin      ? WalRecordType::Kfirst
+                  : end        ? WalRecordType::Klast
+                               : WalRecordType::Kmiddle;
+      EncodeFragment(type, record.substr(0, fragment));
+      record.remove_prefix(fragment);
+      begin = false;
+      if (end) {
+        break;
+      }
+    } while (true);
+  }
+
+  void EncodeFragment(WalRecordType type, std::string_view payload) {
+    char header[Kwal_header_size];
+    auto type_byte = static_cast<char>(type);
+    auto crc = Crc32cExtend(Crc32c(&type_byte, 1), payload.data(),
+                            payload.size());
+    EncodeFixed32(header, MaskCrc(crc));
+    header[4] = static_cast<char>(payload.size() & 0xFF);
+    header[5] = static_cast<char>(payload.size() >> 8);
+    header[6] = type_byte;
+    buffer_.append(header, Kwal_header_size);
+    buffer_.append(payload);
+    block_offset_ += Kwal_header_size + payload.size();
+  }
+
+  auto WriteAll(const char* data, size_t size) -> bool {
+    while (size > 0) {
+      auto written = write(fd_, data, size);
+      if (written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return false;
+      }
+      data += written;
+      size -= static_cast<size_t>(written);
+    }
+    return true;
+  }
+
+  void SyncLoop() {
+    std::unique_lock lock(mutex_);
+    while (!stop_) {
+      syncer_cv_.wait_for(lock, options_.sync_interval_);
+      lock.unlock();
+      auto ok = fdatasync(fd_) == 0;
+      lock.lock();
+      ok_ = ok_ && ok;
+    }
+  }
+
+  const int fd_;
+  // NOTE(shiwen): where the next fragment lands in its block, owned by the
+  // leader.
+  size_t block_offset_;
+  const WalOptions options_;
+  std::string buffer_;
+
+  std::mutex mutex_;
+  std::deque<Writer*> writers_;
+  bool ok_{true};
+  bool stop_{false};
+  std::condition_variable syncer_cv_;
+  std::thread syncer_;
+};
+
+// NOTE(shiwen): reads the records of a log held in memory, e.g. a mapped
+// file, from a block boundary on. A fragment with a bad checksum or length
+// drops the rest of its block and any record it was part of, a record cut off
+// by the end of the log, as a crash while appending leaves it, is ignored.
+// Started past the beginning, the tail of a record begun before offset is
+// skipped without counting it as dropped.
+class WalReader {
+ public:
+  explicit WalReader(std::string_view log, size_t offset = 0)
+      : log_(log), offset_(offset), resyncing_(offset > 0) {}
+
+  // NOTE(shiwen): record points into the log for unfragmented records and
+  // into scratch for the others.
+  auto ReadRecord(std::string_view* record, std::string* scratch) -> bool {
+    auto in_record = false;
+    scratch->clear();
+    std::string_view fragment;
+    while (true) {
+      auto type = ReadFragment(&fragment);
+      switch (type) {
+        case WalRecordType::Kfull:
+          if (in_record) {
+            dropped_ += scratch->size();
+          }
+          resyncing_ = false;
+          record_offset_ = fragment_offset_;
+          *record = fragment;
+          return true;
+        case WalRecordType::Kfirst:
+          if (in_record) {
+            dropped_ += scratch->size();
+          }
+          resyncing_ = false;
+          record_offset_ = fragment_offset_;
+          scratch->assign(fragment);
+          in_record = true;
+          break;
+        case WalRecordType::Kmiddle:
+          if (in_record) {
+            scratch->append(fragment);
+          } else if (!resyncing_) {
+            dropped_ += fragment.size();
+          }
+          break;
+        case WalRecordType::Klast:
+          if (in_record) {
+            scratch->append(fragment);
+            *record = *scratch;
+            return true;
+          }
+          if (!resyncing_) {
+            dropped_ += fragment.size();
+          }
+          resyncing_ = false;
+          break;
+        case WalRecordType::Kzero:
+          // NOTE(shiwen): the end of the log, or a corrupt fragment.
+          if (offset_ >= log_.size()) {
+            return false;
+          }
+          if (in_record) {
+            dropped_ += scratch->size();
+            scratch->clear();
+            in_record = false;
+          }
+          break;
+      }
+    }
+  }
+
+  // NOTE(shiwen): bytes skipped because of corruption.
+  auto Dropped() const -> size_t { return dropped_; }
+
+  // NOTE(shiwen): where the next fragment would be read.
+  auto Offset() const -> size_t { return offset_; }
+
+  // NOTE(shiwen): where the first fragment of the last record read starts.
+  auto RecordOffset() const -> size_t { return record_offset_; }
+
+ private:
+  // NOTE(shiwen): Kzero for the end of the log and for anything corrupt,
+  // which also skips the rest of its block.
+  auto ReadFragment(std::string_view* fragment) -> WalRecordType {
+    while (offset_ < log_.size()) {
+      auto left = Kwal_block_size - offset_ % Kwal_block_size;
+      if (left < Kwal_header_size) {
+        offset_ += left;
+        continue;
+      }
+      if (log_.size() - offset_ < Kwal_header_size) {
+        offset_ = log_.size();
+        return WalRecordType::Kzero;
+      }
+      auto header = log_.data() + offset_;
+      auto length = static_cast<size_t>(static_cast<uint8_t>(header[4])) |
+                    static_cast<size_t>(static_cast<uint8_t>(header[5]))
+                        << 8;
+      auto type = static_cast<WalRecordType>(header[6]);
+      if (type == WalRecordType::Kzero && length == 0) {
+        // NOTE(shiwen): zero filled, nothing more in this block.
+        offset_ += left;
+        continue;
+      }
+      if (Kwal_header_size + length > left ||
+          Kwal_header_size + length > log_.size() - offset_) {
+        // NOTE(shiwen): cut off at the end of the log, or a bad length.
+        dropped_ += std::min(left, log_.size() - offset_);
+        offset_ += left;
+        offset_ = std::min(offset_, log_.size());
+        return WalRecordType::Kzero;
+      }
+      auto payload = std::string_view(header + Kwal_header_size, length);
+      auto crc = Crc32cExtend(Crc32c(header + 6, 1), payload.data(),
+                              payload.size());
+      if (UnmaskCrc(DecodeFixed32(header)) != crc ||
+          type > WalRecordType::Klast) {
+        dropped_ += left;
+        offset_ += left;
+        return WalRecordType::Kzero;
+      }
+      fragment_offset_ = offset_;
+      offset_ += Kwal_header_size + length;
+      *fragment = payload;
+      return type;
+    }
+    return WalRecordType::Kzero;
+  }
+
+  std::string_view log_;
+  size_t offset_;
+  bool resyncing_;
+  size_t fragment_offset_{0};
+  size_t record_offset_{0};
+  size_t dropped_{0};
+};
+
+// NOTE(shiwen): a whole file mapped read only, e.g. a log to replay.
+class MappedFile {
+ public:
+  // NOTE(shiwen): nullptr if path cannot be opened or mapped. An empty file
+  // maps to an empty view.
+  static auto Open(const std::string& path) -> std::unique_ptr<MappedFile> {
+    auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      return nullptr;
+    }
+    auto size = static_cast<size_t>(st.st_size);
+    void* base = nullptr;
+    if (size > 0) {
+      base = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+      if (base == MAP_FAILED) {
+        close(fd);
+        return nullptr;
+      }
+      // NOTE(shiwen): replay reads the whole file front to back.
+      madvise(base, size, MADV_SEQUENTIAL | MADV_WILLNEED);
+    }
+    close(fd);
+    return std::unique_ptr<MappedFile>(
+        new MappedFile(static_cast<const char*>(base), size));
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  ~MappedFile() {
+    if (size_ > 0) {
+      munmap(const_cast<char*>(data_), size_);
+    }
+  }
+
+  auto Contents() const -> std::string_view {
+    return std::string_view(data_, size_);
+  }
+
+ private:
+  MappedFile(const char* data, size_t size) : data_(data), size_(size) {}
+
+  const char* data_;
+  size_t size_;
+};
+
+// NOTE(shiwen): what replaying a log found and how fast it went.
+struct WalRecoveryStats {
+  bool ok_{false};
+  uint64_t bytes_{0};
+  uint64_t records_{0};
+  uint64_t operations_{0};
+  // NOTE(shiwen): corrupt fragments and malformed records.
+  uint64_t dropped_bytes_{0};
+  uint64_t last_sequence_{0};
+  double seconds_{0};
+
+  auto MegabytesPerSecond() const -> double {
+    return seconds_ > 0 ? static_cast<double>(bytes_) / (1 << 20) / seconds_
+                        : 0;
+  }
+
+  auto OperationsPerSecond() const -> double {
+    return seconds_ > 0 ? static_cast<double>(operations_) / seconds_ : 0;
+  }
+};
+
+// NOTE(shiwen): read log with up to threads threads, each taking the records
+// whose first fragment lies in its share of the blocks. on_record(thread,
+// record) runs on the reading thread, records of one thread arrive in log
+// order. Returns the bytes dropped because of corruption.
+template <typename F>
+auto ParallelReadWal(std::string_view log, size_t threads, F&& on_record)
+    -> size_t {
+  auto blocks = (log.size() + Kwal_block_size - 1) / Kwal_block_size;
+  threads = std::max<size_t>(1, std::min(threads, blocks));
+  auto chunk = (blocks + threads - 1) / threads * Kwal_block_size;
+  std::vector<size_t> dropped(threads, 0);
+  auto read_chunk = [&](size_t thread) {
+    auto begin = thread * chunk;
+    auto end = std::min(log.size(), begin + chunk);
+    auto reader = WalReader(log, begin);
+    std::string_view record;
+    std::string scratch;
+    while (reader.Offset() < end && reader.ReadRecord(&record, &scratch)) {
+      if (reader.RecordOffset() >= end) {
+        break;
+      }
+      on_record(thread, record);
+    }
+    dropped[thread] = reader.Dropped();
+  };
+  std::vector<std::thread> workers;
+  for (size_t thread = 1; thread < threads; thread++) {
+    workers.emplace_back(read_chunk, thread);
+  }
+  read_chunk(0);
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  size_t total = 0;
+  for (auto bytes : dropped) {
+    total += bytes;
+  }
+  return total;
+}
+
+// NOTE(shiwen): the payload of a log record is one MemTable write
+//   first sequence (fixed64) | operation count (fixed32) | operations
+// and each operation
+//   type | varint32 key size | key | varint32 size | value or end key
+// with consecutive sequences from the first on. Keys and values are stored
+// as ObjectBytes.
+enum class WalOpType : uint8_t { Kput = 0, Kdelete = 1, Kdelete_range = 2 };
+
+inline void EncodeWalHeader(std::string& dst, uint64_t sequence,
+                            uint32_t count) {
+  char buf[12];
+  EncodeFixed64(buf, sequence);
+  EncodeFixed32(buf + 8, count);
+  dst.append(buf, sizeof(buf));
+}
+
+inline void EncodeWalOp(std::string& dst, WalOpType type,
+                        std::string_view key, std::string_view value) {
+  char buf[KmaxVarint32Length];
+  dst.push_back(static_cast<char>(type));
+  dst.append(buf, EncodeVarint32(buf, static_cast<uint32_t>(key.size())));
+  dst.append(key);
+  dst.append(buf, EncodeVarint32(buf, static_cast<uint32_t>(value.size())));
+  dst.append(value);
+}
+
+// NOTE(shiwen): callback(type, sequence, key, value) for every operation of
+// record, false if record is malformed. If callback returns bool, false
+// rejects the operation as malformed. Operations before the malformed one
+// were already handed to callback.
+template <typename F>
+auto DecodeWalRecord(std::string_view record, F&& callback) -> bool {
+  if (record.size() < 12) {
+    return false;
+  }
+  auto sequence = DecodeFixed64(record.data());
+  auto count = DecodeFixed32(record.data() + 8);
+  auto ptr = record.data() + 12;
+  auto limit = record.data() + record.size();
+  for (uint32_t i = 0; i < count; i++) {
+    if (ptr == limit) {
+      return false;
+    }
+    auto type = static_cast<WalOpType>(*ptr++);
+    uint32_t key_size;
+    ptr = DecodeVarint32(ptr, limit, &key_size);
+    if (ptr == nullptr || static_cast<size_t>(limit - ptr) < key_size) {
+      return false;
+    }
+    auto key = std::string_view(ptr, key_size);
+    uint32_t value_size;
+    ptr = DecodeVarint32(ptr + key_size, limit, &value_size);
+    if (ptr == nullptr || static_cast<size_t>(limit - ptr) < value_size ||
+        type > WalOpType::Kdelete_range) {
+      return false;
+    }
+    auto value = std::string_view(ptr, value_size);
+    ptr += value_size;
+    if constexpr (std::is_same_v<std::invoke_result_t<F&, WalOpType, uint64_t,
+                                                      std::string_view,
+                                                      std::string_view>,
+                                 bool>) {
+      if (!callback(type, sequence + i, key, value)) {
+        return false;
+      }
+    } else {
+      callback(type, sequence + i, key, value);
+    }
+  }
+  return true;
+}
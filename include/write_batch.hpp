@@ -0,0 +1,60 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "comparator.hpp"
+
+// NOTE(shiwen): a group of puts and deletes applied by MemTable::Write under
+// one lock acquisition. Later operations on the same key win. Byte string
+// keys and values are not copied, they must outlive the Write.
+template <typename T = uint32_t, typename U = uint32_t>
+class WriteBatch {
+ public:
+  using key_type = T;
+  using value_type = U;
+
+  struct Entry {
+    key_type key_;
+    value_type value_;
+    bool deletion_;
+  };
+
+  auto Put(const key_type& key, const value_type& value) {
+    entries_.push_back(Entry{key, value, false});
+  }
+
+  auto Delete(const key_type& key) {
+    entries_.push_back(Entry{key, value_type{}, true});
+  }
+
+  auto Clear() { entries_.clear(); }
+
+  auto Count() const -> size_t { return entries_.size(); }
+
+  auto Entries() const -> const std::vector<Entry>& { return entries_; }
+
+  // NOTE(shiwen): sort by key and keep only the last operation of each key,
+  // so the batch can be inserted left to right.
+  template <typename C = DefaultComparator<key_type>>
+  auto SortAndDedup(const C& compare = C{}) {
+    std::stable_sort(entries_.begin(), entries_.end(),
+                     [&compare](const Entry& lhs, const Entry& rhs) {
+                       return compare(lhs.key_, rhs.key_) < 0;
+                     });
+    auto out = entries_.begin();
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+      auto next = it + 1;
+      if (next != entries_.end() && compare(it->key_, next->key_) == 0) {
+        continue;
+      }
+      *out++ = std::move(*it);
+    }
+    entries_.erase(out, entries_.end());
+  }
+
+ private:
+  std::vector<Entry> entries_;
+};
@@ -1,11 +1,30 @@
 #include <sys/types.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <mutex>
 #include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
 
+#include "arena.hpp"
+#include "flat_combining.hpp"
 #include "gtest/gtest.h"
+#include "height_policy.hpp"
 #include "lock_free_skip_list.hpp"
+#include "persistent_skip_list.hpp"
+#include "rotating_memtable.hpp"
+#include "sharded_memtable.hpp"
 #include "simple_memtable.hpp"
+#include "simple_skip_list.hpp"
+#include "sorted_run.hpp"
+#include "spin_lock.hpp"
+#include "stats.hpp"
+#include "unrolled_skip_list.hpp"
+#include "wal.hpp"
 
 TEST(MemTableTest, BasicPutGet) {
   auto mt = MemTable<uint32_t, uint32_t, NaiveSpinLock,
@@ -40,6 +59,2057 @@ TEST(MemTableTest, DeleteExisting) {
   EXPECT_FALSE(mt.Get(1, value));
 }
 
+TEST(ArenaTest, AlignedAndLargeAllocations) {
+  auto arena = BasicArena<4096>{};
+  EXPECT_EQ(arena.MemoryUsage(), 0);
+
+  auto odd = arena.Allocate(3);
+  auto aligned = arena.AllocateAligned(24, 16);
+  EXPECT_NE(odd, nullptr);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(aligned) % 16, 0);
+  auto usage = arena.MemoryUsage();
+  EXPECT_GE(usage, 4096);
+
+  // NOTE(shiwen): big objects get their own block.
+  auto large = arena.Allocate(8192);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(large) % KcacheLineSize, 0);
+  EXPECT_GE(arena.MemoryUsage(), usage + 8192);
+  for (auto i = 0; i < 8192; i++) {
+    large[i] = static_cast<char>(i);
+  }
+}
+
+TEST(MemTableTest, HugePageArena) {
+  auto mt = MemTable<uint32_t, uint32_t, NaiveSpinLock,
+                     NaiveSkipList<uint32_t, uint32_t>, HugePageArena>{};
+  uint32_t value;
+
+  for (uint32_t i = 1; i <= 4096; i++) {
+    EXPECT_TRUE(mt.Put(i, i * 2));
+  }
+  for (uint32_t i = 1; i <= 4096; i++) {
+    EXPECT_TRUE(mt.Get(i, value));
+    EXPECT_EQ(value, i * 2);
+  }
+}
+
+TEST(SkipListTest, OverwriteInPlace) {
+  auto list = SkipList<uint32_t, uint32_t>{};
+  auto naive_list = NaiveSkipList<uint32_t, uint32_t>{};
+  uint32_t value;
+
+  for (uint32_t i = 0; i < 1024; i++) {
+    EXPECT_TRUE(list.Put(i, i));
+    EXPECT_TRUE(naive_list.Put(i, i));
+  }
+  auto usage = list.arena_.MemoryUsage();
+  auto naive_usage = naive_list.arena_.MemoryUsage();
+  for (uint32_t round = 1; round <= 64; round++) {
+    for (uint32_t i = 0; i < 1024; i++) {
+      EXPECT_FALSE(list.Put(i, i + round));
+      EXPECT_FALSE(naive_list.Put(i, i + round));
+    }
+  }
+  // NOTE(shiwen): overwrites must not allocate nodes.
+  EXPECT_EQ(list.arena_.MemoryUsage(), usage);
+  EXPECT_EQ(naive_list.arena_.MemoryUsage(), naive_usage);
+
+  for (uint32_t i = 0; i < 1024; i++) {
+    EXPECT_TRUE(list.Get(i, value));
+    EXPECT_EQ(value, i + 64);
+    EXPECT_TRUE(naive_list.Get(i, value));
+    EXPECT_EQ(value, i + 64);
+  }
+}
+
+TEST(SkipListTest, NonTriviallyCopyableValue) {
+  auto list = SkipList<uint32_t, std::string>{};
+  auto naive_list = NaiveSkipList<std::string, std::string>{};
+  std::string value;
+
+  EXPECT_TRUE(list.Put(1, "one"));
+  EXPECT_FALSE(list.Put(1, std::string(64, 'x')));
+  EXPECT_TRUE(list.Get(1, value));
+  EXPECT_EQ(value, std::string(64, 'x'));
+
+  EXPECT_TRUE(naive_list.Put("key", "one"));
+  EXPECT_FALSE(naive_list.Put("key", "two"));
+  EXPECT_FALSE(naive_list.Get("other", value));
+  EXPECT_TRUE(naive_list.Get("key", value));
+  EXPECT_EQ(value, "two");
+}
+
+TEST(SkipListTest, Iterator) {
+  auto list = SkipList<uint32_t, uint32_t>{};
+  auto naive_list = NaiveSkipList<uint32_t, uint32_t>{};
+  auto iter = SkipList<uint32_t, uint32_t>::Iterator(&list);
+  auto naive_iter = NaiveSkipList<uint32_t, uint32_t>::Iterator(&naive_list);
+
+  iter.SeekToFirst();
+  EXPECT_FALSE(iter.Valid());
+  naive_iter.SeekToLast();
+  EXPECT_FALSE(naive_iter.Valid());
+
+  for (uint32_t i = 1000; i > 0; i--) {
+    list.Put(i * 2, i);
+    naive_list.Put(i * 2, i);
+  }
+
+  iter.Seek(7);
+  naive_iter.Seek(7);
+  for (uint32_t i = 4; i <= 1000; i++) {
+    ASSERT_TRUE(iter.Valid());
+    ASSERT_TRUE(naive_iter.Valid());
+    EXPECT_EQ(iter.key(), i * 2);
+    EXPECT_EQ(iter.value(), i);
+    EXPECT_EQ(naive_iter.key(), i * 2);
+    iter.Next();
+    naive_iter.Next();
+  }
+  EXPECT_FALSE(iter.Valid());
+  EXPECT_FALSE(naive_iter.Valid());
+
+  iter.SeekToFirst();
+  EXPECT_EQ(iter.key(), 2);
+  iter.SeekToLast();
+  EXPECT_EQ(iter.key(), 2000);
+  iter.Seek(2001);
+  EXPECT_FALSE(iter.Valid());
+}
+
+TEST(MemTableTest, Scan) {
+  auto mt = MemTable<>{};
+  for (uint32_t i = 1; i <= 100; i++) {
+    mt.Put(i, i * 10);
+  }
+  for (uint32_t i = 1; i <= 100; i += 3) {
+    mt.Delete(i);
+  }
+
+  std::vector<uint32_t> keys;
+  mt.Scan(10, 20, [&keys](const uint32_t& key, const uint32_t& value) {
+    EXPECT_EQ(value, key * 10);
+    keys.push_back(key);
+  });
+  EXPECT_EQ(keys, (std::vector<uint32_t>{11, 12, 14, 15, 17, 18}));
+
+  keys.clear();
+  mt.Scan(0, 1000, [&keys](const uint32_t& key, const uint32_t&) {
+    keys.push_back(key);
+    return keys.size() < 5;
+  });
+  EXPECT_EQ(keys, (std::vector<uint32_t>{2, 3, 5, 6, 8}));
+}
+
+TEST(SkipListTest, PutWithSplice) {
+  auto list = SkipList<uint32_t, uint32_t>{};
+  auto naive_list = NaiveSkipList<uint32_t, uint32_t>{};
+  auto splice = SkipList<uint32_t, uint32_t>::Splice{};
+  auto naive_splice = NaiveSkipList<uint32_t, uint32_t>::Splice{};
+  uint32_t value;
+
+  for (uint32_t i = 0; i < 4096; i += 2) {
+    list.Put(i, i);
+    naive_list.Put(i, i);
+  }
+  // NOTE(shiwen): ascending keys, mixing inserts and updates.
+  for (uint32_t i = 1; i < 4096; i++) {
+    EXPECT_EQ(list.Put(i, i + 1, splice), i % 2 == 1);
+    EXPECT_EQ(naive_list.Put(i, i + 1, naive_splice), i % 2 == 1);
+  }
+  for (uint32_t i = 1; i < 4096; i++) {
+    EXPECT_TRUE(list.Get(i, value));
+    EXPECT_EQ(value, i + 1);
+    EXPECT_TRUE(naive_list.Get(i, value));
+    EXPECT_EQ(value, i + 1);
+  }
+  auto iter = SkipList<uint32_t, uint32_t>::Iterator(&list);
+  uint32_t expected = 0;
+  for (iter.SeekToFirst(); iter.Valid(); iter.Next()) {
+    EXPECT_EQ(iter.key(), expected++);
+  }
+  EXPECT_EQ(expected, 4096);
+}
+
+TEST(SkipListTest, CachedSplice) {
+  auto list = SkipList<uint32_t, uint32_t>{};
+  auto naive_list = NaiveSkipList<uint32_t, uint32_t>{};
+  auto other_list = SkipList<uint32_t, uint32_t>{};
+  uint32_t value;
+
+  // NOTE(shiwen): appends, clustered runs and jumps backwards, interleaved
+  // with a second list that shares this thread's splice cache.
+  auto keys = std::vector<uint32_t>{};
+  for (uint32_t i = 0; i < 2000; i++) {
+    keys.push_back(100000 + i);
+  }
+  for (uint32_t base = 50000; base > 0; base -= 5000) {
+    for (uint32_t i = 0; i < 100; i++) {
+      keys.push_back(base + i * 3);
+    }
+  }
+  std::mt19937 gen(42);
+  for (uint32_t i = 0; i < 2000; i++) {
+    keys.push_back(gen() % 200000);
+  }
+
+  for (auto key : keys) {
+    list.Put(key, key + 1);
+    naive_list.Put(key, key + 1);
+    other_list.Put(key + 1, key);
+  }
+  for (auto key : keys) {
+    EXPECT_TRUE(list.Get(key, value));
+    EXPECT_EQ(value, key + 1);
+    EXPECT_TRUE(naive_list.Get(key, value));
+    EXPECT_EQ(value, key + 1);
+    EXPECT_TRUE(other_list.Get(key + 1, value));
+    EXPECT_EQ(value, key);
+  }
+
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  auto iter = SkipList<uint32_t, uint32_t>::Iterator(&list);
+  auto naive_iter = NaiveSkipList<uint32_t, uint32_t>::Iterator(&naive_list);
+  iter.SeekToFirst();
+  naive_iter.SeekToFirst();
+  for (auto key : keys) {
+    ASSERT_TRUE(iter.Valid());
+    ASSERT_TRUE(naive_iter.Valid());
+    EXPECT_EQ(iter.key(), key);
+    EXPECT_EQ(naive_iter.key(), key);
+    iter.Next();
+    naive_iter.Next();
+  }
+  EXPECT_FALSE(iter.Valid());
+  EXPECT_FALSE(naive_iter.Valid());
+}
+
+TEST(MemTableTest, WriteBatch) {
+  auto mt = MemTable<uint32_t, uint32_t, NaiveSpinLock,
+                     NaiveSkipList<uint32_t, uint32_t>>{};
+  auto batch = WriteBatch<uint32_t, uint32_t>{};
+  uint32_t value;
+
+  mt.Put(7, 7);
+  for (uint32_t i = 100; i > 0; i--) {
+    batch.Put(i, i);
+  }
+  batch.Put(5, 500);
+  batch.Delete(7);
+  batch.Delete(8);
+  batch.Put(8, 800);
+  EXPECT_EQ(batch.Count(), 104);
+  EXPECT_TRUE(mt.Write(batch));
+  EXPECT_EQ(batch.Count(), 100);
+
+  EXPECT_TRUE(mt.Get(5, value));
+  EXPECT_EQ(value, 500);
+  EXPECT_FALSE(mt.Get(7, value));
+  EXPECT_TRUE(mt.Get(8, value));
+  EXPECT_EQ(value, 800);
+  EXPECT_TRUE(mt.Get(100, value));
+  EXPECT_EQ(value, 100);
+}
+
+TEST(MemTableTest, MultiGet) {
+  auto mt = MemTable<>{};
+  auto naive_mt = MemTable<uint32_t, uint32_t, NaiveSpinLock,
+                           NaiveSkipList<uint32_t, uint32_t>>{};
+  auto unrolled_mt = MemTable<uint32_t, uint32_t, NaiveSpinLock,
+                              UnrolledSkipList<uint32_t, uint32_t>>{};
+  for (uint32_t i = 0; i < 3000; i += 3) {
+    mt.Put(i, i + 1);
+    naive_mt.Put(i, i + 1);
+    unrolled_mt.Put(i, i + 1);
+  }
+  mt.Delete(300);
+  naive_mt.Delete(300);
+  unrolled_mt.Delete(300);
+
+  // NOTE(shiwen): more keys than lanes, with hits, misses, a tombstone,
+  // repeats and keys past the end.
+  std::vector<uint32_t> keys;
+  std::mt19937 gen(7);
+  for (uint32_t i = 0; i < 200; i++) {
+    keys.push_back(gen() % 3500);
+  }
+  keys.push_back(300);
+  keys.push_back(keys[0]);
+
+  for (int round = 0; round < 3; round++) {
+    std::vector<uint32_t> values(keys.size());
+    auto found = std::make_unique<bool[]>(keys.size());
+    auto found_span = std::span<bool>(found.get(), keys.size());
+    size_t hits = 0;
+    if (round == 0) {
+      hits = mt.MultiGet(keys, values, found_span);
+    } else if (round == 1) {
+      hits = naive_mt.MultiGet(keys, values, found_span);
+    } else {
+      hits = unrolled_mt.MultiGet(keys, values, found_span);
+    }
+
+    size_t expected_hits = 0;
+    for (size_t i = 0; i < keys.size(); i++) {
+      auto expected = keys[i] % 3 == 0 && keys[i] < 3000 && keys[i] != 300;
+      EXPECT_EQ(found[i], expected) << keys[i];
+      if (expected) {
+        EXPECT_EQ(values[i], keys[i] + 1);
+        expected_hits++;
+      }
+    }
+    EXPECT_EQ(hits, expected_hits);
+  }
+  EXPECT_EQ(mt.MultiGet({}, {}, {}), 0);
+}
+
+TEST(SkipListTest, UnrolledSkipList) {
+  auto list = UnrolledSkipList<uint32_t, uint32_t>{};
+  auto splice = UnrolledSkipList<uint32_t, uint32_t>::Splice{};
+  auto iter = UnrolledSkipList<uint32_t, uint32_t>::Iterator(&list);
+  uint32_t value;
+
+  iter.SeekToFirst();
+  EXPECT_FALSE(iter.Valid());
+  EXPECT_FALSE(list.Get(1, value));
+
+  // NOTE(shiwen): keys above 1 << 31 check the unsigned block compare.
+  auto keys = std::vector<uint32_t>{};
+  std::mt19937 gen(42);
+  for (uint32_t i = 0; i < 5000; i++) {
+    keys.push_back(gen());
+  }
+  for (uint32_t i = 0; i < 1000; i++) {
+    keys.push_back(i * 7);
+  }
+  for (auto key : keys) {
+    list.Put(key, key + 1);
+  }
+  for (auto key : keys) {
+    EXPECT_FALSE(list.Put(key, key + 2, splice));
+  }
+  for (auto key : keys) {
+    EXPECT_TRUE(list.Get(key, value));
+    EXPECT_EQ(value, key + 2);
+  }
+  EXPECT_FALSE(list.Get(1, value));
+
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  iter.SeekToFirst();
+  for (auto key : keys) {
+    ASSERT_TRUE(iter.Valid());
+    EXPECT_EQ(iter.key(), key);
+    EXPECT_EQ(iter.value(), key + 2);
+    iter.Next();
+  }
+  EXPECT_FALSE(iter.Valid());
+
+  iter.Seek(keys[100] + 1);
+  ASSERT_TRUE(iter.Valid());
+  EXPECT_EQ(iter.key(), keys[101]);
+  iter.SeekToLast();
+  EXPECT_EQ(iter.key(), keys.back());
+}
+
+TEST(MemTableTest, UnrolledSkipList) {
+  auto mt = MemTable<uint32_t, uint32_t, NaiveSpinLock,
+                     UnrolledSkipList<uint32_t, uint32_t>>{};
+  const uint32_t num_keys = 20000;
+  std::atomic<bool> done{false};
+  uint32_t value;
+
+  // NOTE(shiwen): one writer splits blocks while readers keep finding every
+  // key that was already inserted.
+  for (uint32_t i = 0; i < num_keys; i += 2) {
+    mt.Put(i, i);
+  }
+  auto reader = [&mt, &done]() {
+    uint32_t value;
+    while (!done.load()) {
+      for (uint32_t i = 0; i < num_keys; i += 2) {
+        ASSERT_TRUE(mt.Get(i, value));
+        ASSERT_EQ(value, i);
+      }
+    }
+  };
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 2; i++) {
+    readers.emplace_back(reader);
+  }
+  for (uint32_t i = num_keys - 1; i < num_keys; i -= 2) {
+    mt.Put(i, i);
+  }
+  done.store(true);
+  for (auto& thread : readers) {
+    thread.join();
+  }
+
+  for (uint32_t i = 0; i < num_keys; i++) {
+    EXPECT_TRUE(mt.Get(i, value));
+    EXPECT_EQ(value, i);
+  }
+  uint32_t expected = 0;
+  mt.Scan(0, num_keys, [&expected](const uint32_t& key, const uint32_t&) {
+    EXPECT_EQ(key, expected++);
+  });
+  EXPECT_EQ(expected, num_keys);
+}
+
+// NOTE(shiwen): orders byte strings backwards, without a Prefix.
+struct ReverseComparator {
+  auto operator()(std::string_view lhs, std::string_view rhs) const -> int {
+    return rhs.compare(lhs);
+  }
+};
+
+TEST(SkipListTest, ByteStringKeys) {
+  auto list = SkipList<std::string_view, std::string_view>{};
+  auto naive_list = NaiveSkipList<std::string_view, std::string_view, Arena,
+                                  ReverseComparator>{};
+  std::string_view value;
+
+  // NOTE(shiwen): keys sharing the 8 byte prefix, embedded zero bytes and the
+  // empty key. The buffer is reused, the lists must keep their own copies.
+  auto keys = std::vector<std::string>{"", "a", std::string("a\0", 2),
+                                       "user:0000", "user:0001", "user:00",
+                                       "zz"};
+  for (uint32_t i = 0; i < 300; i++) {
+    keys.push_back("composite/key/" + std::to_string(i * 7919 % 1000));
+  }
+  std::string buffer;
+  for (const auto& key : keys) {
+    buffer = key;
+    auto value_buffer = "v" + key;
+    list.Put(buffer, value_buffer);
+    naive_list.Put(buffer, value_buffer);
+    buffer.assign(buffer.size(), 'x');
+  }
+  EXPECT_FALSE(list.Put("zz", "new"));
+  EXPECT_FALSE(naive_list.Put("zz", "new"));
+
+  for (const auto& key : keys) {
+    auto expected = key == "zz" ? std::string("new") : "v" + key;
+    EXPECT_TRUE(list.Get(key, value));
+    EXPECT_EQ(value, expected);
+    EXPECT_TRUE(naive_list.Get(key, value));
+    EXPECT_EQ(value, expected);
+  }
+  EXPECT_FALSE(list.Get("user:000", value));
+  EXPECT_FALSE(list.Get(std::string("a\0\0", 3), value));
+
+  std::sort(keys.begin(), keys.end());
+  auto iter = SkipList<std::string_view, std::string_view>::Iterator(&list);
+  iter.SeekToFirst();
+  for (const auto& key : keys) {
+    ASSERT_TRUE(iter.Valid());
+    EXPECT_EQ(iter.key(), key);
+    iter.Next();
+  }
+  EXPECT_FALSE(iter.Valid());
+
+  auto naive_iter = decltype(naive_list)::Iterator(&naive_list);
+  naive_iter.SeekToFirst();
+  for (auto it = keys.rbegin(); it != keys.rend(); ++it) {
+    ASSERT_TRUE(naive_iter.Valid());
+    EXPECT_EQ(naive_iter.key(), *it);
+    naive_iter.Next();
+  }
+  EXPECT_FALSE(naive_iter.Valid());
+}
+
+TEST(MemTableTest, ByteStrings) {
+  auto mt = MemTable<std::string_view, std::string_view>{};
+  std::string_view value;
+
+  EXPECT_TRUE(mt.Put("apple", "red"));
+  EXPECT_TRUE(mt.Put("banana", ""));
+  EXPECT_TRUE(mt.Put("cherry", "dark red"));
+  EXPECT_TRUE(mt.Delete("cherry"));
+  EXPECT_TRUE(mt.Get("apple", value));
+  EXPECT_EQ(value, "red");
+  // NOTE(shiwen): an empty value is not a tombstone.
+  EXPECT_TRUE(mt.Get("banana", value));
+  EXPECT_EQ(value, "");
+  EXPECT_FALSE(mt.Get("cherry", value));
+
+  auto batch = WriteBatch<std::string_view, std::string_view>{};
+  batch.Put("date", "brown");
+  batch.Delete("apple");
+  batch.Put("cherry", "black");
+  EXPECT_TRUE(mt.Write(batch));
+
+  std::vector<std::string> seen;
+  mt.Scan("a", "d", [&seen](std::string_view key, std::string_view value) {
+    seen.push_back(std::string(key) + "=" + std::string(value));
+  });
+  EXPECT_EQ(seen, (std::vector<std::string>{"banana=", "cherry=black"}));
+}
+
+TEST(MemTableTest, Snapshot) {
+  auto mt = MemTable<>{};
+  uint32_t value;
+
+  mt.Put(1, 10);
+  mt.Put(2, 20);
+  auto first = mt.GetSnapshot();
+  mt.Put(1, 11);
+  mt.Delete(2);
+  mt.Put(3, 30);
+  auto second = mt.GetSnapshot();
+  mt.Put(2, 22);
+
+  EXPECT_TRUE(mt.Get(1, value, first));
+  EXPECT_EQ(value, 10);
+  EXPECT_TRUE(mt.Get(2, value, first));
+  EXPECT_EQ(value, 20);
+  EXPECT_FALSE(mt.Get(3, value, first));
+  EXPECT_TRUE(mt.Get(1, value, second));
+  EXPECT_EQ(value, 11);
+  EXPECT_FALSE(mt.Get(2, value, second));
+  EXPECT_TRUE(mt.Get(2, value));
+  EXPECT_EQ(value, 22);
+
+  auto seen = std::vector<std::pair<uint32_t, uint32_t>>{};
+  auto collect = [&seen](const uint32_t& key, const uint32_t& value) {
+    seen.emplace_back(key, value);
+  };
+  mt.Scan(0, 10, collect, first);
+  EXPECT_EQ(seen, (std::vector<std::pair<uint32_t, uint32_t>>{{1, 10},
+                                                              {2, 20}}));
+  seen.clear();
+  mt.Scan(0, 10, collect, second);
+  EXPECT_EQ(seen, (std::vector<std::pair<uint32_t, uint32_t>>{{1, 11},
+                                                              {3, 30}}));
+  seen.clear();
+  mt.Scan(0, 10, collect);
+  EXPECT_EQ(seen, (std::vector<std::pair<uint32_t, uint32_t>>{
+                      {1, 11}, {2, 22}, {3, 30}}));
+
+  uint32_t keys[] = {1, 2, 3, 4};
+  uint32_t values[4];
+  bool found[4];
+  EXPECT_EQ(mt.MultiGet(keys, values, found, first), 2);
+  EXPECT_EQ(values[0], 10);
+  EXPECT_EQ(values[1], 20);
+  EXPECT_FALSE(found[2]);
+}
+
+TEST(MemTableTest, ConcurrentSnapshots) {
+  auto mt = MemTable<uint32_t, uint32_t, NoLock>{};
+  const uint32_t rounds = 2000;
+  std::atomic<bool> done{false};
+
+  // NOTE(shiwen): every batch writes the same value to all four keys, a
+  // snapshot must never see two of them disagree.
+  auto writer = [&mt](uint32_t first_key) {
+    for (uint32_t round = 1; round <= rounds; round++) {
+      auto batch = WriteBatch<uint32_t, uint32_t>{};
+      for (uint32_t key = first_key; key < first_key + 4; key++) {
+        batch.Put(key, round);
+      }
+      mt.Write(batch);
+    }
+  };
+  auto reader = [&mt, &done]() {
+    uint32_t values[4];
+    bool found[4];
+    uint32_t keys[] = {0, 1, 2, 3};
+    while (!done.load()) {
+      auto snapshot = mt.GetSnapshot();
+      mt.MultiGet(keys, values, found, snapshot);
+      for (int i = 1; i < 4; i++) {
+        ASSERT_EQ(found[i], found[0]);
+        if (found[0]) {
+          ASSERT_EQ(values[i], values[0]);
+        }
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  threads.emplace_back(reader);
+  std::vector<std::thread> writers;
+  writers.emplace_back(writer, 0);
+  writers.emplace_back(writer, 100);
+  for (auto& thread : writers) {
+    thread.join();
+  }
+  done.store(true);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  uint32_t value;
+  EXPECT_TRUE(mt.Get(3, value));
+  EXPECT_EQ(value, rounds);
+  EXPECT_TRUE(mt.Get(103, value));
+  EXPECT_EQ(value, rounds);
+}
+
+TEST(MemTableTest, DeleteRange) {
+  auto mt = MemTable<>{};
+  uint32_t value;
+
+  for (uint32_t i = 0; i < 100; i++) {
+    mt.Put(i, i);
+  }
+  auto before = mt.GetSnapshot();
+  mt.DeleteRange(10, 20);
+  mt.DeleteRange(15, 30);
+  mt.DeleteRange(50, 50);
+  auto between = mt.GetSnapshot();
+  mt.Put(12, 1200);
+  mt.DeleteRange(60, 70);
+  mt.Put(65, 6500);
+
+  for (uint32_t i = 0; i < 100; i++) {
+    auto deleted = (i >= 10 && i < 30 && i != 12) ||
+                   (i >= 60 && i < 70 && i != 65);
+    EXPECT_EQ(mt.Get(i, value), !deleted) << i;
+    EXPECT_TRUE(mt.Get(i, value, before));
+    EXPECT_EQ(value, i);
+    EXPECT_EQ(mt.Get(i, value, between), i < 10 || i >= 30) << i;
+  }
+  EXPECT_TRUE(mt.Get(12, value));
+  EXPECT_EQ(value, 1200);
+
+  uint32_t count = 0;
+  mt.Scan(0, 100, [&count](const uint32_t& key, const uint32_t&) {
+    EXPECT_FALSE(key >= 13 && key < 30);
+    count++;
+  });
+  EXPECT_EQ(count, 72);
+
+  auto bytes_mt = MemTable<std::string_view, std::string_view>{};
+  std::string_view bytes_value;
+  bytes_mt.Put("tenant1/a", "1");
+  bytes_mt.Put("tenant1/b", "2");
+  bytes_mt.Put("tenant2/a", "3");
+  std::string begin = "tenant1/";
+  std::string end = "tenant10";
+  bytes_mt.DeleteRange(begin, end);
+  begin.assign(begin.size(), 'x');
+  end.assign(end.size(), 'x');
+  EXPECT_FALSE(bytes_mt.Get("tenant1/a", bytes_value));
+  EXPECT_FALSE(bytes_mt.Get("tenant1/b", bytes_value));
+  EXPECT_TRUE(bytes_mt.Get("tenant2/a", bytes_value));
+  EXPECT_EQ(bytes_value, "3");
+}
+
+TEST(SkipListTest, MemoryAccounting) {
+  auto list = SkipList<uint32_t, uint32_t>{};
+  auto naive_list = NaiveSkipList<uint32_t, uint32_t>{};
+  auto unrolled_list = UnrolledSkipList<uint32_t, uint32_t>{};
+  for (uint32_t i = 0; i < 1000; i++) {
+    list.Put(i, i);
+    list.Put(i, i + 1);
+    naive_list.Put(i, i);
+    naive_list.Put(i, i + 1);
+    unrolled_list.Put(999 - i, i);
+    unrolled_list.Put(999 - i, i + 1);
+  }
+  EXPECT_EQ(list.Count(), 1000);
+  EXPECT_EQ(naive_list.Count(), 1000);
+  EXPECT_EQ(unrolled_list.Count(), 1000);
+  EXPECT_GE(list.ApproximateMemoryUsage(), 1000 * 2 * sizeof(uint32_t));
+  EXPECT_GE(naive_list.ApproximateMemoryUsage(), 1000 * 2 * sizeof(uint32_t));
+  EXPECT_GE(unrolled_list.ApproximateMemoryUsage(),
+            1000 * 2 * sizeof(uint32_t));
+
+  auto mt = MemTable<>{};
+  mt.Put(1, 1);
+  mt.Put(1, 2);
+  mt.Delete(1);
+  EXPECT_EQ(mt.Count(), 3);
+  EXPECT_EQ(mt.LastSequence(), 3);
+}
+
+TEST(SkipListTest, BulkLoad) {
+  constexpr uint32_t scale = 1 << 16;
+  std::vector<std::pair<uint32_t, uint32_t>> input;
+  for (uint32_t i = 0; i < scale; i++) {
+    input.emplace_back((i * 7919) % scale, i);
+  }
+  // NOTE(shiwen): duplicates of every tenth key, the last pair wins.
+  for (uint32_t i = 0; i < scale; i += 10) {
+    input.emplace_back(i, i + scale);
+  }
+  auto expected = [](uint32_t key) {
+    return key % 10 == 0 ? key + scale : (key * 53263) % scale;
+  };
+  ASSERT_EQ((53263ull * 7919) % scale, 1);
+
+  for (auto heights : {TowerHeights::Krandom, TowerHeights::Kbalanced}) {
+    BulkLoadOptions options;
+    options.heights_ = heights;
+    options.sort_threads_ = 4;
+    auto list = SkipList<uint32_t, uint32_t>(input.begin(), input.end(),
+                                              options);
+    auto naive_list = NaiveSkipList<uint32_t, uint32_t>(
+        input.begin(), input.end(), options);
+    EXPECT_EQ(list.Count(), scale);
+    EXPECT_EQ(naive_list.Count(), scale);
+
+    auto iter = SkipList<uint32_t, uint32_t>::Iterator(&list);
+    iter.SeekToFirst();
+    for (uint32_t i = 0; i < scale; i++) {
+      ASSERT_TRUE(iter.Valid());
+      EXPECT_EQ(iter.key(), i);
+      EXPECT_EQ(iter.value(), expected(i));
+      iter.Next();
+    }
+    EXPECT_FALSE(iter.Valid());
+
+    uint32_t value;
+    for (uint32_t i = 0; i < scale; i += 3) {
+      ASSERT_TRUE(list.Get(i, value));
+      EXPECT_EQ(value, expected(i));
+      ASSERT_TRUE(naive_list.Get(i, value));
+      EXPECT_EQ(value, expected(i));
+    }
+    EXPECT_FALSE(list.Get(scale, value));
+
+    // NOTE(shiwen): a bulk loaded list takes Puts like any other.
+    EXPECT_TRUE(list.Put(scale, 1));
+    EXPECT_TRUE(naive_list.Put(scale, 1));
+    EXPECT_FALSE(list.Put(5, 1));
+    EXPECT_TRUE(list.Get(5, value));
+    EXPECT_EQ(value, 1);
+    EXPECT_TRUE(naive_list.Get(scale, value));
+  }
+
+  auto sorted = std::vector<std::pair<uint32_t, uint32_t>>{{1, 1}, {3, 3}};
+  auto list = SkipList<uint32_t, uint32_t>{};
+  BulkLoadOptions options;
+  options.sorted_ = true;
+  EXPECT_EQ(list.BulkLoad(sorted.begin(), sorted.end(), options), 2);
+  EXPECT_TRUE(list.Put(2, 2));
+  EXPECT_EQ(list.Count(), 3);
+}
+
+TEST(SkipListTest, HeightPolicy) {
+  // NOTE(shiwen): a tower reaches level l with probability p^-l.
+  auto check_distribution = []<typename H>(H /*policy*/) {
+    constexpr int draws = 1 << 20;
+    int reached[3] = {0, 0, 0};
+    for (auto i = 0; i < draws; i++) {
+      auto level = H::RandomLevel(H::Kmax_level);
+      ASSERT_LE(level, H::Kmax_level);
+      for (auto l = 0; l < 3 && l <= level; l++) {
+        reached[l]++;
+      }
+    }
+    EXPECT_EQ(reached[0], draws);
+    EXPECT_NEAR(reached[1], draws / H::Kp, draws / H::Kp / 20);
+    EXPECT_NEAR(reached[2], draws / H::Kp / H::Kp,
+                draws / H::Kp / H::Kp / 10);
+  };
+  check_distribution(DefaultHeightPolicy{});
+  check_distribution(HeightPolicy<31, 2, XorShift64>{});
+  check_distribution(HeightPolicy<7, 8, WyRand>{});
+
+  EXPECT_EQ(DefaultHeightPolicy::MaxLevelFor(0), 15);
+  EXPECT_EQ(DefaultHeightPolicy::MaxLevelFor(1), 0);
+  EXPECT_EQ(DefaultHeightPolicy::MaxLevelFor(15), 1);
+  EXPECT_EQ(DefaultHeightPolicy::MaxLevelFor(16), 2);
+  EXPECT_EQ(DefaultHeightPolicy::MaxLevelFor(size_t{1} << 40), 15);
+  EXPECT_EQ((HeightPolicy<31>::MaxLevelFor(size_t{1} << 40)), 20);
+
+  // NOTE(shiwen): a small table never grows towers it does not need.
+  constexpr uint32_t scale = 1 << 10;
+  auto small = SkipList<uint32_t, uint32_t>({}, scale);
+  auto naive_small = NaiveSkipList<uint32_t, uint32_t>({}, scale);
+  auto unrolled_small = UnrolledSkipList<uint32_t, uint32_t>({}, scale);
+  // NOTE(shiwen): and a big one may grow past 16 levels.
+  using TallPolicy = HeightPolicy<31, 2, XorShift64>;
+  auto tall = SkipList<uint32_t, uint32_t, ConcurrentArena,
+                       DefaultComparator<uint32_t>, TallPolicy>{};
+  for (uint32_t i = 0; i < scale; i++) {
+    auto key = (i * 7919) % scale;
+    EXPECT_TRUE(small.Put(key, i));
+    EXPECT_TRUE(naive_small.Put(key, i));
+    EXPECT_TRUE(unrolled_small.Put(key, i));
+    EXPECT_TRUE(tall.Put(key, i));
+  }
+  EXPECT_LE(small.level_.load(), 5);
+  EXPECT_LE(naive_small.level_.load(), 5);
+  EXPECT_LE(unrolled_small.level_.load(),
+            DefaultHeightPolicy::MaxLevelFor(
+                scale / UnrolledSkipList<uint32_t, uint32_t>::Kblock_size));
+  uint32_t value;
+  for (uint32_t i = 0; i < scale; i++) {
+    auto key = (i * 7919) % scale;
+    ASSERT_TRUE(small.Get(key, value));
+    EXPECT_EQ(value, i);
+    ASSERT_TRUE(naive_small.Get(key, value));
+    EXPECT_EQ(value, i);
+    ASSERT_TRUE(unrolled_small.Get(key, value));
+    EXPECT_EQ(value, i);
+    ASSERT_TRUE(tall.Get(key, value));
+    EXPECT_EQ(value, i);
+  }
+  EXPECT_TRUE(tall.Erase(5));
+  EXPECT_FALSE(tall.Get(5, value));
+
+  // NOTE(shiwen): a bulk load caps its towers only when asked to, at least
+  // at the size of its input.
+  std::vector<std::pair<uint32_t, uint32_t>> input;
+  for (uint32_t i = 0; i < 64; i++) {
+    input.emplace_back(i, i);
+  }
+  BulkLoadOptions options;
+  options.expected_entries_ = 16;
+  auto capped = SkipList<uint32_t, uint32_t>(input.begin(), input.end(),
+                                             options);
+  EXPECT_EQ(capped.max_level_, 3);
+  EXPECT_LE(capped.level_.load(), 3);
+
+  // NOTE(shiwen): otherwise a list loaded small still grows towers as it is
+  // put far past its input.
+  input.resize(2);
+  auto loaded = SkipList<uint32_t, uint32_t>(input.begin(), input.end());
+  auto naive_loaded =
+      NaiveSkipList<uint32_t, uint32_t>(input.begin(), input.end());
+  EXPECT_EQ(loaded.max_level_, DefaultHeightPolicy::Kmax_level);
+  EXPECT_EQ(naive_loaded.max_level_, DefaultHeightPolicy::Kmax_level);
+  for (uint32_t i = 2; i < scale * 16; i++) {
+    EXPECT_TRUE(loaded.Put(i, i));
+    EXPECT_TRUE(naive_loaded.Put(i, i));
+  }
+  EXPECT_GE(loaded.level_.load(), 2);
+  EXPECT_GE(naive_loaded.level_.load(), 2);
+  for (uint32_t i = 0; i < scale * 16; i++) {
+    ASSERT_TRUE(loaded.Get(i, value));
+    EXPECT_EQ(value, i);
+  }
+}
+
+TEST(SkipListTest, Erase) {
+  auto list = SkipList<uint32_t, uint32_t>{};
+  for (uint32_t i = 0; i < 100; i++) {
+    EXPECT_TRUE(list.Put(i, i));
+  }
+  uint32_t value;
+  EXPECT_FALSE(list.Erase(100));
+  for (uint32_t i = 0; i < 100; i += 2) {
+    EXPECT_TRUE(list.Erase(i));
+    EXPECT_FALSE(list.Erase(i));
+    EXPECT_FALSE(list.Get(i, value));
+  }
+  EXPECT_EQ(list.Count(), 50);
+  {
+    // NOTE(shiwen): a live iterator pins the epoch, nothing erased meanwhile
+    // is reused.
+    auto iter = SkipList<uint32_t, uint32_t>::Iterator(&list);
+    iter.Seek(10);
+    for (uint32_t i = 11; i < 100; i += 2) {
+      ASSERT_TRUE(iter.Valid());
+      EXPECT_EQ(iter.key(), i);
+      iter.Next();
+    }
+    EXPECT_FALSE(iter.Valid());
+    EXPECT_TRUE(list.Erase(99));
+    iter.SeekToLast();
+    ASSERT_TRUE(iter.Valid());
+    EXPECT_EQ(iter.key(), 97);
+  }
+  // NOTE(shiwen): an erased key can be put again.
+  EXPECT_TRUE(list.Put(10, 20));
+  EXPECT_TRUE(list.Get(10, value));
+  EXPECT_EQ(value, 20);
+  EXPECT_EQ(list.Count(), 50);
+
+  // NOTE(shiwen): churn reuses the erased nodes, the footprint stops growing.
+  constexpr uint32_t churn = 1 << 12;
+  auto churned = SkipList<uint32_t, uint32_t>{};
+  size_t settled = 0;
+  for (auto round = 0; round < 32; round++) {
+    for (uint32_t i = 0; i < churn; i++) {
+      EXPECT_TRUE(churned.Put(i * 7 + round, i));
+    }
+    for (uint32_t i = 0; i < churn; i++) {
+      EXPECT_TRUE(churned.Erase(i * 7 + round));
+    }
+    churned.Reclaim();
+    if (round == 4) {
+      settled = churned.ApproximateMemoryUsage();
+    }
+  }
+  EXPECT_EQ(churned.Count(), 0);
+  EXPECT_EQ(churned.ApproximateMemoryUsage(), settled);
+
+  // NOTE(shiwen): writers put and erase their own keys while readers run,
+  // a reader only ever sees a key with its own value.
+  constexpr uint32_t scale = 1 << 12;
+  constexpr int num_writers = 2;
+  constexpr int num_readers = 4;
+  constexpr int rounds = 8;
+  auto shared = SkipList<uint32_t, uint32_t>{};
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> readers;
+  for (auto r = 0; r < num_readers; r++) {
+    readers.emplace_back([&shared, &stop, r] {
+      auto rnd = std::mt19937(r);
+      while (!stop.load(std::memory_order_relaxed)) {
+        uint32_t key = rnd() % scale;
+        uint32_t value;
+        if (shared.Get(key, value)) {
+          EXPECT_EQ(value, key * 3);
+        }
+        auto iter = SkipList<uint32_t, uint32_t>::Iterator(&shared);
+        iter.Seek(key);
+        uint32_t last = key;
+        for (auto i = 0; i < 16 && iter.Valid(); i++, iter.Next()) {
+          EXPECT_GE(iter.key(), last);
+          EXPECT_EQ(iter.value(), iter.key() * 3);
+          last = iter.key() + 1;
+        }
+      }
+    });
+  }
+  std::vector<std::thread> writers;
+  for (auto w = 0; w < num_writers; w++) {
+    writers.emplace_back([&shared, w] {
+      for (auto round = 0; round < rounds; round++) {
+        for (uint32_t key = w; key < scale; key += num_writers) {
+          EXPECT_TRUE(shared.Put(key, key * 3));
+        }
+        for (uint32_t key = w; key < scale; key += num_writers) {
+          if (round + 1 < rounds || key % 4 < 2) {
+            EXPECT_TRUE(shared.Erase(key));
+          }
+        }
+      }
+    });
+  }
+  for (auto& writer : writers) {
+    writer.join();
+  }
+  stop.store(true);
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  EXPECT_EQ(shared.Count(), scale / 2);
+  for (uint32_t key = 0; key < scale; key++) {
+    EXPECT_EQ(shared.Get(key, value), key % 4 >= 2);
+  }
+}
+
+TEST(SkipListTest, ConcurrentEraseAndPutSameKey) {
+  // NOTE(shiwen): every thread puts and erases the same few keys, so puts with
+  // stale splices meet erasures of the key they put while erased nodes are
+  // reclaimed and reused.
+  constexpr uint32_t keys = 8;
+  constexpr int thread_count = 4;
+  constexpr int rounds = 1 << 14;
+  auto list = SkipList<uint32_t, uint32_t>{};
+  std::atomic<bool> stop{false};
+  std::thread reader([&list, &stop] {
+    while (!stop.load(std::memory_order_relaxed)) {
+      auto iter = SkipList<uint32_t, uint32_t>::Iterator(&list);
+      uint32_t next = 0;
+      for (iter.SeekToFirst(); iter.Valid(); iter.Next()) {
+        ASSERT_GE(iter.key(), next);
+        ASSERT_EQ(iter.value(), iter.key() * 3);
+        next = iter.key() + 1;
+      }
+    }
+  });
+  std::vector<std::thread> threads;
+  for (auto t = 0; t < thread_count; t++) {
+    threads.emplace_back([&list, t] {
+      auto rnd = std::mt19937(t);
+      for (auto round = 0; round < rounds; round++) {
+        uint32_t key = rnd() % keys;
+        if (rnd() % 2 == 0) {
+          list.Put(key, key * 3);
+        } else {
+          list.Erase(key);
+        }
+      }
+      list.Reclaim();
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  stop.store(true);
+  reader.join();
+
+  // NOTE(shiwen): nothing erased is left linked, so the reclaimed nodes can
+  // be reused for other keys without breaking the order on any level.
+  for (uint32_t key = 0; key < keys; key++) {
+    list.Erase(key);
+  }
+  list.Reclaim();
+  list.Reclaim();
+  EXPECT_EQ(list.Count(), 0);
+  for (uint32_t key = keys; key < keys * 64; key++) {
+    EXPECT_TRUE(list.Put(key, key * 3));
+  }
+  uint32_t value;
+  for (uint32_t key = 0; key < keys * 64; key++) {
+    ASSERT_EQ(list.Get(key, value), key >= keys) << key;
+  }
+  auto iter = SkipList<uint32_t, uint32_t>::Iterator(&list);
+  uint32_t expected = keys;
+  for (iter.SeekToFirst(); iter.Valid(); iter.Next()) {
+    ASSERT_EQ(iter.key(), expected++);
+  }
+  EXPECT_EQ(expected, keys * 64);
+}
+
+template <typename T>
+concept HasStats = requires(const T& table) { table.GetStats(); };
+
+TEST(SkipListTest, Stats) {
+  EXPECT_EQ(LatencyHistogram::BucketOf(7), 7);
+  EXPECT_EQ(LatencyHistogram::BucketOf(8), 8);
+  EXPECT_EQ(LatencyHistogram::BucketOf(15), 15);
+  EXPECT_EQ(LatencyHistogram::BucketOf(16), 16);
+  EXPECT_EQ(LatencyHistogram::BucketOf(17), 16);
+  EXPECT_EQ(LatencyHistogram::BucketOf(UINT64_MAX),
+            LatencyHistogram::Kbuckets - 1);
+  for (size_t bucket = 0; bucket < LatencyHistogram::Kbuckets; bucket++) {
+    EXPECT_EQ(LatencyHistogram::BucketOf(LatencyHistogram::BucketFloor(bucket)),
+              bucket);
+  }
+  auto histogram = LatencyHistogram{};
+  for (uint64_t nanos = 1; nanos <= 1000; nanos++) {
+    histogram.Record(nanos);
+  }
+  EXPECT_EQ(histogram.Count(), 1000);
+  EXPECT_EQ(histogram.Max(), 1000);
+  EXPECT_DOUBLE_EQ(histogram.Mean(), 500.5);
+  EXPECT_NEAR(histogram.Percentile(0.5), 500, 500 / 8);
+  EXPECT_NEAR(histogram.Percentile(0.99), 990, 990 / 8);
+  EXPECT_EQ(histogram.Percentile(1), 1000 / 64 * 64);
+
+  // NOTE(shiwen): the default policy adds nothing to the list.
+  static_assert(std::is_empty_v<NoStats>);
+  static_assert(sizeof(SkipList<uint32_t, uint32_t>) ==
+                sizeof(SkipList<uint32_t, uint32_t, ConcurrentArena,
+                                DefaultComparator<uint32_t>,
+                                DefaultHeightPolicy, NoStats>));
+  static_assert(!HasStats<SkipList<uint32_t, uint32_t>>);
+
+  constexpr uint32_t scale = 1 << 12;
+  auto list = SkipList<uint32_t, uint32_t, ConcurrentArena,
+                       DefaultComparator<uint32_t>, DefaultHeightPolicy,
+                       ThreadStats>{};
+  auto naive = NaiveSkipList<uint32_t, uint32_t, Arena,
+                             DefaultComparator<uint32_t>, DefaultHeightPolicy,
+                             ThreadStats>{};
+  std::vector<std::thread> writers;
+  for (uint32_t t = 0; t < 4; t++) {
+    writers.emplace_back([&list, t] {
+      for (uint32_t i = t; i < scale; i += 4) {
+        list.Put((i * 7919) % scale, i);
+      }
+    });
+  }
+  for (auto& writer : writers) {
+    writer.join();
+  }
+  for (uint32_t i = 0; i < scale; i++) {
+    naive.Put((i * 7919) % scale, i);
+  }
+  EXPECT_FALSE(list.Put(0, 0));
+  EXPECT_FALSE(naive.Put(0, 0));
+  uint32_t value;
+  for (uint32_t key = 0; key < scale; key++) {
+    ASSERT_TRUE(list.Get(key, value));
+    ASSERT_TRUE(naive.Get(key, value));
+  }
+  for (uint32_t key = 0; key < scale; key += 2) {
+    EXPECT_TRUE(list.Erase(key));
+  }
+
+  auto check = [](const StatsSnapshot& stats, size_t count, size_t puts,
+                  size_t erased) {
+    uint64_t linked = 0;
+    for (auto height : stats.heights_) {
+      linked += height;
+    }
+    EXPECT_EQ(linked, count);
+    EXPECT_EQ(stats.duplicates_, 1);
+    EXPECT_GE(stats.allocations_, count + erased);
+    EXPECT_GT(stats.allocated_bytes_, stats.allocations_ * sizeof(void*));
+    EXPECT_GT(stats.Hops(), 0);
+    EXPECT_GT(stats.hops_[1], 0);
+    EXPECT_GE(stats.comparisons_, stats.Hops());
+    EXPECT_EQ(stats.Latency(StatsOp::Kput).Count(), puts);
+    EXPECT_EQ(stats.Latency(StatsOp::Kget).Count(), puts - 1);
+    EXPECT_EQ(stats.Latency(StatsOp::Kdelete).Count(), erased);
+    EXPECT_EQ(stats.Latency(StatsOp::Klock_wait).Count(), 0);
+    EXPECT_GE(stats.Latency(StatsOp::Kget).Max(),
+              stats.Latency(StatsOp::Kget).Percentile(0.99));
+  };
+  check(list.GetStats(), list.Count(), scale + 1, scale / 2);
+  check(naive.GetStats(), naive.Count(), scale + 1, 0);
+}
+
+TEST(MemTableTest, Stats) {
+  static_assert(!HasStats<MemTable<>>);
+
+  constexpr uint32_t scale = 1 << 12;
+  using StatsSkipList = SkipList<uint32_t, uint32_t, ConcurrentArena,
+                                 DefaultComparator<uint32_t>,
+                                 DefaultHeightPolicy, ThreadStats>;
+  auto mt = MemTable<uint32_t, uint32_t, NaiveSpinLock, StatsSkipList>{};
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < 4; t++) {
+    threads.emplace_back([&mt, t] {
+      for (uint32_t i = t; i < scale; i += 4) {
+        mt.Put(i, i);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_TRUE(mt.Delete(1));
+  auto batch = WriteBatch<>{};
+  batch.Put(2, 3);
+  EXPECT_TRUE(mt.Write(batch));
+  uint32_t value;
+  EXPECT_TRUE(mt.Get(2, value));
+  EXPECT_FALSE(mt.Get(1, value));
+
+  auto stats = mt.GetStats();
+  EXPECT_EQ(stats.Latency(StatsOp::Kput).Count(), scale);
+  EXPECT_EQ(stats.Latency(StatsOp::Kdelete).Count(), 1);
+  EXPECT_EQ(stats.Latency(StatsOp::Kget).Count(), 2);
+  EXPECT_EQ(stats.Latency(StatsOp::Klock_wait).Count(), scale + 2);
+  // NOTE(shiwen): every write is a new version, nothing is overwritten.
+  EXPECT_EQ(stats.duplicates_, 0);
+  uint64_t linked = 0;
+  for (auto height : stats.heights_) {
+    linked += height;
+  }
+  EXPECT_EQ(linked, mt.Count());
+  EXPECT_GT(stats.comparisons_, 0);
+}
+
+TEST(MemTableTest, ScanStepsOverVersions) {
+  constexpr uint32_t scale = 1 << 12;
+  using StatsSkipList = SkipList<uint32_t, uint32_t, ConcurrentArena,
+                                 DefaultComparator<uint32_t>,
+                                 DefaultHeightPolicy, ThreadStats>;
+  using StatsMemTable =
+      MemTable<uint32_t, uint32_t, NaiveSpinLock, StatsSkipList>;
+  auto mt = StatsMemTable{};
+  for (uint32_t i = 0; i < scale; i++) {
+    mt.Put(i, i);
+  }
+  auto old = mt.GetSnapshot();
+  for (uint32_t version = 1; version <= 3; version++) {
+    for (uint32_t i = 0; i < scale; i++) {
+      mt.Put(i, i + version);
+    }
+  }
+  // NOTE(shiwen): more versions than a scan steps over before it seeks.
+  for (uint32_t version = 4; version <= 64; version++) {
+    mt.Put(scale / 2, scale / 2 + version);
+  }
+
+  auto scan = [&](const StatsMemTable::Snapshot& snapshot, uint32_t newest,
+                  uint32_t newest_middle) {
+    auto hops = mt.GetStats().Hops();
+    uint32_t expected = 0;
+    mt.Scan(
+        0, scale,
+        [&](uint32_t key, uint32_t value) {
+          EXPECT_EQ(key, expected);
+          EXPECT_EQ(value, key + (key == scale / 2 ? newest_middle : newest));
+          expected++;
+        },
+        snapshot);
+    EXPECT_EQ(expected, scale);
+    return mt.GetStats().Hops() - hops;
+  };
+  auto newest_hops = scan(mt.GetSnapshot(), 3, 64);
+  auto old_hops = scan(old, 0, 0);
+  // NOTE(shiwen): the versions are stepped over, only the first key and the
+  // long run of versions are sought.
+  EXPECT_LT(newest_hops, scale / 16);
+  EXPECT_LT(old_hops, scale / 16);
+}
+
+TEST(MemTableTest, Rotation) {
+  constexpr size_t write_buffer_size = 4 << 20;
+  constexpr uint32_t scale = 1 << 18;
+  auto mt = RotatingMemTable<>{write_buffer_size};
+  uint32_t value;
+
+  for (uint32_t i = 0; i < scale; i++) {
+    mt.Put(i, i);
+  }
+  auto before = mt.GetSnapshot();
+  auto tables = mt.Immutables();
+  ASSERT_GE(tables.size(), 2);
+  for (const auto& table : tables) {
+    EXPECT_GE(table->ApproximateMemoryUsage(), write_buffer_size);
+  }
+  EXPECT_GE(mt.ApproximateMemoryUsage(), tables.size() * write_buffer_size);
+
+  // NOTE(shiwen): the oldest keys live in the oldest table, newer tables
+  // overwrite and delete them.
+  mt.Put(0, 100);
+  mt.Delete(1);
+  mt.DeleteRange(2, 10);
+  mt.Put(5, 500);
+  for (uint32_t i = 0; i < scale; i++) {
+    auto deleted = i == 1 || (i >= 2 && i < 10 && i != 5);
+    EXPECT_EQ(mt.Get(i, value), !deleted) << i;
+    EXPECT_TRUE(mt.Get(i, value, before));
+    EXPECT_EQ(value, i);
+  }
+  EXPECT_TRUE(mt.Get(0, value));
+  EXPECT_EQ(value, 100);
+  EXPECT_TRUE(mt.Get(5, value));
+  EXPECT_EQ(value, 500);
+  EXPECT_FALSE(mt.Get(scale, value));
+
+  auto sealed = mt.Immutables().size();
+  mt.PopOldestImmutable();
+  EXPECT_EQ(mt.Immutables().size(), sealed - 1);
+  EXPECT_FALSE(mt.Get(3, value, before));
+  // NOTE(shiwen): tables already loaded outlive the pop.
+  EXPECT_TRUE(tables.back()->Get(3, value));
+  EXPECT_EQ(value, 3);
+}
+
+template <typename L>
+void CheckMutualExclusion() {
+  constexpr int thread_count = 4;
+  constexpr int rounds = 10000;
+  L lock;
+  uint64_t counter = 0;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < thread_count; t++) {
+    threads.emplace_back([&] {
+      for (int i = 0; i < rounds; i++) {
+        lock.lock();
+        counter++;
+        lock.unlock();
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(counter, thread_count * rounds);
+  EXPECT_TRUE(lock.try_lock());
+  lock.unlock();
+}
+
+TEST(LockTest, MutualExclusion) {
+  CheckMutualExclusion<NaiveSpinLock>();
+  CheckMutualExclusion<BackoffSpinLock>();
+  CheckMutualExclusion<TicketLock>();
+  CheckMutualExclusion<McsLock>();
+  CheckMutualExclusion<SharedSpinLock>();
+  CheckMutualExclusion<InstrumentedLock<McsLock>>();
+  CheckMutualExclusion<InstrumentedLock<std::mutex>>();
+
+  // NOTE(shiwen): try_lock fails while held, MCS locks nest.
+  TicketLock ticket;
+  ticket.lock();
+  EXPECT_FALSE(ticket.try_lock());
+  ticket.unlock();
+  McsLock outer;
+  McsLock inner;
+  outer.lock();
+  EXPECT_FALSE(outer.try_lock());
+  inner.lock();
+  inner.unlock();
+  outer.unlock();
+  EXPECT_TRUE(outer.try_lock());
+  outer.unlock();
+}
+
+TEST(LockTest, SharedSpinLock) {
+  SharedSpinLock lock;
+  lock.lock_shared();
+  EXPECT_TRUE(lock.try_lock_shared());
+  EXPECT_FALSE(lock.try_lock());
+  lock.unlock_shared();
+  lock.unlock_shared();
+  EXPECT_TRUE(lock.try_lock());
+  EXPECT_FALSE(lock.try_lock_shared());
+  lock.unlock();
+
+  // NOTE(shiwen): writers see the pair always equal, readers too.
+  uint64_t first = 0;
+  uint64_t second = 0;
+  std::atomic<bool> torn{false};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < 10000; i++) {
+        if (t % 2 == 0) {
+          lock.lock();
+          first++;
+          second++;
+          lock.unlock();
+        } else {
+          lock.lock_shared();
+          if (first != second) {
+            torn = true;
+          }
+          lock.unlock_shared();
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_FALSE(torn);
+  EXPECT_EQ(first, 20000);
+}
+
+TEST(LockTest, InstrumentedMemTable) {
+  constexpr uint32_t scale = 1 << 14;
+  auto mt = MemTable<uint32_t, uint32_t, InstrumentedLock<TicketLock>>{};
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < 4; t++) {
+    threads.emplace_back([&mt, t] {
+      for (uint32_t i = t; i < scale; i += 4) {
+        mt.Put(i, i);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  auto stats = mt.StateLock().Stats();
+  EXPECT_EQ(stats.acquisitions_, scale);
+  EXPECT_LE(stats.contended_, stats.acquisitions_);
+  uint64_t timed = 0;
+  for (auto count : stats.wait_histogram_) {
+    timed += count;
+  }
+  EXPECT_EQ(timed, stats.contended_);
+  EXPECT_GE(stats.wait_nanos_, stats.max_wait_nanos_);
+  uint32_t value;
+  EXPECT_TRUE(mt.Get(scale - 1, value));
+
+  auto mcs = MemTable<uint32_t, uint32_t, McsLock>{};
+  auto batch = WriteBatch<>{};
+  batch.Put(1, 1);
+  batch.Put(2, 2);
+  EXPECT_TRUE(mcs.Write(batch));
+  EXPECT_TRUE(mcs.Get(2, value));
+}
+
+TEST(MemTableTest, FlatCombining) {
+  constexpr uint32_t scale = 1 << 15;
+  constexpr uint32_t thread_count = 4;
+  auto mt = FlatCombiningMemTable<>{};
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < thread_count; t++) {
+    threads.emplace_back([&mt, t] {
+      for (uint32_t i = t; i < scale; i += thread_count) {
+        EXPECT_TRUE(mt.Put(i, i));
+        if (i % 3 == 0) {
+          EXPECT_TRUE(mt.Delete(i));
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  uint32_t value;
+  for (uint32_t i = 0; i < scale; i++) {
+    ASSERT_EQ(mt.Get(i, value), i % 3 != 0) << i;
+    if (i % 3 != 0) {
+      EXPECT_EQ(value, i);
+    }
+  }
+  auto operations = scale + (scale + 2) / 3;
+  EXPECT_EQ(mt.LastSequence(), operations);
+  EXPECT_EQ(mt.CombinedOperations(), operations);
+  EXPECT_LE(mt.Combines(), operations);
+
+  // NOTE(shiwen): byte strings and a Wal go through the combined batches.
+  auto path = testing::TempDir() + "flat_combining_wal";
+  std::remove(path.c_str());
+  {
+    auto wal = Wal::Open(path, WalOptions{WalSyncPolicy::Knone});
+    auto strings =
+        FlatCombiningMemTable<MemTable<std::string_view, std::string_view>>{
+            0, wal.get()};
+    std::vector<std::thread> writers;
+    for (uint32_t t = 0; t < thread_count; t++) {
+      writers.emplace_back([&strings, t] {
+        for (uint32_t i = 0; i < 1000; i++) {
+          auto key = std::to_string(t) + "/" + std::to_string(i);
+          EXPECT_TRUE(strings.Put(key, key + "!"));
+        }
+      });
+    }
+    for (auto& writer : writers) {
+      writer.join();
+    }
+    std::string_view text;
+    EXPECT_TRUE(strings.Get("3/999", text));
+    EXPECT_EQ(text, "3/999!");
+  }
+  auto recovered = MemTable<std::string_view, std::string_view>{};
+  auto stats = recovered.Recover(path, 2);
+  EXPECT_TRUE(stats.ok_);
+  EXPECT_EQ(stats.operations_, thread_count * 1000);
+  std::string_view text;
+  EXPECT_TRUE(recovered.Get("2/500", text));
+  EXPECT_EQ(text, "2/500!");
+
+  auto rotating = RotatingMemTable<FlatCombiningMemTable<>>{4 << 20};
+  for (uint32_t i = 0; i < scale * 8; i++) {
+    rotating.Put(i, i);
+  }
+  EXPECT_GE(rotating.Immutables().size(), 1);
+  EXPECT_TRUE(rotating.Get(11, value));
+}
+
+TEST(MemTableTest, Sharded) {
+  constexpr uint32_t scale = 1 << 16;
+  constexpr int thread_count = 4;
+  auto mt = ShardedMemTable<>{{1000, 20000, 40000}};
+  EXPECT_EQ(mt.Shards(), 4);
+  uint32_t value;
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < thread_count; t++) {
+    threads.emplace_back([&mt, t] {
+      for (uint32_t i = t; i < scale; i += thread_count) {
+        mt.Put(i, i);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(mt.Count(), scale);
+  EXPECT_EQ(mt.LastSequence(), scale);
+  auto before = mt.GetSnapshot();
+  EXPECT_EQ(before.sequence_, scale);
+
+  // NOTE(shiwen): a batch and a range tombstone spanning every shard.
+  auto batch = WriteBatch<>{};
+  for (uint32_t i = 0; i < scale; i += 997) {
+    batch.Put(i, i + 1);
+  }
+  batch.Delete(40000);
+  EXPECT_TRUE(mt.Write(batch));
+  EXPECT_TRUE(mt.DeleteRange(999, 20001));
+  for (uint32_t i = 0; i < scale; i++) {
+    auto deleted = i == 40000 || (i >= 999 && i < 20001);
+    ASSERT_EQ(mt.Get(i, value), !deleted) << i;
+    if (!deleted) {
+      EXPECT_EQ(value, i % 997 == 0 ? i + 1 : i);
+    }
+    ASSERT_TRUE(mt.Get(i, value, before));
+    EXPECT_EQ(value, i);
+  }
+
+  uint32_t keys[] = {5, 1500, 30000, 50000, 40000, scale};
+  uint32_t values[6];
+  bool found[6];
+  EXPECT_EQ(mt.MultiGet(keys, values, found), 3);
+  EXPECT_TRUE(found[0] && !found[1] && found[2] && found[3]);
+  EXPECT_FALSE(found[4] || found[5]);
+  EXPECT_EQ(values[3], 50000);
+
+  // NOTE(shiwen): a scan crosses shards in key order and stops when asked.
+  uint32_t next = 900;
+  mt.Scan(900, 45000, [&](const uint32_t& key, const uint32_t&) {
+    EXPECT_EQ(key, next);
+    next = next == 998 ? 20001 : (next == 39999 ? 40001 : next + 1);
+  });
+  EXPECT_EQ(next, 45000);
+  auto visited = 0;
+  mt.Scan(0, scale, [&](const uint32_t&, const uint32_t&) {
+    return ++visited < 1500;
+  });
+  EXPECT_EQ(visited, 1500);
+
+  // NOTE(shiwen): writes crowded into [0, 1000) move the successor's split
+  // points there.
+  for (uint32_t round = 0; round < 128; round++) {
+    for (uint32_t i = 0; i < 1000; i++) {
+      mt.Put(i, round);
+    }
+  }
+  auto next_table = mt.Successor();
+  EXPECT_EQ(next_table->LastSequence(), mt.LastSequence());
+  const auto& splits = next_table->SplitPoints();
+  ASSERT_EQ(splits.size(), 3);
+  EXPECT_LT(splits[1], 1000);
+  EXPECT_TRUE(std::is_sorted(splits.begin(), splits.end()));
+
+  auto even = ShardedMemTable<>::SplitsFromSample(
+      std::vector<uint32_t>{1, 2, 3, 4, 5, 6, 7, 8}, 4);
+  EXPECT_EQ(even, (std::vector<uint32_t>{3, 5, 7}));
+
+  auto rotating = RotatingMemTable<ShardedMemTable<>>{4 << 20};
+  for (uint32_t i = 0; i < scale * 4; i++) {
+    rotating.Put(i, i);
+  }
+  EXPECT_GE(rotating.Immutables().size(), 1);
+  EXPECT_TRUE(rotating.Get(7, value));
+  EXPECT_EQ(value, 7);
+}
+
+TEST(MemTableTest, ShardedLockFreeSample) {
+  constexpr uint32_t scale = 1 << 16;
+  constexpr int thread_count = 4;
+  using LockFreeMemTable =
+      MemTable<uint32_t, uint32_t, NoLock, SkipList<uint32_t, uint32_t>>;
+  auto mt = ShardedMemTable<LockFreeMemTable>{{}};
+  std::atomic<bool> done{false};
+
+  // NOTE(shiwen): writers without a table lock sample into the one shard
+  // while its sample is read.
+  std::vector<std::thread> threads;
+  for (int t = 0; t < thread_count; t++) {
+    threads.emplace_back([&mt, t] {
+      for (uint32_t i = t; i < scale; i += thread_count) {
+        mt.Put(i, i);
+      }
+    });
+  }
+  std::thread reader([&mt, &done] {
+    while (!done.load(std::memory_order_relaxed)) {
+      auto next_table = mt.Successor();
+      EXPECT_TRUE(std::is_sorted(next_table->SplitPoints().begin(),
+                                 next_table->SplitPoints().end()));
+    }
+  });
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  done.store(true, std::memory_order_relaxed);
+  reader.join();
+  EXPECT_EQ(mt.Count(), scale);
+}
+
+TEST(SortedRunTest, FlushAndRead) {
+  EXPECT_EQ(Crc32c("123456789", 9), 0xE3069283);
+  EXPECT_EQ(UnmaskCrc(MaskCrc(0xE3069283)), 0xE3069283);
+
+  auto mt = MemTable<>{};
+  constexpr uint32_t scale = 10000;
+  for (uint32_t i = 0; i < scale; i++) {
+    mt.Put(i * 2, i);
+  }
+  auto snapshot = mt.GetSnapshot();
+  mt.Delete(10);
+  mt.DeleteRange(100, 200);
+  mt.Put(150, 1500);
+
+  auto path = testing::TempDir() + "sorted_run_flush";
+  ASSERT_TRUE(WriteSortedRun(mt, path));
+  auto run = SortedRunReader<>::Open(path);
+  ASSERT_NE(run, nullptr);
+  EXPECT_EQ(run->Count(), scale);
+  EXPECT_TRUE(run->VerifyChecksums());
+
+  uint32_t value;
+  for (uint32_t i = 0; i < scale * 2; i++) {
+    auto expected = LookupResult::Knot_found;
+    if (i == 10 || (i >= 100 && i < 200 && i != 150)) {
+      expected = i % 2 == 0 ? LookupResult::Kdeleted : expected;
+    } else if (i % 2 == 0 || i == 150) {
+      expected = LookupResult::Kfound;
+    }
+    ASSERT_EQ(run->Lookup(i, value), expected) << i;
+    if (expected == LookupResult::Kfound) {
+      EXPECT_EQ(value, i == 150 ? 1500 : i / 2);
+    }
+  }
+
+  uint32_t count = 0;
+  uint32_t last = 0;
+  run->Scan(90, 300, [&](const uint32_t& key, const uint32_t&) {
+    EXPECT_TRUE(count == 0 || key > last);
+    last = key;
+    count++;
+  });
+  // NOTE(shiwen): 90..98, 150 and 200..298.
+  EXPECT_EQ(count, 5 + 1 + 50);
+
+  // NOTE(shiwen): a snapshot flush ignores the later writes.
+  ASSERT_TRUE(WriteSortedRun(mt, path, snapshot));
+  run = SortedRunReader<>::Open(path);
+  ASSERT_NE(run, nullptr);
+  EXPECT_TRUE(run->Get(10, value));
+  EXPECT_EQ(value, 5);
+  EXPECT_TRUE(run->Get(150, value));
+  EXPECT_EQ(value, 75);
+
+  // NOTE(shiwen): flip a byte of the first data block.
+  run.reset();
+  {
+    auto file = std::fopen(path.c_str(), "r+b");
+    ASSERT_NE(file, nullptr);
+    std::fseek(file, 3, SEEK_SET);
+    auto byte = std::fgetc(file);
+    std::fseek(file, 3, SEEK_SET);
+    std::fputc(byte ^ 0xFF, file);
+    std::fclose(file);
+  }
+  run = SortedRunReader<>::Open(path);
+  ASSERT_NE(run, nullptr);
+  EXPECT_FALSE(run->VerifyChecksums());
+  run.reset();
+  {
+    auto file = std::fopen(path.c_str(), "r+b");
+    ASSERT_NE(file, nullptr);
+    std::fseek(file, -1, SEEK_END);
+    std::fputc(0, file);
+    std::fclose(file);
+  }
+  EXPECT_EQ(SortedRunReader<>::Open(path), nullptr);
+  std::remove(path.c_str());
+
+  auto writer = SortedRunWriter<>{};
+  ASSERT_TRUE(writer.Open(path));
+  EXPECT_TRUE(writer.Add(2, 2));
+  EXPECT_FALSE(writer.Add(1, 1));
+  EXPECT_FALSE(writer.Finish());
+}
+
+TEST(SortedRunTest, ByteStrings) {
+  auto mt = MemTable<std::string_view, std::string_view>{};
+  for (int i = 0; i < 1000; i++) {
+    auto key = "key" + std::to_string(1000 + i);
+    mt.Put(key, std::string(i % 100, 'v'));
+  }
+  mt.Delete("key1500");
+
+  auto path = testing::TempDir() + "sorted_run_bytes";
+  ASSERT_TRUE(WriteSortedRun(mt, path));
+  auto run = SortedRunReader<std::string_view, std::string_view>::Open(path);
+  ASSERT_NE(run, nullptr);
+  EXPECT_TRUE(run->VerifyChecksums());
+  std::string_view value;
+  EXPECT_TRUE(run->Get("key1000", value));
+  EXPECT_EQ(value, "");
+  EXPECT_TRUE(run->Get("key1999", value));
+  EXPECT_EQ(value, std::string(99, 'v'));
+  EXPECT_EQ(run->Lookup("key1500", value), LookupResult::Kdeleted);
+  EXPECT_EQ(run->Lookup("key2000", value), LookupResult::Knot_found);
+  EXPECT_EQ(run->Lookup("a", value), LookupResult::Knot_found);
+
+  auto iter = decltype(run)::element_type::Iterator(run.get());
+  uint32_t count = 0;
+  for (iter.SeekToFirst(); iter.Valid(); iter.Next()) {
+    count += !iter.deleted();
+  }
+  EXPECT_EQ(count, 999);
+
+  // NOTE(shiwen): give the first key a size past the end of its block.
+  run.reset();
+  {
+    auto file = std::fopen(path.c_str(), "r+b");
+    ASSERT_NE(file, nullptr);
+    std::fseek(file, 1, SEEK_SET);
+    for (auto byte : {0xFF, 0xFF, 0xFF, 0x0F}) {
+      std::fputc(byte, file);
+    }
+    std::fclose(file);
+  }
+  run = SortedRunReader<std::string_view, std::string_view>::Open(path);
+  ASSERT_NE(run, nullptr);
+  EXPECT_EQ(run->Lookup("key1000", value), LookupResult::Kcorruption);
+  EXPECT_TRUE(run->Get("key1999", value));
+  iter = decltype(run)::element_type::Iterator(run.get());
+  iter.SeekToFirst();
+  EXPECT_FALSE(iter.Valid());
+  EXPECT_TRUE(iter.Corrupted());
+  EXPECT_FALSE(run->Scan("a", "z", [](std::string_view, std::string_view) {}));
+  run.reset();
+  std::remove(path.c_str());
+}
+
+auto ReadFile(const std::string& path) -> std::string {
+  auto file = std::fopen(path.c_str(), "rb");
+  std::string contents;
+  char buf[4096];
+  size_t n;
+  while ((n = std::fread(buf, 1, sizeof(buf), file)) > 0) {
+    contents.append(buf, n);
+  }
+  std::fclose(file);
+  return contents;
+}
+
+TEST(WalTest, Records) {
+  auto path = testing::TempDir() + "wal_records";
+  std::remove(path.c_str());
+  std::vector<std::string> records;
+  for (auto size : {0, 10, Kwal_block_size - 2 * Kwal_header_size, 1,
+                    3 * Kwal_block_size, 100}) {
+    records.push_back(std::string(size, static_cast<char>('a' + size % 26)));
+  }
+  {
+    auto wal = Wal::Open(path, WalOptions{WalSyncPolicy::Knone});
+    ASSERT_NE(wal, nullptr);
+    for (const auto& record : records) {
+      EXPECT_TRUE(wal->Append(record));
+    }
+  }
+
+  auto log = ReadFile(path);
+  std::string_view record;
+  std::string scratch;
+  {
+    auto reader = WalReader(log);
+    for (const auto& expected : records) {
+      ASSERT_TRUE(reader.ReadRecord(&record, &scratch));
+      EXPECT_EQ(record, expected);
+    }
+    EXPECT_FALSE(reader.ReadRecord(&record, &scratch));
+    EXPECT_EQ(reader.Dropped(), 0);
+  }
+
+  // NOTE(shiwen): a torn tail is ignored, a corrupt fragment drops the rest
+  // of its block, here records 1 and the part of 2 in the first block.
+  log.resize(log.size() - 50);
+  log[Kwal_header_size + 2] ^= 1;
+  auto reader = WalReader(log);
+  for (auto i : {0, 3, 4}) {
+    ASSERT_TRUE(reader.ReadRecord(&record, &scratch));
+    EXPECT_EQ(record, records[i]);
+  }
+  EXPECT_FALSE(reader.ReadRecord(&record, &scratch));
+  EXPECT_GT(reader.Dropped(), 0);
+  std::remove(path.c_str());
+}
+
+TEST(WalTest, MemTableGroupCommit) {
+  auto path = testing::TempDir() + "wal_memtable";
+  std::remove(path.c_str());
+  constexpr int num_threads = 4;
+  constexpr uint32_t per_thread = 500;
+  auto mt = MemTable<>{};
+  {
+    auto wal = Wal::Open(path);
+    ASSERT_NE(wal, nullptr);
+    auto logged = MemTable<>{0, wal.get()};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; t++) {
+      threads.emplace_back([&logged, t] {
+        for (uint32_t i = 0; i < per_thread; i++) {
+          auto key = i * num_threads + t;
+          EXPECT_TRUE(logged.Put(key, key));
+          if (key % 7 == 0) {
+            EXPECT_TRUE(logged.Delete(key));
+          }
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    auto batch = WriteBatch<>{};
+    batch.Put(3, 300);
+    batch.Delete(5);
+    EXPECT_TRUE(logged.Write(batch));
+    EXPECT_TRUE(logged.DeleteRange(100, 200));
+
+    // NOTE(shiwen): replay the log in sequence order into mt.
+    auto log = ReadFile(path);
+    auto reader = WalReader(log);
+    std::string_view record;
+    std::string scratch;
+    std::vector<std::tuple<uint64_t, WalOpType, uint32_t, uint32_t>> ops;
+    while (reader.ReadRecord(&record, &scratch)) {
+      EXPECT_TRUE(DecodeWalRecord(
+          record, [&ops](WalOpType type, uint64_t sequence,
+                         std::string_view key, std::string_view value) {
+            ops.emplace_back(
+                sequence, type, ObjectFromBytes<uint32_t>(key),
+                value.empty() ? 0 : ObjectFromBytes<uint32_t>(value));
+          }));
+    }
+    EXPECT_EQ(ops.size(), logged.LastSequence());
+    std::sort(ops.begin(), ops.end());
+    for (const auto& [sequence, type, key, value] : ops) {
+      if (type == WalOpType::Kput) {
+        mt.Put(key, value);
+      } else if (type == WalOpType::Kdelete) {
+        mt.Delete(key);
+      } else {
+        mt.DeleteRange(key, value);
+      }
+    }
+
+    uint32_t expected;
+    uint32_t value;
+    for (uint32_t key = 0; key < num_threads * per_thread; key++) {
+      auto found = logged.Get(key, expected);
+      ASSERT_EQ(mt.Get(key, value), found) << key;
+      if (found) {
+        EXPECT_EQ(value, expected);
+      }
+    }
+  }
+
+  // NOTE(shiwen): reopening appends behind the existing records.
+  {
+    auto wal =
+        Wal::Open(path, WalOptions{WalSyncPolicy::Kinterval,
+                                   std::chrono::milliseconds(1)});
+    ASSERT_NE(wal, nullptr);
+    auto logged = MemTable<>{mt.LastSequence(), wal.get()};
+    EXPECT_TRUE(logged.Put(1, 1));
+  }
+  auto log = ReadFile(path);
+  auto reader = WalReader(log);
+  std::string_view record;
+  std::string scratch;
+  uint64_t last = 0;
+  while (reader.ReadRecord(&record, &scratch)) {
+    DecodeWalRecord(record, [&last](WalOpType, uint64_t sequence,
+                                    std::string_view, std::string_view) {
+      last = std::max(last, sequence);
+    });
+  }
+  EXPECT_EQ(last, mt.LastSequence() + 1);
+  EXPECT_EQ(reader.Dropped(), 0);
+  std::remove(path.c_str());
+}
+
+TEST(WalTest, Recover) {
+  auto path = testing::TempDir() + "wal_recover";
+  std::remove(path.c_str());
+  auto mt = MemTable<>{};
+  {
+    auto wal = Wal::Open(path, WalOptions{WalSyncPolicy::Knone});
+    ASSERT_NE(wal, nullptr);
+    auto logged = MemTable<>{0, wal.get()};
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < 4; t++) {
+      threads.emplace_back([&logged, t] {
+        for (uint32_t i = 0; i < 20000; i++) {
+          logged.Put(i % 5000, i * 4 + t);
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    auto batch = WriteBatch<>{};
+    for (uint32_t key = 0; key < 5000; key += 3) {
+      batch.Delete(key);
+    }
+    logged.Write(batch);
+    logged.DeleteRange(1000, 2000);
+    logged.Put(1500, 1);
+
+    for (auto num_threads : {1, 3, 8}) {
+      auto recovered = MemTable<>{};
+      auto stats = recovered.Recover(path, num_threads);
+      ASSERT_TRUE(stats.ok_);
+      EXPECT_EQ(stats.dropped_bytes_, 0);
+      EXPECT_EQ(stats.operations_, logged.LastSequence());
+      EXPECT_EQ(stats.last_sequence_, logged.LastSequence());
+      EXPECT_EQ(recovered.LastSequence(), logged.LastSequence());
+      EXPECT_GT(stats.MegabytesPerSecond(), 0);
+      uint32_t expected;
+      uint32_t value;
+      for (uint32_t key = 0; key < 5000; key++) {
+        auto found = logged.Get(key, expected);
+        ASSERT_EQ(recovered.Get(key, value), found) << key;
+        if (found) {
+          EXPECT_EQ(value, expected);
+        }
+      }
+      EXPECT_TRUE(recovered.Put(7, 7));
+      EXPECT_EQ(recovered.LastSequence(), logged.LastSequence() + 1);
+    }
+  }
+  EXPECT_FALSE(mt.Recover(path + ".missing").ok_);
+  std::remove(path.c_str());
+
+  // NOTE(shiwen): byte strings, records spanning blocks and chunks.
+  {
+    auto wal = Wal::Open(path, WalOptions{WalSyncPolicy::Knone});
+    auto logged = MemTable<std::string_view, std::string_view>{0, wal.get()};
+    for (int i = 0; i < 200; i++) {
+      auto key = "key" + std::to_string(i);
+      logged.Put(key, std::string(i * 500, static_cast<char>('a' + i % 26)));
+    }
+    logged.Delete("key7");
+    auto recovered = MemTable<std::string_view, std::string_view>{};
+    auto stats = recovered.Recover(path, 8);
+    ASSERT_TRUE(stats.ok_);
+    EXPECT_EQ(stats.records_, 201);
+    std::string_view value;
+    for (int i = 0; i < 200; i++) {
+      auto key = "key" + std::to_string(i);
+      ASSERT_EQ(recovered.Get(key, value), i != 7) << i;
+      if (i != 7) {
+        EXPECT_EQ(value, std::string(i * 500,
+                                     static_cast<char>('a' + i % 26)));
+      }
+    }
+  }
+  std::remove(path.c_str());
+
+  // NOTE(shiwen): a record whose key is shorter than the key type is dropped
+  // as malformed, the records around it still recover.
+  size_t short_size = 0;
+  {
+    auto wal = Wal::Open(path, WalOptions{WalSyncPolicy::Knone});
+    ASSERT_NE(wal, nullptr);
+    uint32_t key = 1;
+    uint32_t value = 10;
+    std::string good;
+    EncodeWalHeader(good, 1, 1);
+    EncodeWalOp(good, WalOpType::Kput, ObjectBytes(key), ObjectBytes(value));
+    EXPECT_TRUE(wal->Append(good));
+    std::string short_key;
+    EncodeWalHeader(short_key, 2, 1);
+    EncodeWalOp(short_key, WalOpType::Kput, ObjectBytes(key).substr(0, 2),
+                ObjectBytes(value));
+    EXPECT_TRUE(wal->Append(short_key));
+    short_size = short_key.size();
+    key = 3;
+    std::string after;
+    EncodeWalHeader(after, 3, 1);
+    EncodeWalOp(after, WalOpType::Kput, ObjectBytes(key), ObjectBytes(value));
+    EXPECT_TRUE(wal->Append(after));
+  }
+  {
+    auto recovered = MemTable<>{};
+    auto stats = recovered.Recover(path, 2);
+    ASSERT_TRUE(stats.ok_);
+    EXPECT_EQ(stats.records_, 3);
+    EXPECT_EQ(stats.dropped_bytes_, short_size);
+    EXPECT_EQ(recovered.Count(), 2);
+    uint32_t value;
+    EXPECT_TRUE(recovered.Get(1, value));
+    EXPECT_EQ(value, 10);
+    EXPECT_TRUE(recovered.Get(3, value));
+  }
+  std::remove(path.c_str());
+}
+
+TEST(PersistentSkipListTest, Reopen) {
+  using List = PersistentSkipList<uint32_t, uint64_t>;
+  auto path = testing::TempDir() + "persistent_skip_list";
+  auto crash_path = path + ".crash";
+  std::remove(path.c_str());
+  EXPECT_EQ(List::Open(path), nullptr);
+
+  constexpr uint32_t scale = 1 << 14;
+  auto options = PersistentSkipListOptions{};
+  options.capacity_ = 4 << 20;
+  {
+    auto list = List::Create(path, options);
+    ASSERT_NE(list, nullptr);
+    EXPECT_FALSE(list->Dirty());
+    for (uint32_t i = 0; i < scale; i++) {
+      ASSERT_EQ(list->Put((i * 7919) % scale, i),
+                PersistentPutResult::Kinserted);
+    }
+    EXPECT_TRUE(list->Dirty());
+    EXPECT_EQ(list->Put(0, 42), PersistentPutResult::Kupdated);
+    EXPECT_EQ(list->Count(), scale);
+    EXPECT_TRUE(list->Sync());
+    EXPECT_FALSE(list->Dirty());
+  }
+
+  // NOTE(shiwen): a reopened list serves reads without loading anything.
+  {
+    auto list = List::Open(path, options);
+    ASSERT_NE(list, nullptr);
+    EXPECT_EQ(list->Count(), scale);
+    uint64_t value;
+    for (uint32_t i = 1; i < scale; i++) {
+      ASSERT_TRUE(list->Get((i * 7919) % scale, value));
+      EXPECT_EQ(value, i);
+    }
+    ASSERT_TRUE(list->Get(0, value));
+    EXPECT_EQ(value, 42);
+    EXPECT_FALSE(list->Get(scale, value));
+    auto iter = List::Iterator(list.get());
+    uint32_t expected = 0;
+    for (iter.SeekToFirst(); iter.Valid(); iter.Next()) {
+      EXPECT_EQ(iter.key(), expected++);
+    }
+    EXPECT_EQ(expected, scale);
+    iter.Seek(100);
+    ASSERT_TRUE(iter.Valid());
+    EXPECT_EQ(iter.key(), 100);
+
+    // NOTE(shiwen): a copy of a dirty file is what a crash leaves behind.
+    EXPECT_EQ(list->Put(scale, scale), PersistentPutResult::Kinserted);
+    auto file = std::fopen(crash_path.c_str(), "wb");
+    auto contents = ReadFile(path);
+    std::fwrite(contents.data(), 1, contents.size(), file);
+    std::fclose(file);
+  }
+  EXPECT_EQ(List::Open(crash_path, options), nullptr);
+  options.accept_dirty_ = true;
+  {
+    auto crashed = List::Open(crash_path, options);
+    ASSERT_NE(crashed, nullptr);
+    EXPECT_TRUE(crashed->Dirty());
+    uint64_t value;
+    ASSERT_TRUE(crashed->Get(scale, value));
+    EXPECT_EQ(value, scale);
+  }
+  // NOTE(shiwen): closed without a crash, the file is clean again.
+  options.accept_dirty_ = false;
+  EXPECT_NE(List::Open(crash_path, options), nullptr);
+
+  // NOTE(shiwen): the layout must match the one the file was made with.
+  EXPECT_EQ((PersistentSkipList<uint32_t, uint32_t>::Open(path)), nullptr);
+  EXPECT_EQ((PersistentSkipList<uint32_t, uint64_t, DefaultComparator<uint32_t>,
+                                uint64_t>::Open(path)),
+            nullptr);
+  std::remove(path.c_str());
+  std::remove(crash_path.c_str());
+}
+
+TEST(PersistentSkipListTest, Capacity) {
+  auto path = testing::TempDir() + "persistent_skip_list_small";
+  auto options = PersistentSkipListOptions{};
+  options.capacity_ = size_t{5} << 30;
+  EXPECT_EQ(PersistentSkipList<>::Create(path, options), nullptr);
+
+  // NOTE(shiwen): 64-bit offsets lift the 4 GiB limit, here a full file.
+  options.capacity_ = 4 << 10;
+  using WideList = PersistentSkipList<uint32_t, uint32_t,
+                                      DefaultComparator<uint32_t>, uint64_t>;
+  auto list = WideList::Create(path, options);
+  ASSERT_NE(list, nullptr);
+  uint32_t key = 0;
+  auto result = PersistentPutResult::Kinserted;
+  while ((result = list->Put(key, key)) == PersistentPutResult::Kinserted) {
+    key++;
+  }
+  EXPECT_EQ(result, PersistentPutResult::Kfailed);
+  EXPECT_GT(key, 0);
+  EXPECT_EQ(list->Count(), key);
+  EXPECT_LE(list->ApproximateMemoryUsage(), list->Capacity());
+  // NOTE(shiwen): a full file still takes updates in place.
+  EXPECT_EQ(list->Put(0, 7), PersistentPutResult::Kupdated);
+  uint32_t value;
+  ASSERT_TRUE(list->Get(0, value));
+  EXPECT_EQ(value, 7);
+  EXPECT_FALSE(list->Get(key, value));
+  list.reset();
+  std::remove(path.c_str());
+}
+
 TEST(MemTableTest, ScalePutGetv1) {
   auto mt = MemTable<uint32_t, uint32_t, NaiveSpinLock,
                      SkipList<uint32_t, uint32_t>>{};
@@ -366,4 +2436,67 @@ TEST(MemTableTest, ScalePutGetv4) {
   for (int i = 0; i < scale; i++) {
     EXPECT_FALSE(mt.Get(keys[i], value));
   }
-}
\ No newline at end of file
+}
+
+TEST(MemTableTest, ConcurrentPutGet) {
+  auto mt =
+      MemTable<uint32_t, uint32_t, NoLock, SkipList<uint32_t, uint32_t>>{};
+  constexpr int scale = 32768;
+  constexpr int num_search_threads = 4;
+  constexpr int num_insert_threads = 4;
+  std::atomic<bool> stop_flag{false};
+
+  std::vector<int> keys(scale);
+  for (int i = 0; i < scale; i++) {
+    keys[i] = i + 1;
+  }
+  std::random_device rd;
+  std::shuffle(keys.begin(), keys.end(), std::mt19937(rd()));
+
+  auto search_worker = [&mt, &stop_flag, &keys]() {
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::uniform_int_distribution<> dis(0, scale - 1);
+
+    while (!stop_flag.load()) {
+      int key = keys[dis(gen)];
+      uint32_t value;
+      if (mt.Get(key, value)) {
+        EXPECT_EQ(value, key);
+      }
+    }
+  };
+
+  // NOTE(shiwen): no lock at all, the writers race on the CAS.
+  auto insert_worker = [&mt, &keys](int thread_id) {
+    for (int i = thread_id; i < scale; i += num_insert_threads) {
+      EXPECT_TRUE(mt.Put(keys[i], keys[i]));
+    }
+  };
+
+  std::vector<std::thread> search_threads;
+  for (int i = 0; i < num_search_threads; i++) {
+    search_threads.emplace_back(search_worker);
+  }
+
+  std::vector<std::thread> insert_threads;
+  for (int i = 0; i < num_insert_threads; i++) {
+    insert_threads.emplace_back(insert_worker, i);
+  }
+
+  for (auto& t : insert_threads) {
+    t.join();
+  }
+
+  stop_flag.store(true);
+
+  for (auto& t : search_threads) {
+    t.join();
+  }
+
+  uint32_t value;
+  for (int i = 0; i < scale; i++) {
+    EXPECT_TRUE(mt.Get(keys[i], value));
+    EXPECT_EQ(value, keys[i]);
+  }
+}